@@ -0,0 +1,30 @@
+#include <cstdlib>
+#include <new>
+
+#include "Allocations.h"
+
+using namespace std;
+
+/*
+ * Heap allocation counting
+ */
+
+atomic<unsigned long> g_allocations(0);
+
+void* operator new(size_t size)
+{
+  g_allocations.fetch_add(1, memory_order_relaxed);
+  if (void* ptr = malloc(size ? size : 1))
+    return ptr;
+  throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+  free(ptr);
+}
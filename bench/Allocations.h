@@ -0,0 +1,19 @@
+#ifndef _MSCTRL_BENCH_ALLOCATIONS_H
+#define _MSCTRL_BENCH_ALLOCATIONS_H
+
+#include <atomic>
+
+/**
+ * Number of heap allocations made through operator new, by all
+ * threads. The replacement operators live in their own translation
+ * unit so that their malloc() and free() are not inlined into the
+ * callers, which GCC reports as mismatched allocations.
+ */
+extern std::atomic<unsigned long> g_allocations;
+
+inline unsigned long allocation_count()
+{
+  return g_allocations.load(std::memory_order_relaxed);
+}
+
+#endif /* _MSCTRL_BENCH_ALLOCATIONS_H */
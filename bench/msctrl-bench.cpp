@@ -0,0 +1,2121 @@
+
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <list>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <nlohmann/json.hpp>
+
+#include "src/Controller.h"
+#include "src/SDLMain.h"
+#include "src/MasterSystem.h"
+#include "src/NullBackend.h"
+#include "src/MemoryBackend.h"
+#include "src/SerialBackend.h"
+#include "src/RingBackend.h"
+#include "src/RingServer.h"
+#include "src/ButtonMap.h"
+#include "src/HatMap.h"
+#include "src/AxisMap.h"
+#include "src/GyroMap.h"
+#include "src/EventLog.h"
+#include "src/IMUIntegrator.h"
+#include "src/Paddle.h"
+#include "src/SportsPad.h"
+#include "src/MegaDrivePad.h"
+#include "src/UDPInput.h"
+#include "src/UDPSender.h"
+#include "src/SonyReport.h"
+#include "src/utils.h"
+#include "bench/Allocations.h"
+
+using namespace std;
+using namespace MSCtrl;
+
+/*
+ * Exit status of a mode whose checks failed. The timing harnesses need
+ * a CPU per thread; on a smaller machine a failure may only be
+ * preemption, and this status makes CTest report the test as skipped.
+ */
+
+static const int SkipStatus = 77;
+
+static int failure_status(unsigned cpus)
+{
+  return (thread::hardware_concurrency() < cpus) ? SkipStatus : 1;
+}
+
+/*
+ * Retired instructions from the perf counters, if the kernel lets us
+ */
+
+class InstructionCounter
+{
+public:
+  InstructionCounter()
+    : m_fd(-1) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    m_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (m_fd < 0)
+      spdlog::warn("Instruction counter unavailable: {}", strerror(errno));
+  }
+
+  ~InstructionCounter() {
+    if (m_fd >= 0)
+      close(m_fd);
+  }
+
+  bool available() const {
+    return m_fd >= 0;
+  }
+
+  void start() {
+    if (m_fd >= 0) {
+      ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  uint64_t stop() {
+    uint64_t count = 0;
+    if (m_fd >= 0) {
+      ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+    }
+    return count;
+  }
+
+private:
+  int m_fd;
+};
+
+class Bench
+{
+public:
+  Bench(unsigned count)
+    : m_count(count),
+      m_instructions() {
+    cout << fmt::format("{:<24} {:>10} {:>10} {:>12} {:>12}", "Benchmark", "Events", "ns/event", "instr/event", "allocs/event") << endl;
+  }
+
+  /**
+   * Run a benchmark
+   * @param name Benchmark name
+   * @param setup Called before the timed run (warm up, calibration)
+   * @param event Called for each event, with the event index
+   */
+  void run(const string& name, const function<void ()>& setup, const function<void (unsigned)>& event) {
+    setup();
+
+    unsigned long allocations = allocation_count();
+    m_instructions.start();
+    uint64_t start = monotonic_ns();
+
+    for (unsigned index = 0; index < m_count; ++index)
+      event(index);
+
+    uint64_t elapsed = monotonic_ns() - start;
+    uint64_t instructions = m_instructions.stop();
+    allocations = allocation_count() - allocations;
+
+    cout << fmt::format("{:<24} {:>10} {:>10.1f} {:>12} {:>12.3f}",
+                        name, m_count,
+                        1.0 * elapsed / m_count,
+                        m_instructions.available() ? fmt::format("{:.1f}", 1.0 * instructions / m_count) : string("n/a"),
+                        1.0 * allocations / m_count) << endl;
+  }
+
+private:
+  unsigned m_count;
+  InstructionCounter m_instructions;
+};
+
+/*
+ * Gyro integration accuracy: a recording of a known motion is replayed
+ * through the integrator, with the sensor timestamps at full (us)
+ * resolution and truncated to ms like SDL's event timestamp.
+ */
+
+class IMUAccuracy
+{
+public:
+  // Yaw oscillating +/- 45 degrees at 1.5 Hz, for 10 seconds
+  static constexpr double Amplitude = M_PI / 4;
+  static constexpr double Frequency = 1.5;
+  static constexpr double Duration = 10.0;
+
+  // Sensor clock origin, arbitrary
+  static constexpr uint64_t Origin = 123456789;
+
+  // Above the error with microsecond timestamps, below the one with
+  // millisecond ones
+  static constexpr double MaxError = 0.01;
+
+  IMUAccuracy()
+    : m_filename() {
+    char filename[] = "/tmp/msctrl-bench-XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0)
+      throw runtime_error(fmt::format("Cannot create temporary file: {}", strerror(errno)));
+    close(fd);
+    m_filename = filename;
+
+    cout << endl << fmt::format("{:<24} {:>10} {:>14} {:>14} {:>8}", "Gyro integration", "Rate (Hz)", "us error (deg)", "ms error (deg)", "Result") << endl;
+  }
+
+  ~IMUAccuracy() {
+    unlink(m_filename.c_str());
+  }
+
+  /**
+   * @return false if the error with microsecond timestamps is too large
+   */
+  bool run(unsigned rate) {
+    record(rate);
+
+    double error = replay(false);
+    cout << fmt::format("{:<24} {:>10} {:>14.3f} {:>14.3f} {:>8}", "Max angle error", rate, error, replay(true),
+                        (error <= MaxError) ? "ok" : "FAILED") << endl;
+    return error <= MaxError;
+  }
+
+private:
+  std::string m_filename;
+
+  static double angle(double t) {
+    return Amplitude * sin(2 * M_PI * Frequency * t);
+  }
+
+  static double angular_rate(double t) {
+    return Amplitude * 2 * M_PI * Frequency * cos(2 * M_PI * Frequency * t);
+  }
+
+  void record(unsigned rate) {
+    EventLogWriter writer(m_filename);
+    EventLog::Record record;
+
+    record.which = 0;
+    record.type = EventLog::RecordType::SensorUpdate;
+    record.code = SDL_SENSOR_GYRO;
+
+    // Sensor clock with a little jitter
+    unsigned count = Duration * rate;
+    for (unsigned index = 0; index < count; ++index) {
+      record.sensor_timestamp = Origin + 1000000ULL * index / rate + (index * 7919) % 41;
+      double t = (record.sensor_timestamp - Origin) / 1e6;
+      record.data[0] = 0.0f;
+      record.data[1] = 0.0f;
+      record.data[2] = angular_rate(t);
+      writer.write(record, monotonic_ns());
+    }
+  }
+
+  double replay(bool ms_timestamps) {
+    EventLogReader reader(m_filename);
+    EventLog::Record record;
+    Controller ctrl(0, "Bench controller");
+    IMUIntegrator imu;
+    imu.set_bias(0.0f, 0.0f, 0.0f);
+
+    double start = 0.0, error = 0.0;
+    while (reader.read(record)) {
+      uint64_t timestamp = ms_timestamps ? record.sensor_timestamp / 1000 * 1000 : record.sensor_timestamp;
+      double t = (record.sensor_timestamp - Origin) / 1e6;
+
+      if (!imu.update(ctrl, timestamp, record.data[0], record.data[1], record.data[2]))
+        start = angle(t);
+      else
+        error = max(error, fabs(imu.angle(IMUIntegrator::Z) - (angle(t) - start)));
+    }
+
+    return error * 180 / M_PI;
+  }
+};
+
+/*
+ * Predictive gyro thresholds: recorded sessions are replayed through
+ * +Z/-Z gyro mappings with and without prediction, and the presses
+ * compared. Without recordings, a synthetic session of tilts of random
+ * amplitude (some stopping short of the threshold) is used.
+ */
+
+class PredictionEvaluation
+{
+public:
+  static constexpr float Threshold = 15.0f;
+
+  PredictionEvaluation()
+    : m_records() {
+  }
+
+  void load(const string& filename) {
+    EventLogReader reader(filename);
+    EventLog::Record record;
+
+    // Only the gyro of the first controller that has one
+    m_records.clear();
+    while (reader.read(record)) {
+      if ((record.type == EventLog::RecordType::SensorUpdate) && (record.code == SDL_SENSOR_GYRO) &&
+          (m_records.empty() || (record.which == m_records.front().which)))
+        m_records.push_back(record);
+    }
+  }
+
+  void generate(const string& filename) {
+    EventLogWriter writer(filename);
+    EventLog::Record record;
+    record.which = 0;
+    record.type = EventLog::RecordType::SensorUpdate;
+    record.code = SDL_SENSOR_GYRO;
+    record.data[0] = record.data[1] = 0.0f;
+
+    uint32_t seed = 12345;
+    auto random = [&seed]() {
+      seed = seed * 1664525 + 1013904223;
+      return (seed >> 8) / 16777216.0;
+    };
+
+    // Tilt to +/- 5..40 degrees in 100..300 ms, hold, and back, at 250 Hz
+    uint64_t timestamp = 1000000;
+    for (unsigned gesture = 0; gesture < 200; ++gesture) {
+      double amplitude = (5 + 35 * random()) * M_PI / 180 * ((random() < 0.5) ? -1 : 1);
+      double duration = 0.1 + 0.2 * random();
+
+      for (double sign : { 1.0, 0.0, -1.0, 0.0 }) {
+        double length = (sign == 0.0) ? 0.25 : duration;
+        for (double t = 0; t < length; t += 0.004, timestamp += 4000) {
+          // Raised cosine velocity profile
+          double rate = sign * amplitude * M_PI / (2 * duration) * sin(M_PI * t / duration);
+          record.sensor_timestamp = timestamp;
+          record.data[2] = rate + 0.02 * (random() - 0.5);
+          writer.write(record, monotonic_ns());
+        }
+      }
+    }
+  }
+
+  void run(const string& name) {
+    cout << endl << fmt::format("{:<24} {:>12} {:>10} {:>14} {:>14}", fmt::format("Prediction ({:.0f} deg)", Threshold), "Horizon (ms)", "Presses", "Gain (ms)", "False (%)") << endl;
+
+    auto baseline = presses(0.0f);
+    cout << fmt::format("{:<24} {:>12} {:>10} {:>14} {:>14}", name, "none", baseline.size(), "-", "-") << endl;
+
+    for (float horizon : { 10.0f, 20.0f, 30.0f, 50.0f }) {
+      auto predicted = presses(horizon);
+      unsigned matched = 0, false_presses = 0;
+      double gain = 0.0;
+
+      for (const auto& press : predicted) {
+        // The actual press follows shortly, on the same button
+        auto pos = find_if(baseline.begin(), baseline.end(), [&](const Press& actual) {
+          return (actual.button == press.button) && (actual.start >= press.start) && (actual.start <= press.end + horizon * 1000 + 20000);
+        });
+
+        if (pos == baseline.end()) {
+          ++false_presses;
+        } else {
+          ++matched;
+          gain += (pos->start - press.start) / 1000.0;
+        }
+      }
+
+      cout << fmt::format("{:<24} {:>12.0f} {:>10} {:>14.1f} {:>14.1f}", name, horizon, predicted.size(),
+                          matched ? gain / matched : 0.0,
+                          predicted.empty() ? 0.0 : 100.0 * false_presses / predicted.size()) << endl;
+    }
+  }
+
+private:
+  struct Press {
+    unsigned button;
+    uint64_t start;
+    uint64_t end;
+  };
+
+  vector<EventLog::Record> m_records;
+
+  vector<Press> presses(float horizon) {
+    MasterSystem ms;
+    ms.set_gpio_map(MasterSystem::Button::Left, 0);
+    ms.set_gpio_map(MasterSystem::Button::Right, 1);
+    MemoryBackend* backend = new MemoryBackend();
+    ms.set_backend(backend);
+
+    Controller ctrl(0, "Bench controller");
+    list<unique_ptr<GyroMap>> maps;
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::PosZ, MasterSystem::Button::Left));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::NegZ, MasterSystem::Button::Right));
+    for (auto& map : maps) {
+      map->set_angle_threshold(Threshold);
+      map->set_prediction_horizon(horizon);
+      map->add_to(ctrl);
+    }
+
+    vector<Press> result;
+    Press current[2] = {};
+    for (const auto& record : m_records) {
+      ctrl.on_gyro_update(record.sensor_timestamp, record.data[0], record.data[1], record.data[2]);
+      uint32_t before = backend->levels();
+      ms.commit();
+      uint32_t after = backend->levels();
+
+      for (unsigned button = 0; button < 2; ++button) {
+        uint32_t bit = 1U << button;
+        if ((after & bit) && !(before & bit)) {
+          current[button] = { button, record.sensor_timestamp, 0 };
+        } else if (!(after & bit) && (before & bit)) {
+          current[button].end = record.sensor_timestamp;
+          result.push_back(current[button]);
+        }
+      }
+    }
+
+    return result;
+  }
+};
+
+/*
+ * Console side of the controller port, for peripheral emulations:
+ * outputs are latched atomically so that a simulated console thread
+ * can poll them, TH is driven by that thread, and edges on one output
+ * are timestamped.
+ */
+
+class SimulatedPort : public OutputBackend
+{
+public:
+  /**
+   * Keep TH at the same level at least this long after changing it;
+   * games take a few us before they read and change TH again.
+   */
+  static void hold(uint64_t since) {
+    while (monotonic_ns() - since < 10000)
+      this_thread::yield();
+  }
+
+  // MasterSystem's default mapping
+  static constexpr unsigned THGPIO = 23;
+
+  SimulatedPort(MasterSystem::Button watched)
+    : m_watched(1U << gpio(watched)),
+      m_levels(0),
+      m_inputs(1U << THGPIO),
+      m_edges(),
+      m_count(0) {
+    m_edges.resize(1000000);
+  }
+
+  string name() const override {
+    return "simulated";
+  }
+
+  void open(uint32_t) override {
+  }
+
+  void write(uint32_t set, uint32_t clear) override {
+    uint32_t levels = m_levels.load(memory_order_relaxed);
+    uint32_t next = (levels | set) & ~clear;
+
+    if (((levels ^ next) & m_watched) && (m_count < m_edges.size()))
+      m_edges[m_count++] = monotonic_ns();
+
+    m_levels.store(next, memory_order_release);
+  }
+
+  void open_inputs(uint32_t) override {
+  }
+
+  uint32_t read() override {
+    return m_inputs.load(memory_order_acquire);
+  }
+
+  void set_th(bool level) {
+    m_inputs.store(level ? (1U << THGPIO) : 0, memory_order_release);
+  }
+
+  /**
+   * Level of a line as the console reads it; low when the GPIO is high
+   */
+  bool line(MasterSystem::Button btn) const {
+    return !(m_levels.load(memory_order_acquire) & (1U << gpio(btn)));
+  }
+
+  /**
+   * D0 to D3
+   */
+  unsigned nibble() const {
+    return (line(MasterSystem::Button::Up) ? 1 : 0) | (line(MasterSystem::Button::Down) ? 2 : 0) |
+      (line(MasterSystem::Button::Left) ? 4 : 0) | (line(MasterSystem::Button::Right) ? 8 : 0);
+  }
+
+  /**
+   * D0 to D3, TL and TR
+   */
+  unsigned lines() const {
+    return nibble() | (line(MasterSystem::Button::B1) ? 0x10 : 0) | (line(MasterSystem::Button::B2) ? 0x20 : 0);
+  }
+
+  vector<uint64_t> edges() const {
+    return vector<uint64_t>(m_edges.begin(), m_edges.begin() + m_count);
+  }
+
+private:
+  uint32_t m_watched;
+  atomic<uint32_t> m_levels;
+  atomic<uint32_t> m_inputs;
+  vector<uint64_t> m_edges;
+  size_t m_count;
+
+  static unsigned gpio(MasterSystem::Button btn) {
+    switch (btn) {
+      case MasterSystem::Button::B1:
+        return 27;
+      case MasterSystem::Button::B2:
+        return 22;
+      case MasterSystem::Button::Up:
+        return 2;
+      case MasterSystem::Button::Down:
+        return 3;
+      case MasterSystem::Button::Left:
+        return 4;
+      case MasterSystem::Button::Right:
+        return 17;
+    }
+
+    return 0;
+  }
+};
+
+/*
+ * Paddle timing: the paddle thread drives a simulated port, and a
+ * simulated console polls it like a game's paddle routine (wait for TR
+ * low, read the low nibble, wait for TR high, read the high one) while
+ * the position sweeps. Reports the nibble period and how many bytes
+ * were decoded wrong.
+ */
+
+class PaddleTiming
+{
+public:
+  /**
+   * @return false if bytes were decoded wrong, or the paddle never toggled
+   */
+  bool run(unsigned period_us, double duration) {
+    MasterSystem ms;
+    SimulatedPort* port = new SimulatedPort(MasterSystem::Button::B2);
+    ms.set_backend(port);
+
+    Paddle paddle(ms, Controller::Axis::RightX);
+    paddle.set_period(period_us);
+
+    atomic<bool> stopping(false);
+    atomic<unsigned> current(0), previous(0);
+    uint64_t bytes = 0, errors = 0, skipped = 0;
+
+    thread console([&]() {
+      while (!stopping.load()) {
+        while (port->line(MasterSystem::Button::B2) && !stopping.load())
+          this_thread::yield();
+        uint64_t low_time = monotonic_ns();
+        unsigned low = port->nibble();
+        while (!port->line(MasterSystem::Button::B2) && !stopping.load())
+          this_thread::yield();
+        unsigned value = (port->nibble() << 4) | low;
+
+        if (stopping.load())
+          break;
+
+        // A console reads both nibbles within a couple of periods; if
+        // we were preempted in between, this is not the paddle's fault.
+        if (monotonic_ns() - low_time > 2000ULL * period_us) {
+          ++skipped;
+          continue;
+        }
+
+        ++bytes;
+        if ((value != current.load()) && (value != previous.load()))
+          ++errors;
+      }
+    });
+
+    paddle.start();
+
+    // Sweep the position, one step per ms
+    auto start = chrono::steady_clock::now();
+    for (unsigned step = 0; chrono::steady_clock::now() - start < chrono::duration<double>(duration); ++step) {
+      unsigned position = (step * 37) % 256;
+      previous.store(current.load());
+      current.store(position);
+      paddle.set_position(position);
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    paddle.stop();
+    stopping.store(true);
+    console.join();
+
+    vector<uint64_t> edges = port->edges();
+    vector<double> periods;
+    for (size_t index = 1; index < edges.size(); ++index)
+      periods.push_back((edges[index] - edges[index - 1]) / 1000.0);
+    sort(periods.begin(), periods.end());
+
+    if (periods.empty()) {
+      cout << "No paddle edges" << endl;
+      return false;
+    }
+
+    double mean = 0.0;
+    for (double period : periods)
+      mean += period;
+    mean /= periods.size();
+
+    auto timing = paddle.timing();
+    cout << fmt::format("{:<16} {:>6} {:>10} {:>8.2f} {:>8.2f} {:>8.2f} {:>8.2f} {:>8.2f} {:>10} {:>8}",
+                        "Paddle (us)", period_us, periods.size(), mean, periods[periods.size() / 2],
+                        periods[periods.size() * 99 / 100], periods.front(), periods.back(),
+                        bytes, errors) << endl;
+    cout << fmt::format("  {} overruns, max late {:.1f} us, {} bytes skipped (console preempted)",
+                        timing.overruns, timing.max_late_ns / 1000.0, skipped) << endl;
+
+    return errors == 0;
+  }
+
+  static void header() {
+    cout << fmt::format("{:<16} {:>6} {:>10} {:>8} {:>8} {:>8} {:>8} {:>8} {:>10} {:>8}",
+                        "", "Period", "Nibbles", "Mean", "p50", "p99", "Min", "Max", "Bytes", "Errors") << endl;
+  }
+};
+
+/*
+ * Sports Pad: a simulated console injects known trackball motion,
+ * then strobes TH four times per read like a game does, and checks
+ * each nibble. The response time is measured from the TH change to
+ * the expected nibble appearing on the port.
+ */
+
+class SportsPadHarness
+{
+public:
+  // Longest a game waits after changing TH before it reads
+  static constexpr uint64_t ReadTimeout = 100000;
+
+  /**
+   * @return false on any wrong or late nibble
+   */
+  bool run(unsigned reads) {
+    MasterSystem ms;
+    SimulatedPort* port = new SimulatedPort(MasterSystem::Button::Up);
+    ms.set_backend(port);
+
+    SportsPad pad(ms, SportsPad::Source::Right);
+    pad.start();
+
+    uint32_t seed = 4321;
+    auto random = [&seed]() {
+      seed = seed * 1664525 + 1013904223;
+      return static_cast<int>((seed >> 8) % 201) - 100;
+    };
+
+    LatencyHistogram response;
+    uint64_t errors = 0, timeouts = 0;
+
+    for (unsigned read = 0; read < reads; ++read) {
+      int dx = random(), dy = random();
+      pad.add_motion(dx, dy);
+
+      // TH idles high between reads, for longer than the pad's timeout
+      this_thread::sleep_for(chrono::milliseconds(2));
+
+      unsigned x = static_cast<uint8_t>(dx), y = static_cast<uint8_t>(dy);
+      unsigned expected[4] = { x >> 4, x & 0x0F, y >> 4, y & 0x0F };
+
+      for (unsigned index = 0; index < 4; ++index) {
+        unsigned before = port->nibble();
+        port->set_th(index % 2 == 1);
+        uint64_t strobe = monotonic_ns(), now = strobe;
+
+        while ((port->nibble() != expected[index]) && ((now = monotonic_ns()) - strobe < ReadTimeout))
+          this_thread::yield();
+        SimulatedPort::hold(strobe);
+
+        // Only time nibbles that actually changed
+        if (port->nibble() == expected[index]) {
+          if (before != expected[index])
+            response.record(now - strobe);
+        }
+        else if (now - strobe >= ReadTimeout)
+          ++timeouts;
+        else
+          ++errors;
+      }
+    }
+
+    pad.stop();
+
+    cout << fmt::format("{:<24} {:>8} {:>8} {:>8} {:>10.1f} {:>10.1f} {:>10.1f}", "Sports Pad (us)", reads * 4, errors, timeouts,
+                        response.percentile(50) / 1000.0, response.percentile(99) / 1000.0, response.max() / 1000.0) << endl;
+
+    LatencyHistogram internal = pad.response_times();
+    cout << fmt::format("{:<24} {:>8} {:>8} {:>8} {:>10.1f} {:>10.1f} {:>10.1f}", "  edge to write", internal.count(), "", "",
+                        internal.percentile(50) / 1000.0, internal.percentile(99) / 1000.0, internal.max() / 1000.0) << endl;
+
+    return (errors == 0) && (timeouts == 0);
+  }
+
+  static void header() {
+    cout << fmt::format("{:<24} {:>8} {:>8} {:>8} {:>10} {:>10} {:>10}", "", "Steps", "Errors", "Timeouts", "p50", "p99", "Max") << endl;
+  }
+};
+
+/*
+ * Mega Drive pad: for random sets of pressed buttons, a simulated
+ * console reads the pad like a game does (TH high, then the 3 or 6
+ * button sequence of TH toggles) and checks D0-D3, TL and TR at each
+ * step against the expected table. The response time is measured from
+ * the TH change to the expected levels. Last, the 6 button pad must go
+ * back to its first cycle on its own after a read that stops on the
+ * extra buttons.
+ */
+
+class MegaDriveHarness
+{
+public:
+  static constexpr uint64_t ReadTimeout = 100000;
+  static constexpr uint64_t ErrorTimeout = 1000000;
+
+  /**
+   * @return false on any wrong or late step
+   */
+  bool run(bool six_buttons, unsigned reads) {
+    MasterSystem ms;
+    SimulatedPort* port = new SimulatedPort(MasterSystem::Button::Up);
+    ms.set_backend(port);
+
+    MegaDrivePad pad(ms, six_buttons);
+    pad.start();
+
+    Controller ctrl(0, "Bench controller");
+
+    // Default mapping
+    const Controller::Button sources[] = {
+      Controller::Button::DPadUp, Controller::Button::DPadDown, Controller::Button::DPadLeft, Controller::Button::DPadRight,
+      Controller::Button::X, Controller::Button::A, Controller::Button::B, Controller::Button::Start,
+      Controller::Button::LeftShoulder, Controller::Button::Y, Controller::Button::RightShoulder, Controller::Button::Back
+    };
+    unsigned count = six_buttons ? 12 : 8;
+
+    uint32_t seed = 8765;
+    auto random = [&seed]() {
+      seed = seed * 1664525 + 1013904223;
+      return seed >> 8;
+    };
+
+    LatencyHistogram response;
+    uint64_t steps = 0, errors = 0, timeouts = 0;
+
+    for (unsigned read = 0; read < reads; ++read) {
+      uint16_t pressed = random() & ((1U << count) - 1);
+      for (unsigned btn = 0; btn < count; ++btn)
+        pad.on_button_state(ctrl, sources[btn], pressed & (1U << btn));
+
+      // Idle with TH high, long enough for the 6 button pad to reset
+      port->set_th(true);
+      this_thread::sleep_for(chrono::milliseconds(2));
+
+      const Step* sequence = six_buttons ? SixButtonRead : ThreeButtonRead;
+      unsigned length = six_buttons ? SixButtonSteps : ThreeButtonSteps;
+      for (unsigned step = 0; step < length; ++step) {
+        unsigned expected = expect(pressed, sequence[step].lines);
+
+        unsigned before = port->lines();
+        port->set_th(sequence[step].th);
+        uint64_t strobe = monotonic_ns(), now = strobe;
+
+        while ((port->lines() != expected) && ((now = monotonic_ns()) - strobe < ErrorTimeout))
+          this_thread::yield();
+        SimulatedPort::hold(strobe);
+
+        ++steps;
+        if (port->lines() != expected) {
+          ++errors;
+          break;
+        }
+        if (now - strobe >= ReadTimeout) {
+          // Past the cycle timeout soon; start over
+          ++timeouts;
+          break;
+        }
+        if (before != expected)
+          response.record(now - strobe);
+      }
+    }
+
+    if (six_buttons && (errors == 0) && (timeouts == 0)) {
+      uint16_t pressed = MegaDrivePad::button_bit(MegaDrivePad::Button::X) | MegaDrivePad::button_bit(MegaDrivePad::Button::Z);
+      for (unsigned btn = 0; btn < count; ++btn)
+        pad.on_button_state(ctrl, sources[btn], pressed & (1U << btn));
+
+      port->set_th(true);
+      this_thread::sleep_for(chrono::milliseconds(2));
+
+      // Up to the extra buttons, TH left high
+      for (unsigned step = 0; (step < 7) && (errors == 0); ++step) {
+        unsigned expected = expect(pressed, SixButtonRead[step].lines);
+        port->set_th(SixButtonRead[step].th);
+        uint64_t strobe = monotonic_ns();
+
+        while ((port->lines() != expected) && (monotonic_ns() - strobe < ErrorTimeout))
+          this_thread::yield();
+        SimulatedPort::hold(strobe);
+
+        ++steps;
+        if (port->lines() != expected)
+          ++errors;
+      }
+
+      this_thread::sleep_for(chrono::milliseconds(2));
+      ++steps;
+      if (port->lines() != expect(pressed, "UDLRBC"))
+        ++errors;
+    }
+
+    pad.stop();
+
+    cout << fmt::format("{:<24} {:>8} {:>8} {:>8} {:>10.1f} {:>10.1f} {:>10.1f}", six_buttons ? "MD 6 buttons (us)" : "MD 3 buttons (us)",
+                        steps, errors, timeouts,
+                        response.percentile(50) / 1000.0, response.percentile(99) / 1000.0, response.max() / 1000.0) << endl;
+
+    LatencyHistogram internal = pad.response_times();
+    cout << fmt::format("{:<24} {:>8} {:>8} {:>8} {:>10.1f} {:>10.1f} {:>10.1f}", "  edge to write", internal.count(), "", "",
+                        internal.percentile(50) / 1000.0, internal.percentile(99) / 1000.0, internal.max() / 1000.0) << endl;
+
+    return (errors == 0) && (timeouts == 0);
+  }
+
+private:
+  /**
+   * One TH step of a read: the level TH is set to, then what D0-D3, TL
+   * and TR must read, each as the Mega Drive button it carries (high
+   * when released: Up, Down, Left, Right, A, B, C, Start, X, Y, Z,
+   * Mode) or a fixed level ('0' or '1').
+   */
+  struct Step {
+    bool th;
+    const char* lines;
+  };
+
+  static constexpr unsigned ThreeButtonSteps = 5;
+  static constexpr unsigned SixButtonSteps = 9;
+
+  static constexpr Step ThreeButtonRead[ThreeButtonSteps] = {
+    { true,  "UDLRBC" },
+    { false, "UD00AS" },
+    { true,  "UDLRBC" },
+    { false, "UD00AS" },
+    { true,  "UDLRBC" }
+  };
+
+  // The third falling edge grounds D0-D3 and brings the extra buttons on
+  // the next rising one; the fourth raises D0-D3
+  static constexpr Step SixButtonRead[SixButtonSteps] = {
+    { true,  "UDLRBC" },
+    { false, "UD00AS" },
+    { true,  "UDLRBC" },
+    { false, "UD00AS" },
+    { true,  "UDLRBC" },
+    { false, "0000AS" },
+    { true,  "ZYXMBC" },
+    { false, "1111AS" },
+    { true,  "UDLRBC" }
+  };
+
+  /**
+   * Lines as read by the console for a Step::lines description
+   * @param pressed Mega Drive buttons, in MegaDrivePad::Button order
+   */
+  static unsigned expect(uint16_t pressed, const char* lines) {
+    static const char names[] = "UDLRABCSXYZM";
+
+    unsigned levels = 0;
+    for (unsigned line = 0; line < 6; ++line) {
+      bool high;
+      if ((lines[line] == '0') || (lines[line] == '1'))
+        high = (lines[line] == '1');
+      else
+        high = !(pressed & (1U << (strchr(names, lines[line]) - names)));
+      levels |= (high ? 1U : 0U) << line;
+    }
+    return levels;
+  }
+};
+
+/*
+ * Serial backend: a fake microcontroller on the master side of a
+ * pseudo-terminal parses the frames, checks their CRC, sequence
+ * numbers and contents, and compares the step delays with the actual
+ * spacing of the writes. Writes come in bursts 100 us apart, like a
+ * turbo sequence, so that some of them get batched.
+ */
+
+class SerialHarness
+{
+public:
+  static constexpr unsigned BurstLength = 8;
+  static constexpr uint64_t BurstSpacing = 100000;
+
+  /**
+   * @return false on any bad or missing frame, or wrong levels
+   */
+  bool run(unsigned writes) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) < 0) || (unlockpt(master) < 0))
+      throw runtime_error(fmt::format("Cannot create pseudo-terminal: {}", strerror(errno)));
+
+    const uint32_t pins = 0x00FC0000;
+    vector<uint64_t> times(writes);
+    vector<uint32_t> levels(writes);
+
+    atomic<bool> stopping(false);
+    uint64_t frames = 0, errors = 0, batched = 0;
+    vector<Received> received;
+    received.reserve(writes);
+
+    thread device([&]() {
+      vector<uint8_t> buffer;
+      uint8_t expected_sequence = 0;
+
+      while (!stopping.load() || (received.size() < writes)) {
+        struct pollfd pfd = { master, POLLIN, 0 };
+        if (poll(&pfd, 1, 10) <= 0) {
+          if (stopping.load())
+            break;
+          continue;
+        }
+
+        uint8_t chunk[256];
+        ssize_t count = ::read(master, chunk, sizeof(chunk));
+        if (count <= 0)
+          break;
+        uint64_t now = monotonic_ns();
+        buffer.insert(buffer.end(), chunk, chunk + count);
+
+        while (buffer.size() >= SerialBackend::HeaderSize) {
+          if (buffer[0] != SerialBackend::Sync) {
+            ++errors;
+            buffer.erase(buffer.begin());
+            continue;
+          }
+
+          size_t size = SerialBackend::HeaderSize + buffer[3] + 1;
+          if (buffer.size() < size)
+            break;
+
+          ++frames;
+          const uint8_t* payload = buffer.data() + SerialBackend::HeaderSize;
+          if ((SerialBackend::crc8(buffer.data() + 1, size - 2) != buffer[size - 1]) || (buffer[2] != expected_sequence))
+            ++errors;
+          expected_sequence = buffer[2] + 1;
+
+          if (buffer[1] == SerialBackend::Open) {
+            if ((buffer[3] != 4) || (get_u32(payload) != pins))
+              ++errors;
+          } else if ((buffer[1] == SerialBackend::Steps) && (buffer[3] % SerialBackend::StepSize == 0)) {
+            unsigned count = buffer[3] / SerialBackend::StepSize;
+            if (count > 1)
+              batched += count;
+            for (unsigned index = 0; index < count; ++index) {
+              const uint8_t* step = payload + index * SerialBackend::StepSize;
+              received.push_back({ now, static_cast<uint16_t>(step[0] | (step[1] << 8)), get_u32(step + 2) });
+            }
+          } else {
+            ++errors;
+          }
+
+          buffer.erase(buffer.begin(), buffer.begin() + size);
+        }
+      }
+    });
+
+    {
+      unique_ptr<SerialBackend> backend(new SerialBackend(ptsname(master)));
+      backend->open(pins);
+
+      uint32_t seed = 2468;
+      for (unsigned index = 0; index < writes; ++index) {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t next = (seed >> 8) & pins;
+        uint32_t current = index ? levels[index - 1] : 0;
+
+        if (index % BurstLength == 0)
+          this_thread::sleep_for(chrono::milliseconds(2));
+        else
+          while (monotonic_ns() - times[index - 1] < BurstSpacing)
+            ;
+
+        times[index] = monotonic_ns();
+        levels[index] = next;
+        backend->write(next & ~current, ~next & current & pins);
+      }
+
+      // Flushes the pending writes
+    }
+
+    stopping.store(true);
+    device.join();
+    close(master);
+
+    LatencyHistogram latency;
+    uint64_t spacing = 0;
+    for (unsigned index = 0; index < received.size(); ++index) {
+      if ((index >= writes) || (received[index].levels != levels[index])) {
+        ++errors;
+        continue;
+      }
+
+      latency.record(received[index].arrival - times[index]);
+      if (index % BurstLength != 0) {
+        int64_t actual = times[index] / 1000 - times[index - 1] / 1000;
+        spacing = max<uint64_t>(spacing, llabs(actual - received[index].delay));
+      }
+    }
+    if (received.size() != writes)
+      ++errors;
+
+    cout << fmt::format("{:<16} {:>8} {:>8} {:>8} {:>8} {:>10.1f} {:>10.1f} {:>10.1f} {:>10}", "Serial (us)", received.size(), frames, batched,
+                        errors, latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0, latency.max() / 1000.0, spacing) << endl;
+
+    return errors == 0;
+  }
+
+  static void header() {
+    cout << fmt::format("{:<16} {:>8} {:>8} {:>8} {:>8} {:>10} {:>10} {:>10} {:>10}",
+                        "", "Steps", "Frames", "Batched", "Errors", "p50", "p99", "Max", "Spacing") << endl;
+  }
+
+private:
+  struct Received {
+    uint64_t arrival;
+    uint16_t delay;
+    uint32_t levels;
+  };
+
+  static uint32_t get_u32(const uint8_t* src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+  }
+};
+
+/*
+ * Output ring: msctrl's side writes through the ring backend while a
+ * RingServer, as in msctrl-outputd, applies the changes to the null
+ * backend from another thread. The latency is the extra time the
+ * privilege separation adds to every output change, with the server
+ * sleeping on the futex or spinning.
+ */
+
+class RingHarness
+{
+public:
+  void run(uint64_t spin_us, unsigned writes) {
+    string name = fmt::format("/msctrl-bench-{}", getpid());
+    RingServer server(OutputRing::create(name), new NullBackend(), 0xFFFFFFFF);
+    server.set_spin(spin_us * 1000);
+
+    thread consumer([&server]() { server.run(); });
+
+    {
+      RingBackend backend(name);
+      backend.open(1);
+
+      // Output changes at a gamepad's pace, not back to back
+      for (unsigned index = 0; index < writes; ++index) {
+        this_thread::sleep_for(chrono::microseconds(500));
+        backend.write((index % 2) ? 1 : 0, (index % 2) ? 0 : 1);
+      }
+    }
+
+    // Let the server drain the ring
+    while (server.delivered() < writes)
+      this_thread::sleep_for(chrono::milliseconds(1));
+    server.stop();
+    consumer.join();
+
+    LatencyHistogram latency = server.latency();
+    cout << fmt::format("{:<16} {:>8} {:>10} {:>10.1f} {:>10.1f} {:>10.1f}", "Ring (us)", spin_us, latency.count(),
+                        latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0, latency.max() / 1000.0) << endl;
+  }
+
+  static void header() {
+    cout << fmt::format("{:<16} {:>8} {:>10} {:>10} {:>10} {:>10}", "", "Spin", "Writes", "p50", "p99", "Max") << endl;
+  }
+};
+
+/*
+ * Remote gamepad: button transitions go from a UDPSender to a
+ * UDPInput over the loopback interface, through the real event loop,
+ * and the latency is measured up to the receiving controller's
+ * listener. Heap allocations are counted over the transitions. A
+ * press and release within one batch must both arrive. Gyro
+ * samples at uneven intervals, several per batch, must then be
+ * integrated to the same angle on both sides. Last, hand-made packets
+ * check that duplicated and out-of-order packets are dropped, and
+ * that a silent pad gets its buttons released.
+ */
+
+class UDPHarness
+{
+public:
+  static constexpr uint64_t Timeout = 100000000;
+  static constexpr unsigned GyroSamples = 600;
+  static constexpr float MaxAngleError = 1e-4f;
+
+  UDPHarness()
+    : m_opened(0),
+      m_closed(0),
+      m_events(),
+      m_arrival(0),
+      m_angle(0.0f) {
+  }
+
+  /**
+   * @return false if a transition was lost, or on any error
+   */
+  bool run(unsigned transitions) {
+    Receiver receiver(*this);
+    UDPInput* input = new UDPInput("127.0.0.1:0");
+    uint16_t port = input->port();
+    receiver.add_input_source(input);
+
+    thread loop([&receiver]() { receiver.loop(); });
+
+    LatencyHistogram latency;
+    unsigned lost = 0, errors = 0;
+    unsigned long allocations = 0;
+
+    {
+      Controller ctrl(1, "Bench controller");
+      UDPSender sender(fmt::format("127.0.0.1:{}", port), 0);
+      sender.add_to(ctrl);
+
+      // The receiving side opens the pad on its first packet
+      sender.flush();
+      if (!wait_for([this]() { return m_opened.load() == 1; }, Timeout))
+        throw runtime_error("The remote pad was not opened");
+
+      allocations = allocation_count();
+      for (unsigned index = 0; index < transitions; ++index) {
+        this_thread::sleep_for(chrono::microseconds(500));
+
+        unsigned expected = m_events[0].load() + 1;
+        uint64_t start = monotonic_ns();
+        if (index % 2)
+          ctrl.on_button_release(SDL_CONTROLLER_BUTTON_A);
+        else
+          ctrl.on_button_press(SDL_CONTROLLER_BUTTON_A);
+        sender.flush();
+
+        if (wait_for([this, expected]() { return m_events[0].load() >= expected; }, Timeout))
+          latency.record(m_arrival.load() - start);
+        else
+          ++lost;
+      }
+      allocations = allocation_count() - allocations;
+
+      unsigned expected = m_events[0].load() + 2;
+      ctrl.on_button_press(SDL_CONTROLLER_BUTTON_B);
+      ctrl.on_button_release(SDL_CONTROLLER_BUTTON_B);
+      sender.flush();
+      if (!wait_for([this, expected]() { return m_events[0].load() >= expected; }, Timeout))
+        ++errors;
+    }
+
+    // Bye
+    if (!wait_for([this]() { return m_closed.load() == 1; }, Timeout))
+      ++errors;
+
+    if (!check_gyro(port))
+      ++errors;
+
+    // Pad 1: a press, the same packet again, then an older release
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    RemotePacket packet = {};
+    packet.pad = 1;
+    packet.session = 1234;
+    for (auto step : { make_pair(10U, 1U << SDL_CONTROLLER_BUTTON_B), make_pair(10U, 1U << SDL_CONTROLLER_BUTTON_B), make_pair(9U, 0U) }) {
+      uint8_t data[RemotePacket::Size];
+      packet.sequence = step.first;
+      packet.buttons = step.second;
+      packet.encode(data);
+      sendto(fd, data, sizeof(data), 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    }
+    close(fd);
+
+    this_thread::sleep_for(chrono::milliseconds(100));
+    if (m_events[1].load() != 1)
+      ++errors;
+
+    // No keep-alive for pad 1, so the button is released
+    if (!wait_for([this]() { return m_events[1].load() == 2; }, 1000000000))
+      ++errors;
+
+    kill(getpid(), SIGINT);
+    loop.join();
+
+    const UDPInput::Counters& counters = input->counters();
+    if ((counters.dropped != 2) || (counters.timeouts != 1) || (counters.invalid != 0))
+      ++errors;
+
+    cout << fmt::format("{:<16} {:>8} {:>8} {:>8} {:>8} {:>8} {:>8} {:>10.1f} {:>10.1f} {:>10.1f}", "UDP (us)", transitions, lost,
+                        counters.dropped, counters.timeouts, errors, allocations,
+                        latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0, latency.max() / 1000.0) << endl;
+
+    return (lost == 0) && (errors == 0);
+  }
+
+  static void header() {
+    cout << fmt::format("{:<16} {:>8} {:>8} {:>8} {:>8} {:>8} {:>8} {:>10} {:>10} {:>10}",
+                        "", "Trans.", "Lost", "Dropped", "Timeouts", "Errors", "Allocs", "p50", "p99", "Max") << endl;
+  }
+
+private:
+  /**
+   * Pad 2: the first samples go through the warm-up on both sides, and
+   * a button press marks where the angles are compared from; the
+   * receiver has applied all samples sent before a button transition
+   * once it sees it.
+   */
+  bool check_gyro(uint16_t port) {
+    Controller ctrl(2, "Bench gyro controller");
+    UDPSender sender(fmt::format("127.0.0.1:{}", port), 2, true);
+    sender.add_to(ctrl);
+
+    uint64_t timestamp = 1000000;
+    float sent_base = 0.0f, received_base = 0.0f;
+    for (unsigned index = 0; index < GyroSamples; ++index) {
+      timestamp += (index % 3) ? 4000 : 1000;
+      ctrl.on_gyro_update(timestamp, 0.0f, 0.0f, 2.0f * sinf(index * 0.7f));
+      if (index % 2)
+        continue;
+
+      // At about the sensor's pace, not to overflow the socket buffer
+      this_thread::sleep_for(chrono::microseconds(200));
+      if (index == GyroSamples / 4)
+        ctrl.on_button_press(SDL_CONTROLLER_BUTTON_X);
+      sender.flush();
+
+      if (index == GyroSamples / 4) {
+        if (!wait_for([this]() { return m_events[2].load() == 1; }, Timeout))
+          return false;
+        sent_base = ctrl.imu().angle(IMUIntegrator::Z);
+        received_base = m_angle.load();
+      }
+    }
+
+    ctrl.on_button_release(SDL_CONTROLLER_BUTTON_X);
+    sender.flush();
+    if (!wait_for([this]() { return m_events[2].load() == 2; }, Timeout))
+      return false;
+
+    float sent = ctrl.imu().angle(IMUIntegrator::Z) - sent_base;
+    float received = m_angle.load() - received_base;
+    return fabsf(sent - received) <= MaxAngleError;
+  }
+
+  class Receiver : public SDLMain, public Controller::Listener
+  {
+  public:
+    Receiver(UDPHarness& harness)
+      : m_harness(harness) {
+    }
+
+    bool on_controller_added(const string&) override {
+      return true;
+    }
+
+    void on_controller_open(Controller& ctrl) override {
+      ctrl.add_listener(this);
+      ctrl.request_gyro();
+      ++m_harness.m_opened;
+    }
+
+    void on_controller_close(Controller&) override {
+      ++m_harness.m_closed;
+    }
+
+    void on_events_processed() override {
+    }
+
+    void on_dump_stats() override {
+    }
+
+    unsigned subscriptions() const override {
+      return ButtonEvents | GyroEvents;
+    }
+
+    void on_button_state(Controller& ctrl, Controller::Button, bool) override {
+      m_harness.m_arrival.store(monotonic_ns());
+      ++m_harness.m_events[(ctrl.id() & 0xFF) % UDPInput::MaxPads];
+    }
+
+    void on_gyro_update(Controller& ctrl, uint64_t, float, float, float) override {
+      m_harness.m_angle.store(ctrl.imu().angle(IMUIntegrator::Z));
+    }
+
+  private:
+    UDPHarness& m_harness;
+  };
+
+  atomic<unsigned> m_opened;
+  atomic<unsigned> m_closed;
+  atomic<unsigned> m_events[UDPInput::MaxPads];
+  atomic<uint64_t> m_arrival;
+  atomic<float> m_angle;
+
+  // Polls, so as not to take the CPU from the event loop
+  template <typename F> static bool wait_for(F done, uint64_t timeout) {
+    uint64_t start = monotonic_ns();
+    while (!done()) {
+      if (monotonic_ns() - start > timeout)
+        return false;
+      this_thread::sleep_for(chrono::microseconds(20));
+    }
+    return true;
+  }
+};
+
+/*
+ * hidraw reports: USB and Bluetooth input reports of both pads, built
+ * by hand from the report layouts of the kernel's hid-playstation
+ * driver (with a valid Bluetooth CRC) rather than captured from real
+ * pads, are decoded and compared field by field with the expected state.
+ * So are the two orderings of the calibration feature report, sensor
+ * clock wrap arounds, and reports that must be rejected. Then the
+ * decoding time and heap allocations per report are measured.
+ */
+
+class HidrawHarness
+{
+public:
+  HidrawHarness()
+    : m_failed(0) {
+  }
+
+  /**
+   * @return false if any case failed
+   */
+  bool run(unsigned iterations) {
+    using Model = SonyReport::Model;
+
+    const float Deg = M_PI / 180;
+    const float G = 9.80665f / 8192;
+    const uint32_t A = bit(SDL_CONTROLLER_BUTTON_A), B = bit(SDL_CONTROLLER_BUTTON_B);
+    const uint32_t X = bit(SDL_CONTROLLER_BUTTON_X), Y = bit(SDL_CONTROLLER_BUTTON_Y);
+    const uint32_t Up = bit(SDL_CONTROLLER_BUTTON_DPAD_UP), Right = bit(SDL_CONTROLLER_BUTTON_DPAD_RIGHT);
+    const uint32_t Left = bit(SDL_CONTROLLER_BUTTON_DPAD_LEFT);
+    const uint32_t LS = bit(SDL_CONTROLLER_BUTTON_LEFTSHOULDER), RS = bit(SDL_CONTROLLER_BUTTON_RIGHTSHOULDER);
+    const uint32_t L3 = bit(SDL_CONTROLLER_BUTTON_LEFTSTICK), R3 = bit(SDL_CONTROLLER_BUTTON_RIGHTSTICK);
+    const uint32_t Start = bit(SDL_CONTROLLER_BUTTON_START), Back = bit(SDL_CONTROLLER_BUTTON_BACK);
+    const uint32_t Guide = bit(SDL_CONTROLLER_BUTTON_GUIDE), Touchpad = bit(SDL_CONTROLLER_BUTTON_TOUCHPAD);
+    const uint32_t Mute = bit(SDL_CONTROLLER_BUTTON_MISC1);
+
+    const Case cases[] = {
+      {
+        "DS4 USB", Model::DualShock4,
+        "01807f00ff212115ff00341217a000c0fe10000000002000e000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000",
+        A | Up | Right | LS | Start | Guide, { 128, -129, -32768, 32767, 32767, 0 },
+        { 10 * Deg, -20 * Deg, 1 * Deg }, { 0.0f, 8192 * G, -8192 * G }, 0x1234
+      },
+      {
+        "DS4 Bluetooth", Model::DualShock4,
+        "11c000ff0080804812020080f0ff1700000000f0ff6400c8002c010000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000007bdaca4",
+        B | RS | Back | Touchpad, { 32767, -32768, 128, 128, 0, 16447 },
+        { 0.0f, 0.0f, -1 * Deg }, { 100 * G, 200 * G, 300 * G }, 0xFFF0
+      },
+      {
+        "DualSense USB", Model::DualSense,
+        "01808040c000ff2a8f1004000000000060ff0000200000000000002078563412"
+        "0000000000000000000000000000000000000000000000000000000000000000",
+        Y | Back | Mute, { 128, 128, -16320, 16576, 0, 32767 },
+        { -10 * Deg, 0.0f, 2 * Deg }, { 0.0f, 0.0f, 8192 * G }, 0x12345678
+      },
+      {
+        "DualSense BT", Model::DualSense,
+        "311000ff808080002b16c200000000000010001000100000e000000000f0debc"
+        "9a00000000000000000000000000000000000000000000000000000000000000"
+        "000000000000000000001f53ec81",
+        X | Left | RS | L3 | R3, { -32768, 32767, 128, 128, 16447, 0 },
+        { 1 * Deg, 1 * Deg, 1 * Deg }, { -8192 * G, 0.0f, 0.0f }, 0x9ABCDEF0
+      }
+    };
+
+    SonyReport::Calibration nominal = SonyReport::default_calibration();
+    vector<vector<uint8_t>> reports;
+
+    for (const auto& entry : cases) {
+      reports.push_back(from_hex(entry.hex));
+      const vector<uint8_t>& data = reports.back();
+
+      SonyReport report;
+      bool ok = report.decode(entry.model, nominal, data.data(), data.size()) &&
+        (report.buttons == entry.buttons) && (report.timestamp == entry.timestamp) &&
+        equal(report.axes, report.axes + SonyReport::AxisCount, entry.axes);
+      for (unsigned axis = 0; axis < 3; ++axis)
+        ok = ok && close_to(report.gyro[axis], entry.gyro[axis]) && close_to(report.accel[axis], entry.accel[axis]);
+
+      print(entry.name, data.size(), ok);
+    }
+
+    // Any change to a Bluetooth report breaks its CRC
+    {
+      vector<uint8_t> data = reports[3];
+      data[10] ^= 0x01;
+      SonyReport report;
+      print("Corrupted CRC", data.size(), !report.decode(Model::DualSense, nominal, data.data(), data.size()));
+    }
+
+    // What a DualShock 4 on Bluetooth sends until it is configured
+    {
+      vector<uint8_t> data = from_hex("01808080800800000000");
+      SonyReport report;
+      print("DS4 BT short", data.size(), !report.decode(Model::DualShock4, nominal, data.data(), data.size()));
+    }
+
+    // The same calibration in the USB and in the interleaved orders
+    {
+      vector<uint8_t> pairs = from_hex("020500fdff02006522a5dd5b229fdd6022a4dd1c021c02082008e0002000e06c206ce00000");
+      vector<uint8_t> interleaved = from_hex("050500fdff020065225b226022a5dd9fdda4dd1c021c02082008e0002000e06c206ce0000000000000");
+
+      const float bias[3] = { 5.0f, -3.0f, 2.0f };
+      const float range[3] = { 17600.0f, 17596.0f, 17596.0f };
+      const float accel_bias[3] = { 8.0f, 0.0f, 108.0f };
+
+      for (auto entry : { make_pair(&pairs, false), make_pair(&interleaved, true) }) {
+        SonyReport::Calibration calibration;
+        bool ok = SonyReport::parse_calibration(entry.second, entry.first->data(), entry.first->size(), calibration);
+        for (unsigned axis = 0; axis < 3; ++axis) {
+          ok = ok && close_to(calibration.gyro_bias[axis], bias[axis]) &&
+            close_to(calibration.gyro_scale[axis], 1080 / range[axis] * Deg) &&
+            close_to(calibration.accel_bias[axis], accel_bias[axis]) && close_to(calibration.accel_scale[axis], G);
+        }
+        print(entry.second ? "Calibration BT" : "Calibration USB", entry.first->size(), ok);
+      }
+
+      // Clones answer with zeroes
+      vector<uint8_t> zeroes(pairs.size());
+      SonyReport::Calibration calibration;
+      print("Calibration 0", zeroes.size(), !SonyReport::parse_calibration(false, zeroes.data(), zeroes.size(), calibration));
+    }
+
+    print("Clock wrap", 0,
+          (SonyReport::elapsed_ticks(Model::DualShock4, 0xFFF0, 0x0010) == 0x20) &&
+          (SonyReport::ticks_to_us(Model::DualShock4, 0x30) == 256) &&
+          (SonyReport::elapsed_ticks(Model::DualSense, 0xFFFFFFF0, 0x10) == 0x20) &&
+          (SonyReport::ticks_to_us(Model::DualSense, 0x30) == 16));
+
+    unsigned long allocations = allocation_count();
+    uint64_t start = monotonic_ns();
+    uint32_t sink = 0;
+
+    for (unsigned iteration = 0; iteration < iterations; ++iteration) {
+      for (unsigned index = 0; index < reports.size(); ++index) {
+        SonyReport report;
+        if (report.decode(cases[index].model, nominal, reports[index].data(), reports[index].size()))
+          sink += report.buttons;
+      }
+    }
+
+    uint64_t elapsed = monotonic_ns() - start;
+    allocations = allocation_count() - allocations;
+
+    cout << fmt::format("Decoding: {:.1f} ns per report, {} allocations ({})", static_cast<double>(elapsed) / (iterations * reports.size()),
+                        allocations, sink ? "ok" : "FAILED") << endl;
+
+    return (m_failed == 0) && (sink != 0);
+  }
+
+  static void header() {
+    cout << fmt::format("{:<16} {:>8} {:>8}", "", "Size", "Result") << endl;
+  }
+
+private:
+  struct Case {
+    const char* name;
+    SonyReport::Model model;
+    const char* hex;
+    uint32_t buttons;
+    int16_t axes[SonyReport::AxisCount];
+    float gyro[3];
+    float accel[3];
+    uint32_t timestamp;
+  };
+
+  static uint32_t bit(SDL_GameControllerButton btn) {
+    return 1U << btn;
+  }
+
+  static bool close_to(float value, float expected) {
+    return fabsf(value - expected) <= 1e-5f * max(1.0f, fabsf(expected));
+  }
+
+  static vector<uint8_t> from_hex(const char* hex) {
+    vector<uint8_t> result;
+    for (size_t index = 0; hex[index] && hex[index + 1]; index += 2)
+      result.push_back(stoul(string(hex + index, 2), nullptr, 16));
+    return result;
+  }
+
+  unsigned m_failed;
+
+  void print(const char* name, size_t size, bool ok) {
+    cout << fmt::format("{:<16} {:>8} {:>8}", name, size ? to_string(size) : "", ok ? "ok" : "FAILED") << endl;
+    if (!ok)
+      ++m_failed;
+  }
+};
+
+/*
+ * Output backends: the same button transition sequence (from a
+ * recording, or synthetic) goes through MasterSystem::commit() with
+ * each backend, at the original pace or back to back. Commit latency,
+ * process CPU time and context switches are measured, so that
+ * backends can be compared on the target. Backends that need a device
+ * get a stand-in unless one is given: a drained pseudo-terminal for
+ * serial, an in-process RingServer for ring. spdlog goes to /dev/null
+ * at info level, so that stdout pays for formatting but not for the
+ * terminal.
+ */
+
+class BackendBenchmark
+{
+public:
+  BackendBenchmark()
+    : m_transitions(),
+      m_paced(true),
+      m_report(nlohmann::json::array()) {
+  }
+
+  void set_paced(bool paced) {
+    m_paced = paced;
+  }
+
+  /**
+   * Buttons, D-pad and left stick of the first controller in a
+   * recording, with the default mapping
+   */
+  void load(const string& filename) {
+    EventLogReader reader(filename);
+    EventLog::Record record;
+    int32_t which = -1;
+    uint8_t state = 0;
+
+    m_transitions.clear();
+    while (reader.read(record)) {
+      if ((record.type != EventLog::RecordType::ButtonDown) && (record.type != EventLog::RecordType::ButtonUp) &&
+          (record.type != EventLog::RecordType::AxisMotion))
+        continue;
+      if (which < 0)
+        which = record.which;
+      if (record.which != which)
+        continue;
+
+      uint8_t next = state;
+      auto set = [&next](MasterSystem::Button btn, bool pressed) {
+        next = pressed ? (next | MasterSystem::button_bit(btn)) : (next & ~MasterSystem::button_bit(btn));
+      };
+
+      if (record.type == EventLog::RecordType::AxisMotion) {
+        if (record.code == SDL_CONTROLLER_AXIS_LEFTX) {
+          set(MasterSystem::Button::Left, record.value < -16384);
+          set(MasterSystem::Button::Right, record.value > 16384);
+        } else if (record.code == SDL_CONTROLLER_AXIS_LEFTY) {
+          set(MasterSystem::Button::Up, record.value < -16384);
+          set(MasterSystem::Button::Down, record.value > 16384);
+        }
+      } else {
+        bool pressed = (record.type == EventLog::RecordType::ButtonDown);
+        switch (record.code) {
+          case SDL_CONTROLLER_BUTTON_A:
+            set(MasterSystem::Button::B1, pressed);
+            break;
+          case SDL_CONTROLLER_BUTTON_B:
+            set(MasterSystem::Button::B2, pressed);
+            break;
+          case SDL_CONTROLLER_BUTTON_DPAD_UP:
+            set(MasterSystem::Button::Up, pressed);
+            break;
+          case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+            set(MasterSystem::Button::Down, pressed);
+            break;
+          case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
+            set(MasterSystem::Button::Left, pressed);
+            break;
+          case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
+            set(MasterSystem::Button::Right, pressed);
+            break;
+        }
+      }
+
+      if (next != state)
+        m_transitions.push_back({ record.time, next });
+      state = next;
+    }
+  }
+
+  /**
+   * Random presses and releases, 1 to 8 ms apart
+   */
+  void generate(unsigned count) {
+    uint32_t seed = 13579;
+    auto random = [&seed]() {
+      seed = seed * 1664525 + 1013904223;
+      return seed >> 8;
+    };
+
+    m_transitions.clear();
+    uint64_t time = 0;
+    uint8_t state = 0;
+    while (m_transitions.size() < count) {
+      time += 1000000 + random() % 7000000;
+      state ^= 1U << (random() % MasterSystem::ButtonCount);
+      m_transitions.push_back({ time, state });
+    }
+  }
+
+  void run(const string& spec) {
+    auto sep = spec.find(':');
+    string name = spec.substr(0, sep);
+    nlohmann::json result = { { "backend", spec } };
+
+    unique_ptr<PtySink> sink;
+    unique_ptr<RingServer> server;
+    thread consumer;
+
+    try {
+      string actual = spec;
+      if ((name == "serial") && (sep == string::npos)) {
+        sink.reset(new PtySink());
+        actual = "serial:" + sink->path();
+      } else if ((name == "ring") && (sep == string::npos)) {
+        actual = fmt::format("ring:/msctrl-bench-{}", getpid());
+        server.reset(new RingServer(OutputRing::create(actual.substr(5)), new NullBackend(), 0xFFFFFFFF));
+        consumer = thread([&server]() { server->run(); });
+      }
+
+      MasterSystem ms;
+      ms.set_backend(OutputBackend::create(actual));
+
+      LatencyHistogram latency;
+      uint64_t total = 0;
+      struct rusage before, after;
+      getrusage(RUSAGE_SELF, &before);
+      uint64_t cpu = process_cpu_ns();
+      uint64_t start = monotonic_ns();
+
+      for (const auto& transition : m_transitions) {
+        if (m_paced) {
+          uint64_t deadline = start + transition.time - m_transitions.front().time;
+          uint64_t now = monotonic_ns();
+          if (deadline > now)
+            this_thread::sleep_for(chrono::nanoseconds(deadline - now));
+        }
+
+        for (unsigned btn = 0; btn < MasterSystem::ButtonCount; ++btn)
+          ms.set_button_state(static_cast<MasterSystem::Button>(btn), transition.state & (1U << btn));
+
+        uint64_t before_commit = monotonic_ns();
+        ms.commit();
+        uint64_t elapsed = monotonic_ns() - before_commit;
+        latency.record(elapsed);
+        total += elapsed;
+      }
+
+      cpu = process_cpu_ns() - cpu;
+      getrusage(RUSAGE_SELF, &after);
+
+      unsigned commits = m_transitions.size();
+      result["available"] = true;
+      result["commits"] = commits;
+      result["latency_ns"] = {
+        { "mean", commits ? total / commits : 0 },
+        { "p50", latency.percentile(50) },
+        { "p99", latency.percentile(99) },
+        { "max", latency.max() }
+      };
+      result["cpu_ns"] = cpu;
+      result["cpu_ns_per_commit"] = commits ? cpu / commits : 0;
+      result["voluntary_switches"] = after.ru_nvcsw - before.ru_nvcsw;
+      result["involuntary_switches"] = after.ru_nivcsw - before.ru_nivcsw;
+
+      cout << fmt::format("{:<24} {:>8} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.2f} {:>10} {:>10}", spec, commits,
+                          (commits ? total / commits : 0) / 1000.0, latency.percentile(50) / 1000.0,
+                          latency.percentile(99) / 1000.0, latency.max() / 1000.0, commits ? cpu / 1000.0 / commits : 0.0,
+                          after.ru_nvcsw - before.ru_nvcsw, after.ru_nivcsw - before.ru_nivcsw) << endl;
+    } catch (const exception& exc) {
+      result["available"] = false;
+      result["error"] = exc.what();
+      cout << fmt::format("{:<24} unavailable: {}", spec, exc.what()) << endl;
+    }
+
+    if (server) {
+      // Everything was pushed before the backend went away
+      while (server->delivered() < m_transitions.size() && result["available"] == true)
+        this_thread::sleep_for(chrono::milliseconds(1));
+      server->stop();
+      consumer.join();
+      LatencyHistogram delivery = server->latency();
+      result["delivery_ns"] = {
+        { "p50", delivery.percentile(50) },
+        { "p99", delivery.percentile(99) },
+        { "max", delivery.max() }
+      };
+    }
+
+    m_report.push_back(result);
+  }
+
+  nlohmann::json report() const {
+    return {
+      { "paced", m_paced },
+      { "transitions", m_transitions.size() },
+      { "cpus", thread::hardware_concurrency() },
+      { "backends", m_report }
+    };
+  }
+
+  static void header() {
+    cout << fmt::format("{:<24} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}",
+                        "Backend (us)", "Commits", "Mean", "p50", "p99", "Max", "CPU/commit", "Vol. sw", "Invol. sw") << endl;
+  }
+
+private:
+  struct Transition {
+    uint64_t time;
+    uint8_t state;
+  };
+
+  /**
+   * Master side of a pseudo-terminal, read and discarded by a thread
+   */
+  class PtySink
+  {
+  public:
+    PtySink()
+      : m_fd(posix_openpt(O_RDWR | O_NOCTTY)),
+        m_stopping(false),
+        m_thread() {
+      if ((m_fd < 0) || (grantpt(m_fd) < 0) || (unlockpt(m_fd) < 0))
+        throw runtime_error(fmt::format("Cannot create pseudo-terminal: {}", strerror(errno)));
+
+      m_thread = thread([this]() {
+        uint8_t buffer[256];
+        while (!m_stopping.load()) {
+          struct pollfd pfd = { m_fd, POLLIN, 0 };
+          if ((poll(&pfd, 1, 10) > 0) && (::read(m_fd, buffer, sizeof(buffer)) <= 0))
+            break;
+        }
+      });
+    }
+
+    ~PtySink() {
+      m_stopping.store(true);
+      m_thread.join();
+      close(m_fd);
+    }
+
+    string path() const {
+      return ptsname(m_fd);
+    }
+
+  private:
+    int m_fd;
+    atomic<bool> m_stopping;
+    thread m_thread;
+  };
+
+  vector<Transition> m_transitions;
+  bool m_paced;
+  nlohmann::json m_report;
+
+  static uint64_t process_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  spdlog::set_level(spdlog::level::warn);
+
+  if ((argc > 1) && !strcmp(argv[1], "--prediction")) {
+    PredictionEvaluation evaluation;
+
+    if (argc == 2) {
+      char filename[] = "/tmp/msctrl-bench-XXXXXX";
+      int fd = mkstemp(filename);
+      if (fd < 0)
+        throw runtime_error(fmt::format("Cannot create temporary file: {}", strerror(errno)));
+      close(fd);
+
+      evaluation.generate(filename);
+      evaluation.load(filename);
+      unlink(filename);
+      evaluation.run("synthetic");
+    }
+
+    for (int i = 2; i < argc; ++i) {
+      evaluation.load(argv[i]);
+      evaluation.run(argv[i]);
+    }
+
+    return 0;
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--imu")) {
+    IMUAccuracy accuracy;
+    bool ok = true;
+    for (unsigned rate : { 250, 500, 1000 })
+      ok = accuracy.run(rate) && ok;
+
+    return ok ? 0 : 1;
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--paddle")) {
+    double duration = (argc > 2) ? atof(argv[2]) : 2.0;
+
+    if (thread::hardware_concurrency() < 3)
+      cout << "Warning: less than 3 CPUs, the simulated console competes with the paddle thread" << endl;
+
+    PaddleTiming::header();
+    bool ok = true;
+    for (unsigned period : { 60, 30 }) {
+      PaddleTiming timing;
+      ok = timing.run(period, duration) && ok;
+    }
+
+    return ok ? 0 : failure_status(3);
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--sportspad")) {
+    if (thread::hardware_concurrency() < 2)
+      cout << "Warning: only one CPU, the simulated console competes with the responder thread" << endl;
+
+    SportsPadHarness::header();
+    SportsPadHarness harness;
+    return harness.run((argc > 2) ? atoi(argv[2]) : 500) ? 0 : failure_status(2);
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--megadrive")) {
+    if (thread::hardware_concurrency() < 2)
+      cout << "Warning: only one CPU, the simulated console competes with the responder thread" << endl;
+
+    SportsPadHarness::header();
+    bool ok = true;
+    for (bool six_buttons : { false, true }) {
+      MegaDriveHarness harness;
+      ok = harness.run(six_buttons, (argc > 2) ? atoi(argv[2]) : 500) && ok;
+    }
+
+    return ok ? 0 : failure_status(2);
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--serial")) {
+    SerialHarness::header();
+    SerialHarness harness;
+    return harness.run((argc > 2) ? atoi(argv[2]) : 2000) ? 0 : 1;
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--ring")) {
+    RingHarness::header();
+    for (uint64_t spin_us : { 0, 1000 }) {
+      RingHarness harness;
+      harness.run(spin_us, (argc > 2) ? atoi(argv[2]) : 5000);
+    }
+
+    return 0;
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--udp")) {
+    UDPHarness::header();
+    UDPHarness harness;
+    return harness.run((argc > 2) ? atoi(argv[2]) : 2000) ? 0 : 1;
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--hidraw")) {
+    HidrawHarness::header();
+    HidrawHarness harness;
+    return harness.run((argc > 2) ? atoi(argv[2]) : 1000000) ? 0 : 1;
+  }
+
+  if ((argc > 1) && !strcmp(argv[1], "--backends")) {
+    BackendBenchmark benchmark;
+    list<string> specs;
+    string recording, report;
+    unsigned transitions = 1000;
+
+    for (int i = 2; i < argc; ++i) {
+      if (!strcmp(argv[i], "--fast"))
+        benchmark.set_paced(false);
+      else if (!strcmp(argv[i], "--recording") && (i + 1 < argc))
+        recording = argv[++i];
+      else if (!strcmp(argv[i], "--report") && (i + 1 < argc))
+        report = argv[++i];
+      else if (!strcmp(argv[i], "--transitions") && (i + 1 < argc))
+        transitions = atoi(argv[++i]);
+      else
+        specs.push_back(argv[i]);
+    }
+
+    if (recording.empty())
+      benchmark.generate(transitions);
+    else
+      benchmark.load(recording);
+
+    if (specs.empty())
+      specs = OutputBackend::names();
+
+    // Backends log at info level
+    auto logger = spdlog::basic_logger_mt("bench", "/dev/null");
+    logger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(logger);
+
+    BackendBenchmark::header();
+    for (const auto& spec : specs)
+      benchmark.run(spec);
+
+    if (!report.empty()) {
+      ofstream stream(report);
+      stream << benchmark.report().dump(2) << endl;
+      if (!stream)
+        throw runtime_error(fmt::format("Cannot write {}", report));
+    }
+
+    return 0;
+  }
+
+  unsigned count = (argc > 1) ? atoi(argv[1]) : 1000000;
+  if (count == 0) {
+    cerr << "Usage: msctrl-bench [event count]" << endl;
+    cerr << "       msctrl-bench --imu" << endl;
+    cerr << "       msctrl-bench --prediction [recording...]" << endl;
+    cerr << "       msctrl-bench --paddle [seconds]" << endl;
+    cerr << "       msctrl-bench --sportspad [reads]" << endl;
+    cerr << "       msctrl-bench --megadrive [reads]" << endl;
+    cerr << "       msctrl-bench --serial [writes]" << endl;
+    cerr << "       msctrl-bench --ring [writes]" << endl;
+    cerr << "       msctrl-bench --udp [transitions]" << endl;
+    cerr << "       msctrl-bench --hidraw [iterations]" << endl;
+    cerr << "       msctrl-bench --backends [--fast] [--transitions n | --recording file] [--report file.json] [backend...]" << endl;
+    return 1;
+  }
+
+  MasterSystem ms;
+  ms.set_backend(new NullBackend());
+
+  Controller ctrl(0, "Bench controller");
+  Bench bench(count);
+
+  // Synthetic inputs: stick going round at 2 turns/s, sampled at 250 Hz
+  // like a Bluetooth DualShock; gyro at 250 Hz wobbling +/- 45 degrees.
+  const unsigned Period = 125;
+  vector<float> stick_x(Period), stick_y(Period), gyro(Period);
+  for (unsigned i = 0; i < Period; ++i) {
+    float angle = 2 * M_PI * i / Period;
+    stick_x[i] = cosf(angle);
+    stick_y[i] = sinf(angle);
+    gyro[i] = M_PI / 2 * cosf(angle);
+  }
+
+  {
+    ButtonMap map(ms);
+    map.add_mapping(Controller::Button::A, MasterSystem::Button::B1);
+    map.add_mapping(Controller::Button::RightTrigger, MasterSystem::Button::B2);
+
+    bench.run("ButtonMap", [](){}, [&](unsigned index) {
+      // Press/release A, with a non mapped button in between
+      switch (index % 4) {
+        case 0:
+          map.on_button_state(ctrl, Controller::Button::A, true);
+          break;
+        case 1:
+          map.on_button_state(ctrl, Controller::Button::X, true);
+          break;
+        case 2:
+          map.on_button_state(ctrl, Controller::Button::A, false);
+          break;
+        case 3:
+          map.on_button_state(ctrl, Controller::Button::X, false);
+          break;
+      }
+      ms.commit();
+    });
+  }
+
+  {
+    HatMap map(ms);
+    const Controller::Button dpad[4] = { Controller::Button::DPadUp, Controller::Button::DPadRight, Controller::Button::DPadDown, Controller::Button::DPadLeft };
+
+    bench.run("HatMap", [](){}, [&](unsigned index) {
+      map.on_button_state(ctrl, dpad[(index / 2) % 4], (index % 2) == 0);
+      ms.commit();
+    });
+  }
+
+  {
+    AxisMap map(ms, AxisMap::Axis::Left);
+
+    bench.run("AxisMap", [](){}, [&](unsigned index) {
+      // X and Y come as separate events
+      unsigned sample = (index / 2) % Period;
+      if (index % 2)
+        map.on_axis_motion(ctrl, Controller::Axis::LeftY, stick_y[sample]);
+      else
+        map.on_axis_motion(ctrl, Controller::Axis::LeftX, stick_x[sample]);
+      ms.commit();
+    });
+  }
+
+  {
+    Controller gyro_ctrl(1, "Bench controller");
+    GyroMap map(ms, GyroMap::Axis::PosZ, MasterSystem::Button::Left);
+    map.set_angle_threshold(15.0f);
+    map.add_to(gyro_ctrl);
+
+    uint64_t timestamp = 0;
+
+    bench.run("GyroMap+IMUIntegrator", [&]() {
+      // Let calibration complete outside of the timed run
+      for (unsigned index = 0; index < 200; ++index, timestamp += 4000)
+        gyro_ctrl.on_gyro_update(timestamp, 0.0f, 0.0f, 0.0f);
+    }, [&](unsigned index) {
+      gyro_ctrl.on_gyro_update(timestamp, 0.01f, -0.02f, gyro[index % Period]);
+      timestamp += 4000;
+      ms.commit();
+    });
+  }
+
+  {
+    // Same as configurations/afterburner.json: four mappings sharing
+    // the controller's integrator
+    Controller gyro_ctrl(2, "Bench controller");
+    list<unique_ptr<GyroMap>> maps;
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::PosZ, MasterSystem::Button::Left));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::NegZ, MasterSystem::Button::Right));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::NegX, MasterSystem::Button::Up));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::PosX, MasterSystem::Button::Down));
+    for (auto& map : maps)
+      map->add_to(gyro_ctrl);
+
+    uint64_t timestamp = 0;
+
+    bench.run("4x GyroMap", [&]() {
+      for (unsigned index = 0; index < 200; ++index, timestamp += 4000)
+        gyro_ctrl.on_gyro_update(timestamp, 0.0f, 0.0f, 0.0f);
+    }, [&](unsigned index) {
+      gyro_ctrl.on_gyro_update(timestamp, gyro[(index + Period / 4) % Period], -0.02f, gyro[index % Period]);
+      timestamp += 4000;
+      ms.commit();
+    });
+  }
+
+  {
+    // Full path from the frontend entry points, with a typical set of
+    // mappings on one controller: afterburner.json plus the d-pad and
+    // the left stick
+    Controller full_ctrl(3, "Bench controller");
+    ButtonMap buttons(ms);
+    buttons.add_mapping(Controller::Button::RightTrigger, MasterSystem::Button::B1);
+    buttons.add_mapping(Controller::Button::A, MasterSystem::Button::B2);
+    HatMap hat(ms);
+    AxisMap stick(ms, AxisMap::Axis::Left);
+    list<unique_ptr<GyroMap>> maps;
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::PosZ, MasterSystem::Button::Left));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::NegZ, MasterSystem::Button::Right));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::NegX, MasterSystem::Button::Up));
+    maps.emplace_back(new GyroMap(ms, GyroMap::Axis::PosX, MasterSystem::Button::Down));
+
+    buttons.add_to(full_ctrl);
+    hat.add_to(full_ctrl);
+    stick.add_to(full_ctrl);
+    for (auto& map : maps)
+      map->add_to(full_ctrl);
+
+    const uint8_t sources[4] = { SDL_CONTROLLER_BUTTON_A, SDL_CONTROLLER_BUTTON_DPAD_UP, SDL_CONTROLLER_BUTTON_X, SDL_CONTROLLER_BUTTON_DPAD_LEFT };
+
+    bench.run("Controller buttons", [](){}, [&](unsigned index) {
+      uint8_t button = sources[(index / 2) % 4];
+      if (index % 2)
+        full_ctrl.on_button_release(button);
+      else
+        full_ctrl.on_button_press(button);
+      ms.commit();
+    });
+
+    bench.run("Controller axes", [](){}, [&](unsigned index) {
+      unsigned sample = (index / 2) % Period;
+      if (index % 2)
+        full_ctrl.on_axis_motion(SDL_CONTROLLER_AXIS_LEFTY, static_cast<int16_t>(stick_y[sample] * SDL_JOYSTICK_AXIS_MAX));
+      else
+        full_ctrl.on_axis_motion(SDL_CONTROLLER_AXIS_LEFTX, static_cast<int16_t>(stick_x[sample] * SDL_JOYSTICK_AXIS_MAX));
+      ms.commit();
+    });
+
+    uint64_t timestamp = 0;
+
+    bench.run("Controller gyro", [&]() {
+      for (unsigned index = 0; index < 200; ++index, timestamp += 4000)
+        full_ctrl.on_gyro_update(timestamp, 0.0f, 0.0f, 0.0f);
+    }, [&](unsigned index) {
+      full_ctrl.on_gyro_update(timestamp, gyro[(index + Period / 4) % Period], -0.02f, gyro[index % Period]);
+      timestamp += 4000;
+      ms.commit();
+    });
+  }
+
+  IMUAccuracy accuracy;
+  bool ok = true;
+  for (unsigned rate : { 250, 500, 1000 })
+    ok = accuracy.run(rate) && ok;
+
+  return ok ? 0 : 1;
+}
@@ -31,6 +31,10 @@ namespace MSCtrl
      */
     void set_angle_hysteresis(float delta);
 
+    unsigned subscriptions() const override {
+      return AxisEvents;
+    }
+
     void add_to(Controller&) override;
     void on_axis_motion(Controller&, Controller::Axis, float) override;
 
@@ -1,42 +1,60 @@
 
+#include <list>
+
+#include <fmt/core.h>
 #include <spdlog/spdlog.h>
 
 #include "ButtonMap.h"
 #include "utils.h"
 
+using namespace std;
+
 namespace MSCtrl
 {
-  ButtonMap::ButtonMap(MasterSystem& ms, ButtonMap::Button dst)
+  ButtonMap::ButtonMap(MasterSystem& ms)
     : m_ms(ms),
-      m_dst(dst),
-      m_src()
+      m_table()
   {
   }
 
-  void ButtonMap::add_source_button(Controller::Button btn)
+  void ButtonMap::add_mapping(Controller::Button src, MasterSystem::Button dst)
   {
-    m_src.insert(btn);
+    m_table[static_cast<unsigned>(src)] |= MasterSystem::button_bit(dst);
+  }
+
+  bool ButtonMap::empty() const
+  {
+    for (auto mask : m_table) {
+      if (mask != 0)
+        return false;
+    }
+
+    return true;
   }
 
   void ButtonMap::add_to(Controller& ctrl)
   {
-    spdlog::info("Add button mapping {} -> {} to {}", join_strings(",", m_src.begin(), m_src.end()), (m_dst == Button::B1) ? "B1" : "B2", ctrl.name());
+    list<string> mappings;
+    for (unsigned src = 0; src < Controller::ButtonCount; ++src) {
+      for (unsigned dst = 0; dst < MasterSystem::ButtonCount; ++dst) {
+        if (m_table[src] & (1U << dst))
+          mappings.push_back(fmt::format("{}->{}", Controller::button_name(static_cast<Controller::Button>(src)), MasterSystem::button_name(static_cast<MasterSystem::Button>(dst))));
+      }
+    }
+
+    spdlog::info("Add button mapping {} to {}", join_strings(",", mappings.begin(), mappings.end()), ctrl.name());
 
     Controller::Listener::add_to(ctrl);
   }
 
   void ButtonMap::on_button_state(Controller& ctrl, Controller::Button btn, bool state)
   {
-    if (m_src.find(btn) != m_src.end()) {
-      switch (m_dst) {
-        case Button::B1:
-          spdlog::debug("{} B1 (from {} {})", (state ? "Press" : "Release"), ctrl.name(), Controller::button_name(btn));
-          m_ms.set_button_state(MasterSystem::Button::B1, state);
-          break;
-        case Button::B2:
-          spdlog::debug("{} B2 (from {} {})", (state ? "Press" : "Release"), ctrl.name(), Controller::button_name(btn));
-          m_ms.set_button_state(MasterSystem::Button::B2, state);
-          break;
+    unsigned mask = m_table[static_cast<unsigned>(btn)];
+
+    for (unsigned dst = 0; mask != 0; ++dst, mask >>= 1) {
+      if (mask & 1) {
+        spdlog::debug("{} {} (from {} {})", (state ? "Press" : "Release"), MasterSystem::button_name(static_cast<MasterSystem::Button>(dst)), ctrl.name(), Controller::button_name(btn));
+        m_ms.set_button_state(static_cast<MasterSystem::Button>(dst), state);
       }
     }
   }
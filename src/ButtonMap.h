@@ -2,32 +2,37 @@
 #ifndef _MSCTRL_BUTTONMAP_H
 #define _MSCTRL_BUTTONMAP_H
 
-#include <set>
+#include <array>
 
 #include <src/Controller.h>
 #include <src/MasterSystem.h>
 
 namespace MSCtrl
 {
+  /**
+   * Maps controller buttons to Master System buttons. The mapping is
+   * a flat table indexed by controller button, holding the mask of
+   * console buttons it drives.
+   */
   class ButtonMap : public Controller::Listener
   {
   public:
-    enum class Button {
-      B1,
-      B2
-    };
+    ButtonMap(MasterSystem& ms);
 
-    ButtonMap(MasterSystem& ms, Button dst);
+    void add_mapping(Controller::Button src, MasterSystem::Button dst);
 
-    void add_source_button(Controller::Button);
+    bool empty() const;
+
+    unsigned subscriptions() const override {
+      return ButtonEvents;
+    }
 
     void add_to(Controller&) override;
     void on_button_state(Controller&, Controller::Button, bool) override;
 
   private:
     MasterSystem& m_ms;
-    Button m_dst;
-    std::set<Controller::Button> m_src;
+    std::array<uint8_t, Controller::ButtonCount> m_table;
   };
 }
 
@@ -14,10 +14,175 @@
 #include "HatMap.h"
 #include "AxisMap.h"
 #include "GyroMap.h"
+#include "TiltMap.h"
+#include "Paddle.h"
+#include "SportsPad.h"
+#include "MegaDrivePad.h"
+#include "EvdevInput.h"
+#include "UDPInput.h"
+#include "HidrawInput.h"
+#include "Realtime.h"
 #include "utils.h"
 
 using namespace std;
 
+namespace
+{
+  using namespace MSCtrl;
+
+  /**
+   * Value of an option taking a non-negative integer; the whole
+   * string must be digits
+   */
+  int parse_unsigned(const char* option, const string& value)
+  {
+    if (value.empty() || (value.size() > 9) || (value.find_first_not_of("0123456789") != string::npos))
+      throw runtime_error(fmt::format("Invalid value \"{}\" for {}", value, option));
+
+    return stoi(value);
+  }
+
+  /**
+   * Create a gyro or tilt mapping from its JSON configuration
+   */
+  Controller::Listener* create_gyro_map(MasterSystem& ms, const nlohmann::json& config)
+  {
+    GyroMap::Axis axis = GyroMap::axis_from_name(config["axis"]);
+    MasterSystem::Button button = MasterSystem::button_from_name(config["button"]);
+    string mode = config.value("mode", "integrated");
+
+    if (mode == "integrated") {
+      unique_ptr<GyroMap> map(new GyroMap(ms, axis, button));
+
+      if (config.contains("threshold"))
+        map->set_angle_threshold(config["threshold"]);
+      if (config.contains("delta"))
+        map->set_angle_delta(config["delta"]);
+      if (config.contains("lazy"))
+        map->set_lazy_sensor(config["lazy"]);
+      if (config.contains("horizon"))
+        map->set_prediction_horizon(config["horizon"]);
+
+      for (const auto& name : config.value("triggers", nlohmann::json::array()))
+        map->add_trigger_button(Controller::button_from_name(name));
+
+      return map.release();
+    }
+
+    unique_ptr<TiltMap> map(new TiltMap(ms, axis, button, TiltMap::mode_from_name(mode)));
+
+    if (config.contains("threshold"))
+      map->set_angle_threshold(config["threshold"]);
+    if (config.contains("delta"))
+      map->set_angle_delta(config["delta"]);
+    if (config.value("lazy", false) || config.contains("horizon"))
+      throw runtime_error("The lazy and pr options only apply to integrated gyro mappings");
+
+    for (const auto& name : config.value("triggers", nlohmann::json::array()))
+      map->add_trigger_button(Controller::button_from_name(name));
+
+    return map.release();
+  }
+
+  /**
+   * Scheduling of a peripheral's thread, if configured
+   */
+  Realtime* create_thread_realtime(const nlohmann::json& config)
+  {
+    if (!config.contains("cpu") && !config.contains("priority"))
+      return nullptr;
+
+    unique_ptr<Realtime> realtime(new Realtime());
+    if (config.contains("cpu"))
+      realtime->set_cpu(config["cpu"]);
+    if (config.contains("priority"))
+      realtime->set_priority(config["priority"]);
+
+    return realtime.release();
+  }
+
+  /**
+   * Create the paddle emulation from its JSON configuration
+   */
+  Peripheral* create_paddle(MasterSystem& ms, const nlohmann::json& config)
+  {
+    unique_ptr<Paddle> paddle(new Paddle(ms, Controller::axis_from_name(config["axis"])));
+
+    if (config.contains("period"))
+      paddle->set_period(config["period"]);
+    paddle->set_realtime(create_thread_realtime(config));
+
+    return paddle.release();
+  }
+
+  /**
+   * Create the Sports Pad emulation from its JSON configuration
+   */
+  Peripheral* create_sportspad(MasterSystem& ms, const nlohmann::json& config)
+  {
+    unique_ptr<SportsPad> pad(new SportsPad(ms, SportsPad::source_from_name(config["source"])));
+
+    if (config.contains("speed"))
+      pad->set_speed(config["speed"]);
+    pad->set_realtime(create_thread_realtime(config));
+
+    return pad.release();
+  }
+
+  /**
+   * Create the Mega Drive pad emulation from its JSON configuration
+   */
+  Peripheral* create_megadrive(MasterSystem& ms, const nlohmann::json& config)
+  {
+    string type = config["type"];
+    if ((type != "3") && (type != "6"))
+      throw runtime_error(fmt::format("Invalid Mega Drive pad type \"{}\" (3 or 6)", type));
+
+    unique_ptr<MegaDrivePad> pad(new MegaDrivePad(ms, type == "6"));
+
+    for (const auto& item : config.value("map", nlohmann::json::object()).items())
+      pad->set_mapping(Controller::button_from_name(item.key()), MegaDrivePad::button_from_name(item.value()));
+    pad->set_realtime(create_thread_realtime(config));
+
+    return pad.release();
+  }
+
+  /**
+   * Parse the <source>[,<k>=<v>...] specification of a peripheral into
+   * its JSON configuration
+   * @param first Key for the leading source
+   * @param keys Option names to configuration keys
+   * @param other Handles any other option; returns false if invalid
+   */
+  nlohmann::json parse_peripheral_spec(const string& spec, const string& first, const map<string, string>& keys,
+                                       const function<bool (const string&, nlohmann::json&)>& other = nullptr)
+  {
+    nlohmann::json config;
+
+    split_string(spec, ',', [&](unsigned index, const string& part) {
+      if (index == 0) {
+        config[first] = part;
+        return;
+      }
+
+      if (other && other(part, config))
+        return;
+
+      regex rx(R"((\w+)=(\d+))");
+      smatch mt;
+      if (!regex_match(part, mt, rx) || (keys.count(mt[1].str()) == 0))
+        throw runtime_error(fmt::format("Invalid option \"{}\"", part));
+
+      config[keys.at(mt[1].str())] = stoi(mt[2].str());
+    });
+
+    if (!config.contains(first) || config[first] == "")
+      throw runtime_error(fmt::format("Empty specification \"{}\"", spec));
+
+    return config;
+  }
+}
+
 namespace MSCtrl
 {
   CLParser::CLParser()
@@ -26,8 +191,8 @@ namespace MSCtrl
 
   void CLParser::parse(MasterSystem& ms, ConfigurationTarget& target, int argc, char* argv[])
   {
-    unique_ptr<ButtonMap> b1(new ButtonMap(ms, ButtonMap::Button::B1));
-    unique_ptr<ButtonMap> b2(new ButtonMap(ms, ButtonMap::Button::B2));
+    unique_ptr<ButtonMap> buttons(new ButtonMap(ms));
+    unique_ptr<Realtime> realtime(nullptr);
 
     nlohmann::json json_config;
     json_config["version"] = 1;
@@ -37,6 +202,15 @@ namespace MSCtrl
     json_config["config"]["gyro"] = nlohmann::json::array();
     string config_filename = "";
 
+    // Peripherals claim their buttons when created, so a second one
+    // would fail on the first one's claim
+    string peripheral;
+    auto check_peripheral = [&](const string& name) {
+      if (!peripheral.empty())
+        throw runtime_error(fmt::format("Cannot add a {}, a {} is already configured and only one peripheral can be emulated", name, peripheral));
+      peripheral = name;
+    };
+
     int state = 0;
     for (int i = 1; i < argc; ++i) {
       switch (state) {
@@ -58,6 +232,37 @@ namespace MSCtrl
             state = 5;
           else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--config"))
             state = 6;
+          else if (!strcmp(argv[i], "-B") || !strcmp(argv[i], "--backend"))
+            state = 7;
+          else if (!strcmp(argv[i], "--record"))
+            state = 8;
+          else if (!strcmp(argv[i], "--replay"))
+            state = 9;
+          else if (!strcmp(argv[i], "--replay-fast"))
+            state = 10;
+          else if (!strcmp(argv[i], "-E") || !strcmp(argv[i], "--evdev"))
+            state = 11;
+          else if (!strcmp(argv[i], "-U") || !strcmp(argv[i], "--udp"))
+            state = 19;
+          else if (!strcmp(argv[i], "-H") || !strcmp(argv[i], "--hidraw"))
+            state = 20;
+          else if (!strcmp(argv[i], "--realtime")) {
+            if (!realtime)
+              realtime.reset(new Realtime());
+          } else if (!strcmp(argv[i], "--gyro-rate"))
+            state = 14;
+          else if (!strcmp(argv[i], "--calibration-cache"))
+            state = 15;
+          else if (!strcmp(argv[i], "--rt-priority"))
+            state = 12;
+          else if (!strcmp(argv[i], "--rt-cpu"))
+            state = 13;
+          else if (!strcmp(argv[i], "-P") || !strcmp(argv[i], "--paddle"))
+            state = 16;
+          else if (!strcmp(argv[i], "--sportspad"))
+            state = 17;
+          else if (!strcmp(argv[i], "--megadrive"))
+            state = 18;
           else
             throw runtime_error(fmt::format("Unrecognized argument \"{}\"", argv[i]));
           break;
@@ -69,11 +274,7 @@ namespace MSCtrl
           if (!regex_match(v, mt, rx))
             throw runtime_error(fmt::format("Invalid mapping specification \"{}\"", v));
 
-          Controller::Button src = Controller::button_from_name(mt[1].str());
-          if (mt[2].str() == "B1")
-            b1->add_source_button(src);
-          if (mt[2].str() == "B2")
-            b2->add_source_button(src);
+          buttons->add_mapping(Controller::button_from_name(mt[1].str()), MasterSystem::button_from_name(mt[2].str()));
 
           json_config["config"]["buttons"][mt[1].str()] = mt[2].str();
 
@@ -132,8 +333,6 @@ namespace MSCtrl
           nlohmann::json config;
           config["triggers"] = nlohmann::json::array();
 
-          unique_ptr<GyroMap> map(nullptr);
-
           split_string(argv[i], ',', [&](unsigned index, const string& part) {
             if (index == 0) {
               regex rx(R"(((?:\+|-)?[XYZ]):([UDLR]))");
@@ -143,34 +342,39 @@ namespace MSCtrl
 
               config["axis"] = mt[1].str();
               config["button"] = mt[2].str();
-
-              map.reset(new GyroMap(ms, GyroMap::axis_from_name(mt[1].str()), MasterSystem::button_from_name(mt[2].str())));
             } else {
               if (Controller::has_button_named(part)) {
-                map->add_trigger_button(Controller::button_from_name(part));
                 config["triggers"].push_back(part);
                 return;
               }
 
-              regex rx(R"((th|hy)=(\d+(?:\.\d+)?))");
+              if (part == "lazy") {
+                config["lazy"] = true;
+                return;
+              }
+
+              if ((part == "tilt") || (part == "fused")) {
+                config["mode"] = part;
+                return;
+              }
+
+              regex rx(R"((th|hy|pr)=(\d+(?:\.\d+)?))");
               smatch mt;
               if (!regex_match(part, mt, rx))
                 throw runtime_error(fmt::format("Invalid gyro option \"{}\"", part));
 
               float value = stof(mt[2].str());
 
-              if (mt[1].str() == "th") {
-                map->set_angle_threshold(value);
+              if (mt[1].str() == "th")
                 config["threshold"] = value;
-              }
-              if (mt[2].str() == "hy") {
-                map->set_angle_delta(value);
+              else if (mt[1].str() == "hy")
                 config["delta"] = value;
-              }
+              else
+                config["horizon"] = value;
             }
           });
 
-          target.add_map(map.release());
+          target.add_map(create_gyro_map(ms, config));
           json_config["config"]["gyro"].push_back(config);
 
           state = 0;
@@ -188,12 +392,7 @@ namespace MSCtrl
           // There's only version 1 for now, don't check
 
           for (nlohmann::json::iterator pos = data["config"]["buttons"].begin(); pos != data["config"]["buttons"].end(); ++pos) {
-            auto src = Controller::button_from_name(pos.key());
-            
-            if (pos.value() == "B1")
-              b1->add_source_button(src);
-            if (pos.value() == "B2")
-              b2->add_source_button(src);
+            buttons->add_mapping(Controller::button_from_name(pos.key()), MasterSystem::button_from_name(pos.value()));
           }
 
           for (const auto& stick : data["config"]["sticks"]) {
@@ -205,19 +404,8 @@ namespace MSCtrl
             target.add_map(map.release());
           }
 
-          for (const auto& gyro : data["config"]["gyro"]) {
-            unique_ptr<GyroMap> map(new GyroMap(ms, GyroMap::axis_from_name(gyro["axis"]), MasterSystem::button_from_name(gyro["button"])));
-
-            if (gyro.contains("threshold"))
-              map->set_angle_threshold(gyro["threshold"]);
-            if (gyro.contains("delta"))
-              map->set_angle_delta(gyro["delta"]);
-
-            for (const auto& name : gyro["triggers"])
-              map->add_trigger_button(Controller::button_from_name(name));
-
-            target.add_map(map.release());
-          }
+          for (const auto& gyro : data["config"]["gyro"])
+            target.add_map(create_gyro_map(ms, gyro));
 
           if (data["config"].contains("hat"))
             target.add_map(new HatMap(ms));
@@ -226,9 +414,111 @@ namespace MSCtrl
             target.set_trigger_threshold(data["config"]["trigger_threshold"]);
           }
 
+          if (data["config"].contains("gyro_rate"))
+            target.set_gyro_rate(data["config"]["gyro_rate"]);
+
+          if (data["config"].contains("calibration_cache"))
+            target.set_calibration_cache(data["config"]["calibration_cache"]);
+
+          if (data["config"].contains("paddle")) {
+            check_peripheral("paddle");
+            target.set_peripheral(create_paddle(ms, data["config"]["paddle"]));
+          }
+          if (data["config"].contains("sportspad")) {
+            check_peripheral("Sports Pad");
+            target.set_peripheral(create_sportspad(ms, data["config"]["sportspad"]));
+          }
+          if (data["config"].contains("megadrive")) {
+            check_peripheral("Mega Drive pad");
+            target.set_peripheral(create_megadrive(ms, data["config"]["megadrive"]));
+          }
+
           state = 0;
           break;
         }
+        case 7:
+          if (ms.has_backend())
+            throw runtime_error("-B/--backend specified more than once");
+          ms.set_backend(OutputBackend::create(argv[i]));
+          state = 0;
+          break;
+        case 8:
+          target.set_record_file(argv[i]);
+          state = 0;
+          break;
+        case 9:
+        case 10:
+          target.set_replay_file(argv[i], state == 9);
+          state = 0;
+          break;
+        case 11:
+          target.add_input_source(new EvdevInput(argv[i]));
+          state = 0;
+          break;
+        case 12:
+        case 13:
+          if (!realtime)
+            realtime.reset(new Realtime());
+          if (state == 12)
+            realtime->set_priority(parse_unsigned("--rt-priority", argv[i]));
+          else
+            realtime->set_cpu(parse_unsigned("--rt-cpu", argv[i]));
+          state = 0;
+          break;
+        case 14:
+          json_config["config"]["gyro_rate"] = atof(argv[i]);
+          target.set_gyro_rate(atof(argv[i]));
+          state = 0;
+          break;
+        case 15:
+          json_config["config"]["calibration_cache"] = argv[i];
+          target.set_calibration_cache(argv[i]);
+          state = 0;
+          break;
+        case 16:
+        {
+          auto config = parse_peripheral_spec(argv[i], "axis", { { "pe", "period" }, { "cpu", "cpu" }, { "rt", "priority" } });
+          check_peripheral("paddle");
+          target.set_peripheral(create_paddle(ms, config));
+          json_config["config"]["paddle"] = config;
+          state = 0;
+          break;
+        }
+        case 17:
+        {
+          auto config = parse_peripheral_spec(argv[i], "source", { { "sp", "speed" }, { "cpu", "cpu" }, { "rt", "priority" } });
+          check_peripheral("Sports Pad");
+          target.set_peripheral(create_sportspad(ms, config));
+          json_config["config"]["sportspad"] = config;
+          state = 0;
+          break;
+        }
+        case 18:
+        {
+          auto config = parse_peripheral_spec(argv[i], "type", { { "cpu", "cpu" }, { "rt", "priority" } },
+                                              [](const string& part, nlohmann::json& config) {
+            regex rx(R"((\w+):(\w+))");
+            smatch mt;
+            if (!regex_match(part, mt, rx))
+              return false;
+
+            config["map"][mt[1].str()] = mt[2].str();
+            return true;
+          });
+          check_peripheral("Mega Drive pad");
+          target.set_peripheral(create_megadrive(ms, config));
+          json_config["config"]["megadrive"] = config;
+          state = 0;
+          break;
+        }
+        case 19:
+          target.add_input_source(new UDPInput(argv[i]));
+          state = 0;
+          break;
+        case 20:
+          target.add_input_source(new HidrawInput(argv[i]));
+          state = 0;
+          break;
       }
     }
 
@@ -247,10 +537,44 @@ namespace MSCtrl
         throw runtime_error("-o/--output without filename");
       case 6:
         throw runtime_error("-c/--config without filename");
+      case 7:
+        throw runtime_error("-B/--backend without value");
+      case 8:
+        throw runtime_error("--record without filename");
+      case 9:
+        throw runtime_error("--replay without filename");
+      case 10:
+        throw runtime_error("--replay-fast without filename");
+      case 11:
+        throw runtime_error("-E/--evdev without value");
+      case 12:
+        throw runtime_error("--rt-priority without value");
+      case 13:
+        throw runtime_error("--rt-cpu without value");
+      case 14:
+        throw runtime_error("--gyro-rate without value");
+      case 15:
+        throw runtime_error("--calibration-cache without filename");
+      case 16:
+        throw runtime_error("-P/--paddle without value");
+      case 17:
+        throw runtime_error("--sportspad without value");
+      case 18:
+        throw runtime_error("--megadrive without value");
+      case 19:
+        throw runtime_error("-U/--udp without value");
+      case 20:
+        throw runtime_error("-H/--hidraw without value");
     }
 
-    target.add_map(b1.release());
-    target.add_map(b2.release());
+    if (!ms.has_backend())
+      ms.set_backend(OutputBackend::create(OutputBackend::default_name()));
+
+    if (!buttons->empty())
+      target.add_map(buttons.release());
+
+    if (realtime)
+      target.set_realtime(realtime.release());
 
     if (config_filename != "") {
       ofstream ofs(config_filename);
@@ -283,16 +607,73 @@ namespace MSCtrl
 
     cerr << "  -g, --gyro <spec>      Map a gyro axis to a dpad button. <spec> is of the form <axis>:<button>[,options...]" << endl;
     cerr << "                         <axis> may be X, -X, Y, -Y, Z or -Z. <button> can be U,D,L or R (for up, down, left, right)." << endl;
-    cerr << "                         Options is a comma-separated list of either button names (X,Y,A,etc) or <k>=<v>, where <k> may be" << endl;
+    cerr << "                         Options is a comma-separated list of either button names (X,Y,A,etc), \"lazy\", \"tilt\", \"fused\"" << endl;
+    cerr << "                         or <k>=<v>, where <k> may be" << endl;
     cerr << "                            th: Angle threshold in degrees (default 20)" << endl;
     cerr << "                            hy: Hysteresis angle threshold in degrees (default 3)" << endl;
+    cerr << "                            pr: Press (and release) when the threshold is predicted to be crossed within" << endl;
+    cerr << "                                this many ms at the current angular velocity (default 0, no prediction)" << endl;
     cerr << "                         If no buttons are specified, the mapping will always be enabled. Else, it will only be enabled" << endl;
     cerr << "                         whell all those buttons are pressed, and the neutral state is the controller's position when" << endl;
-    cerr << "                         they were pressed." << endl;
+    cerr << "                         they were pressed. With \"lazy\", the gamepad's gyro is only turned on while they are pressed." << endl;
+    cerr << "                         With \"tilt\" or \"fused\", the absolute tilt measured from gravity is used instead, from the" << endl;
+    cerr << "                         accelerometer only or filtered with the gyro. There is no reference position, and buttons" << endl;
+    cerr << "                         only enable the mapping. Y axes are not supported in these modes." << endl;
     cerr << "                         Example: -g -X,L,th=15,LS,RS" << endl;
 
+    cerr << "  --gyro-rate <hz>       Average gyro samples down to this rate (default: the sensor's rate)" << endl;
+
+    cerr << "  --calibration-cache <name>" << endl;
+    cerr << "                         Save gyro calibrations to this file and reuse them when a known gamepad connects" << endl;
+
+    cerr << "  -P, --paddle <spec>    Emulate a Paddle Control (HPD-200) instead of a pad. <spec> is of the form" << endl;
+    cerr << "                         <axis>[,<k>=<v>...] where <axis> is LX, LY, RX, RY, LT or RT, and <k> may be" << endl;
+    cerr << "                            pe: Nibble period in microseconds (default 60)" << endl;
+    cerr << "                            cpu: Pin the paddle thread to this CPU" << endl;
+    cerr << "                            rt: SCHED_FIFO priority of the paddle thread" << endl;
+    cerr << "                         U, D, L, R and B2 are then driven by the paddle; map the paddle button to B1." << endl;
+    cerr << "                         Example: -P RX,cpu=3 -b A:B1" << endl;
+
+    cerr << "  --sportspad <spec>     Emulate a Sports Pad (trackball). <spec> is of the form <source>[,<k>=<v>...] where" << endl;
+    cerr << "                         <source> is L or R (stick speed) or gyro (yaw and pitch), and <k> may be" << endl;
+    cerr << "                            sp: Counts per second at full stick deflection (default 1200) or per radian (default 400)" << endl;
+    cerr << "                            cpu, rt: Same as for -P" << endl;
+    cerr << "                         U, D, L and R are then driven in response to TH, read from GPIO23." << endl;
+
+    cerr << "  --megadrive <spec>     Emulate a Mega Drive pad (through the Power Base Converter). <spec> is of the form" << endl;
+    cerr << "                         <type>[,<options>] where <type> is 3 or 6 (buttons), and <options> may be" << endl;
+    cerr << "                            <src>:<dst>: Map a controller button (A,B,X,Y,LS,RS,LT,RT,U,D,L,R,START,BACK)" << endl;
+    cerr << "                                         to a pad button (U,D,L,R,A,B,C,START,X,Y,Z,MODE)" << endl;
+    cerr << "                            cpu, rt: Same as for -P" << endl;
+    cerr << "                         The default mapping is the D-pad, X/A/B to A/B/C, LS/Y/RS to X/Y/Z, START and BACK" << endl;
+    cerr << "                         to Start and Mode. All pins are driven in response to TH, read from GPIO23." << endl;
+
     cerr << "  -o, --output <name>    Save configuration as JSON to the specified file" << endl;
 
     cerr << "  -c, --config           Load specified JSON file before proceeding" << endl;
+
+    auto backends = OutputBackend::names();
+    cerr << "  -B, --backend <name>   Select how GPIOs are driven: " << join_strings(", ", backends.begin(), backends.end()) << endl;
+    cerr << "                         (default " << OutputBackend::default_name() << ")" << endl;
+
+    cerr << "  --record <name>        Record all controller events to the specified file" << endl;
+    cerr << "  --replay <name>        Replay recorded events in real time instead of reading controllers" << endl;
+    cerr << "  --replay-fast <name>   Replay recorded events as fast as possible" << endl;
+
+    cerr << "  -E, --evdev <node>     Read a gamepad directly from its /dev/input/event* node (and its motion" << endl;
+    cerr << "                         sensors node) instead of SDL. Use \"auto\" for all gamepads in /dev/input." << endl;
+    cerr << "                         This option can be repeated." << endl;
+
+    cerr << "  -H, --hidraw <node>    Read a DualShock 4 or DualSense from its /dev/hidraw* node and decode its reports" << endl;
+    cerr << "                         instead of SDL or evdev. Use \"auto\" for all of them. This option can be repeated." << endl;
+
+    cerr << "  -U, --udp <[addr:]port>" << endl;
+    cerr << "                         Receive gamepads sent by msctrl-send from another machine, on this UDP port" << endl;
+    cerr << "                         (and address, default all). Can be combined with -E." << endl;
+
+    cerr << "  --realtime             Lock memory and run the event loop with SCHED_FIFO (needs CAP_SYS_NICE" << endl;
+    cerr << "                         and CAP_IPC_LOCK, or root)" << endl;
+    cerr << "  --rt-priority <n>      SCHED_FIFO priority, 1 to 99 (default 50). Implies --realtime" << endl;
+    cerr << "  --rt-cpu <n>           Pin the event loop to the specified CPU. Implies --realtime" << endl;
   }
 }
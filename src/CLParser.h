@@ -6,6 +6,9 @@
 
 #include <src/Controller.h>
 #include <src/MasterSystem.h>
+#include <src/InputSource.h>
+#include <src/Realtime.h>
+#include <src/Peripheral.h>
 
 namespace MSCtrl
 {
@@ -22,6 +25,13 @@ namespace MSCtrl
     public:
       virtual void add_map(Controller::Listener*) = 0;
       virtual void set_trigger_threshold(float) = 0;
+      virtual void set_gyro_rate(float) = 0;
+      virtual void set_calibration_cache(const std::string&) = 0;
+      virtual void set_record_file(const std::string&) = 0;
+      virtual void set_replay_file(const std::string&, bool realtime) = 0;
+      virtual void add_input_source(InputSource*) = 0;
+      virtual void set_realtime(Realtime*) = 0;
+      virtual void set_peripheral(Peripheral*) = 0;
     };
 
     CLParser();
@@ -0,0 +1,145 @@
+
+#include <stdexcept>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <nlohmann/json.hpp>
+
+#include "CalibrationCache.h"
+
+using namespace std;
+
+namespace MSCtrl
+{
+  CalibrationCache::CalibrationCache(const string& filename)
+    : m_filename(filename),
+      m_entries(),
+      m_mutex(),
+      m_cond(),
+      m_dirty(false),
+      m_stopping(false),
+      m_writer()
+  {
+    load();
+
+    // Disk writes never happen on the event loop
+    m_writer = thread([this]() {
+      unique_lock<mutex> lock(m_mutex);
+
+      while (true) {
+        m_cond.wait(lock, [this]() { return m_dirty || m_stopping; });
+        if (!m_dirty)
+          break;
+
+        auto entries = m_entries;
+        m_dirty = false;
+
+        lock.unlock();
+        save(entries);
+        lock.lock();
+      }
+    });
+  }
+
+  CalibrationCache::~CalibrationCache()
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_writer.join();
+  }
+
+  void CalibrationCache::add_to(Controller& ctrl)
+  {
+    if (ctrl.guid().empty()) {
+      spdlog::debug("No GUID for {}, gyro calibration will not be cached", ctrl.name());
+      return;
+    }
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+      auto pos = m_entries.find(ctrl.guid());
+      if (pos != m_entries.end())
+        ctrl.set_gyro_bias(pos->second.gyro[0], pos->second.gyro[1], pos->second.gyro[2]);
+    }
+
+    Controller::Listener::add_to(ctrl);
+  }
+
+  void CalibrationCache::on_gyro_calibrated(Controller& ctrl, float x, float y, float z)
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      Entry& entry = m_entries[ctrl.guid()];
+      entry.name = ctrl.name();
+      entry.gyro = { x, y, z };
+      m_dirty = true;
+    }
+    m_cond.notify_one();
+  }
+
+  void CalibrationCache::load()
+  {
+    ifstream ifs(m_filename);
+    if (!ifs) {
+      spdlog::info("No calibration cache in {} yet", m_filename);
+      return;
+    }
+
+    try {
+      auto data = nlohmann::json::parse(ifs);
+
+      for (auto pos = data["controllers"].begin(); pos != data["controllers"].end(); ++pos) {
+        const auto& gyro = pos.value()["gyro"];
+        Entry entry;
+        entry.name = pos.value().value("name", "");
+        entry.gyro = { gyro["X"].get<float>(), gyro["Y"].get<float>(), gyro["Z"].get<float>() };
+        m_entries[pos.key()] = entry;
+      }
+    } catch (const exception& exc) {
+      spdlog::warn("Ignoring invalid calibration cache {}: {}", m_filename, exc.what());
+      m_entries.clear();
+      return;
+    }
+
+    spdlog::info("Loaded gyro calibration for {} controller(s) from {}", m_entries.size(), m_filename);
+  }
+
+  void CalibrationCache::save(const map<string, Entry>& entries)
+  {
+    nlohmann::json data;
+    data["version"] = 1;
+    data["controllers"] = nlohmann::json::object();
+
+    for (const auto& pos : entries) {
+      nlohmann::json entry;
+      entry["name"] = pos.second.name;
+      entry["gyro"]["X"] = pos.second.gyro[0];
+      entry["gyro"]["Y"] = pos.second.gyro[1];
+      entry["gyro"]["Z"] = pos.second.gyro[2];
+      data["controllers"][pos.first] = entry;
+    }
+
+    // Write to a temporary file first so that the cache is never left truncated
+    string tmp = m_filename + ".tmp";
+    {
+      ofstream ofs(tmp);
+      ofs << data.dump(2);
+      if (!ofs) {
+        spdlog::warn("Cannot write calibration cache {}", tmp);
+        return;
+      }
+    }
+
+    if (rename(tmp.c_str(), m_filename.c_str()) < 0)
+      spdlog::warn("Cannot write calibration cache {}: {}", m_filename, strerror(errno));
+    else
+      spdlog::debug("Saved gyro calibration to {}", m_filename);
+  }
+}
@@ -0,0 +1,57 @@
+
+#ifndef _MSCTRL_CALIBRATIONCACHE_H
+#define _MSCTRL_CALIBRATIONCACHE_H
+
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <src/Controller.h>
+
+namespace MSCtrl
+{
+  /**
+   * Gyro calibration offsets saved across runs, keyed by joystick
+   * GUID. The JSON file looks like
+   *   { "version": 1, "controllers": { "<guid>": { "name": "...", "gyro": { "X": 0.0, "Y": 0.0, "Z": 0.0 } } } }
+   * Cached offsets are applied to controllers as they are opened, and
+   * the file is rewritten by a background thread whenever a controller
+   * is (re)calibrated.
+   */
+  class CalibrationCache : public Controller::Listener
+  {
+  public:
+    CalibrationCache(const std::string& filename);
+    ~CalibrationCache();
+
+    unsigned subscriptions() const override {
+      return CalibrationEvents;
+    }
+
+    void add_to(Controller&) override;
+    void on_gyro_calibrated(Controller&, float, float, float) override;
+
+  private:
+    struct Entry {
+      std::string name;
+      std::array<float, 3> gyro;
+    };
+
+    std::string m_filename;
+    std::map<std::string, Entry> m_entries;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_dirty;
+    bool m_stopping;
+    std::thread m_writer;
+
+    void load();
+    void save(const std::map<std::string, Entry>&);
+  };
+}
+
+#endif /* _MSCTRL_CALIBRATIONCACHE_H */
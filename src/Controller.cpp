@@ -1,5 +1,7 @@
 
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
@@ -8,6 +10,12 @@
 
 using namespace std;
 
+namespace
+{
+  // Samples right after the gyro is turned on are not reliable (us)
+  const uint64_t GyroWarmup = 30000;
+}
+
 namespace MSCtrl
 {
   void Controller::Listener::add_to(Controller& ctrl)
@@ -17,26 +25,73 @@ namespace MSCtrl
 
   Controller::Controller(int index)
     : m_handle(SDL_GameControllerOpen(index)),
+      m_id(-1),
+      m_name(),
+      m_guid(),
       m_trigger_threshold(0.5f),
-      m_listeners(),
+      m_button_listeners(),
+      m_axis_listeners(),
+      m_gyro_listeners(),
+      m_calibration_listeners(),
+      m_accel_listeners(),
+      m_IMU(),
+      m_gyro_state(GyroState::Off),
+      m_gyro_requests(0),
+      m_gyro_rate(0.0f),
+      m_gyro_decimation(1),
+      m_gyro_pending(0),
+      m_gyro_sum(),
+      m_gyro_warmup_end(0),
+      m_accel_requests(0),
       m_last_left(0.0f),
       m_last_right(0.0f)
   {
     if (!m_handle)
       throw runtime_error(fmt::format("Error opening controller #{}: {}", index, SDL_GetError()));
 
-    if (SDL_GameControllerHasSensor(m_handle, SDL_SENSOR_GYRO)) {
-      if (SDL_GameControllerSetSensorEnabled(m_handle, SDL_SENSOR_GYRO, SDL_TRUE) < 0)
-        throw runtime_error(fmt::format("Cannot enable gyro: {}", SDL_GetError()));
-      spdlog::info("Gyro enabled on {}", name());
-    } else {
-      spdlog::warn("Controller {} has no gyro", name());
+    m_id = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_handle));
+    m_name = SDL_GameControllerName(m_handle);
+
+    char guid[33];
+    SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(SDL_GameControllerGetJoystick(m_handle)), guid, sizeof(guid));
+    m_guid = guid;
+
+    // Sensors stay off until something asks for them
+    for (SDL_SensorType type : { SDL_SENSOR_GYRO, SDL_SENSOR_ACCEL }) {
+      if (SDL_GameControllerHasSensor(m_handle, type))
+        SDL_GameControllerSetSensorEnabled(m_handle, type, SDL_FALSE);
     }
   }
 
+  Controller::Controller(SDL_JoystickID id, const string& name, const string& guid)
+    : m_handle(nullptr),
+      m_id(id),
+      m_name(name),
+      m_guid(guid),
+      m_trigger_threshold(0.5f),
+      m_button_listeners(),
+      m_axis_listeners(),
+      m_gyro_listeners(),
+      m_calibration_listeners(),
+      m_accel_listeners(),
+      m_IMU(),
+      m_gyro_state(GyroState::Off),
+      m_gyro_requests(0),
+      m_gyro_rate(0.0f),
+      m_gyro_decimation(1),
+      m_gyro_pending(0),
+      m_gyro_sum(),
+      m_gyro_warmup_end(0),
+      m_accel_requests(0),
+      m_last_left(0.0f),
+      m_last_right(0.0f)
+  {
+  }
+
   Controller::~Controller()
   {
-    SDL_GameControllerClose(m_handle);
+    if (m_handle)
+      SDL_GameControllerClose(m_handle);
   }
 
   void Controller::set_trigger_threshold(float value)
@@ -50,42 +105,150 @@ namespace MSCtrl
     spdlog::debug("Trigger threshold for {}: {:.2f}", name(), value);
   }
 
-  void Controller::add_listener(Controller::Listener* listener)
+  void Controller::set_gyro_rate(float rate)
   {
-    m_listeners.push_back(listener);
+    if (rate < 0.0f)
+      throw runtime_error(fmt::format("Gyro rate {} is negative", rate));
+
+    m_gyro_rate = rate;
+    if (m_gyro_state != GyroState::Off)
+      update_gyro_decimation();
   }
 
-  void Controller::remove_listener(Controller::Listener* listener)
+  void Controller::request_gyro()
+  {
+    if (m_gyro_requests++ == 0)
+      enable_gyro(true);
+  }
+
+  void Controller::release_gyro()
+  {
+    if ((m_gyro_requests != 0) && (--m_gyro_requests == 0))
+      enable_gyro(false);
+  }
+
+  void Controller::enable_gyro(bool enabled)
+  {
+    if (m_handle) {
+      if (!SDL_GameControllerHasSensor(m_handle, SDL_SENSOR_GYRO)) {
+        if (enabled)
+          spdlog::warn("Controller {} has no gyro", name());
+        return;
+      }
+
+      if (SDL_GameControllerSetSensorEnabled(m_handle, SDL_SENSOR_GYRO, enabled ? SDL_TRUE : SDL_FALSE) < 0)
+        throw runtime_error(fmt::format("Cannot {} gyro: {}", enabled ? "enable" : "disable", SDL_GetError()));
+    }
+
+    if (enabled) {
+      m_gyro_state = GyroState::Enabling;
+      update_gyro_decimation();
+    } else {
+      // Samples still in flight are dropped; integration resumes from
+      // the next one once enabled again
+      m_gyro_state = GyroState::Off;
+      m_IMU.suspend();
+      spdlog::info("Gyro disabled on {}", name());
+    }
+  }
+
+  void Controller::update_gyro_decimation()
+  {
+    float rate = m_handle ? SDL_GameControllerGetSensorDataRate(m_handle, SDL_SENSOR_GYRO) : 0.0f;
+
+    m_gyro_decimation = 1;
+    m_gyro_pending = 0;
+    for (unsigned i = 0; i < 3; ++i)
+      m_gyro_sum[i] = 0.0f;
+
+    if ((m_gyro_rate > 0.0f) && (rate > 0.0f))
+      m_gyro_decimation = max(1L, lround(rate / m_gyro_rate));
+
+    if (rate <= 0.0f) {
+      spdlog::info("Gyro enabled on {} (unknown rate)", name());
+      if (m_gyro_rate > 0.0f)
+        spdlog::warn("Cannot set gyro rate on {} without knowing the sensor's", name());
+    } else if (m_gyro_decimation > 1) {
+      spdlog::info("Gyro enabled on {} at {:.0f} Hz, averaged down to {:.0f} Hz", name(), rate, rate / m_gyro_decimation);
+    } else {
+      spdlog::info("Gyro enabled on {} at {:.0f} Hz", name(), rate);
+    }
+  }
+
+  void Controller::request_accel()
+  {
+    if (m_accel_requests++ == 0)
+      enable_accel(true);
+  }
+
+  void Controller::release_accel()
   {
-    m_listeners.remove(listener);
+    if ((m_accel_requests != 0) && (--m_accel_requests == 0))
+      enable_accel(false);
   }
 
-  string Controller::name() const
+  void Controller::enable_accel(bool enabled)
   {
-    return SDL_GameControllerName(m_handle);
+    if (m_handle) {
+      if (!SDL_GameControllerHasSensor(m_handle, SDL_SENSOR_ACCEL)) {
+        if (enabled)
+          spdlog::warn("Controller {} has no accelerometer", name());
+        return;
+      }
+
+      if (SDL_GameControllerSetSensorEnabled(m_handle, SDL_SENSOR_ACCEL, enabled ? SDL_TRUE : SDL_FALSE) < 0)
+        throw runtime_error(fmt::format("Cannot {} accelerometer: {}", enabled ? "enable" : "disable", SDL_GetError()));
+    }
+
+    spdlog::info("Accelerometer {} on {}", enabled ? "enabled" : "disabled", name());
   }
 
-  bool Controller::matches(SDL_JoystickID id) const
+  void Controller::set_gyro_bias(float x, float y, float z)
   {
-    return (id == SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(m_handle)));
+    m_IMU.set_bias(x, y, z);
+    spdlog::info("Using cached gyro calibration for {}: X={:.3f}, Y={:.3f}, Z={:.3f}", name(), x, y, z);
+  }
+
+  void Controller::add_listener(Controller::Listener* listener)
+  {
+    unsigned events = listener->subscriptions();
+
+    if (events & Listener::ButtonEvents)
+      m_button_listeners.push_back(listener);
+    if (events & Listener::AxisEvents)
+      m_axis_listeners.push_back(listener);
+    if (events & Listener::GyroEvents)
+      m_gyro_listeners.push_back(listener);
+    if (events & Listener::CalibrationEvents)
+      m_calibration_listeners.push_back(listener);
+    if (events & Listener::AccelEvents)
+      m_accel_listeners.push_back(listener);
+  }
+
+  void Controller::remove_listener(Controller::Listener* listener)
+  {
+    for (auto listeners : { &m_button_listeners, &m_axis_listeners, &m_gyro_listeners, &m_calibration_listeners, &m_accel_listeners })
+      listeners->erase(remove(listeners->begin(), listeners->end(), listener), listeners->end());
+  }
+
+  void Controller::dispatch_button_state(Button btn, bool state)
+  {
+    for (auto listener : m_button_listeners)
+      listener->on_button_state(*this, btn, state);
   }
 
   void Controller::on_button_press(uint8_t btn)
   {
     Button b;
-    if (map_button(btn, b)) {
-      for (auto listener : m_listeners)
-        listener->on_button_state(*this, b, true);
-    }
+    if (map_button(btn, b))
+      dispatch_button_state(b, true);
   }
 
   void Controller::on_button_release(uint8_t btn)
   {
     Button b;
-    if (map_button(btn, b)) {
-      for (auto listener : m_listeners)
-        listener->on_button_state(*this, b, false);
-    }
+    if (map_button(btn, b))
+      dispatch_button_state(b, false);
   }
 
   void Controller::on_axis_motion(uint8_t axis, int16_t value)
@@ -95,24 +258,20 @@ namespace MSCtrl
       case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
         if ((m_last_left < m_trigger_threshold) && (fvalue >= m_trigger_threshold)) {
           spdlog::debug("Left trigger for {} above threshold", name());
-          for (auto listener : m_listeners)
-            listener->on_button_state(*this, Controller::Button::LeftTrigger, true);
+          dispatch_button_state(Controller::Button::LeftTrigger, true);
         } else if ((m_last_left >= m_trigger_threshold) && (fvalue < m_trigger_threshold)) {
           spdlog::debug("Left trigger for {} below threshold", name());
-          for (auto listener : m_listeners)
-            listener->on_button_state(*this, Controller::Button::LeftTrigger, false);
+          dispatch_button_state(Controller::Button::LeftTrigger, false);
         }
         m_last_left = fvalue;
         break;
       case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
         if ((m_last_right < m_trigger_threshold) && (fvalue >= m_trigger_threshold)) {
           spdlog::debug("Right trigger for {} above threshold", name());
-          for (auto listener : m_listeners)
-            listener->on_button_state(*this, Controller::Button::RightTrigger, true);
+          dispatch_button_state(Controller::Button::RightTrigger, true);
         } else if ((m_last_right >= m_trigger_threshold) && (fvalue < m_trigger_threshold)) {
           spdlog::debug("Right trigger for {} below threshold", name());
-          for (auto listener : m_listeners)
-            listener->on_button_state(*this, Controller::Button::RightTrigger, false);
+          dispatch_button_state(Controller::Button::RightTrigger, false);
         }
         m_last_right = fvalue;
         break;
@@ -122,17 +281,69 @@ namespace MSCtrl
 
     Axis a;
     if (map_axis(axis, a)) {
-      for (auto listener : m_listeners)
+      for (auto listener : m_axis_listeners)
         listener->on_axis_motion(*this, a, fvalue);
     }
   }
 
-  void Controller::on_gyro_update(uint32_t timestamp, float dx, float dy, float dz)
+  void Controller::on_gyro_update(uint64_t timestamp, float dx, float dy, float dz)
   {
-    for (auto& listener : m_listeners)
+    switch (m_gyro_state) {
+      case GyroState::Off:
+        return;
+      case GyroState::Enabling:
+        m_gyro_warmup_end = timestamp + GyroWarmup;
+        m_gyro_state = GyroState::WarmingUp;
+        return;
+      case GyroState::WarmingUp:
+        if (timestamp < m_gyro_warmup_end)
+          return;
+        m_gyro_state = GyroState::Running;
+        break;
+      case GyroState::Running:
+        break;
+    }
+
+    if (m_gyro_decimation > 1) {
+      m_gyro_sum[0] += dx;
+      m_gyro_sum[1] += dy;
+      m_gyro_sum[2] += dz;
+      if (++m_gyro_pending < m_gyro_decimation)
+        return;
+
+      dx = m_gyro_sum[0] / m_gyro_pending;
+      dy = m_gyro_sum[1] / m_gyro_pending;
+      dz = m_gyro_sum[2] / m_gyro_pending;
+      m_gyro_pending = 0;
+      m_gyro_sum[0] = m_gyro_sum[1] = m_gyro_sum[2] = 0.0f;
+    }
+
+    if (m_gyro_listeners.empty())
+      return;
+
+    bool running = m_IMU.update(*this, timestamp, dx, dy, dz);
+
+    if (m_IMU.take_calibration()) {
+      for (auto listener : m_calibration_listeners)
+        listener->on_gyro_calibrated(*this, m_IMU.bias(IMUIntegrator::X), m_IMU.bias(IMUIntegrator::Y), m_IMU.bias(IMUIntegrator::Z));
+    }
+
+    if (!running)
+      return;
+
+    for (auto listener : m_gyro_listeners)
       listener->on_gyro_update(*this, timestamp, dx, dy, dz);
   }
 
+  void Controller::on_accel_update(uint64_t timestamp, float ax, float ay, float az)
+  {
+    if (m_accel_requests == 0)
+      return;
+
+    for (auto listener : m_accel_listeners)
+      listener->on_accel_update(*this, timestamp, ax, ay, az);
+  }
+
   bool Controller::map_button(uint8_t src, Controller::Button& dst)
   {
     switch (src) {
@@ -166,6 +377,12 @@ namespace MSCtrl
       case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
         dst = Button::DPadDown;
         break;
+      case SDL_CONTROLLER_BUTTON_START:
+        dst = Button::Start;
+        break;
+      case SDL_CONTROLLER_BUTTON_BACK:
+        dst = Button::Back;
+        break;
       default:
         return false;
     }
@@ -228,6 +445,10 @@ namespace MSCtrl
         return "U";
       case Controller::Button::DPadDown:
         return "D";
+      case Controller::Button::Start:
+        return "START";
+      case Controller::Button::Back:
+        return "BACK";
     }
 
     return "UNK";
@@ -259,6 +480,10 @@ namespace MSCtrl
       return Controller::Button::DPadUp;
     if (name == "D")
       return Controller::Button::DPadDown;
+    if (name == "START")
+      return Controller::Button::Start;
+    if (name == "BACK")
+      return Controller::Button::Back;
 
     throw runtime_error(fmt::format("Invalid controller button name \"{}\"", name));
   }
@@ -4,10 +4,12 @@
 
 #include <ostream>
 #include <string>
-#include <list>
+#include <vector>
 
 #include <SDL2/SDL.h>
 
+#include <src/IMUIntegrator.h>
+
 namespace MSCtrl
 {
   class Controller
@@ -25,9 +27,13 @@ namespace MSCtrl
       DPadLeft,
       DPadRight,
       DPadUp,
-      DPadDown
+      DPadDown,
+      Start,
+      Back
     };
 
+    static constexpr unsigned ButtonCount = static_cast<unsigned>(Button::Back) + 1;
+
     enum class Axis {
       LeftX,
       LeftY,
@@ -40,13 +46,40 @@ namespace MSCtrl
     class Listener
     {
     public:
+      /**
+       * Event types a listener may subscribe to; the controller only
+       * dispatches an event to listeners that subscribed to its type.
+       */
+      enum Events {
+        ButtonEvents = 0x01,
+        AxisEvents = 0x02,
+        GyroEvents = 0x04,
+        CalibrationEvents = 0x08,
+        AccelEvents = 0x10,
+        AllEvents = 0x1F
+      };
+
+      virtual ~Listener() {}
+
+      virtual unsigned subscriptions() const {
+        return AllEvents;
+      }
+
       virtual void on_button_state(Controller&, Button, bool) {};
       virtual void on_axis_motion(Controller&, Axis, float) {};
-      virtual void on_gyro_update(Controller&, uint32_t, float, float, float) {};
+      virtual void on_gyro_update(Controller&, uint64_t, float, float, float) {};
+      virtual void on_gyro_calibrated(Controller&, float, float, float) {};
+      virtual void on_accel_update(Controller&, uint64_t, float, float, float) {};
 
       virtual void add_to(Controller&);
     };
 
+    /**
+     * Controller without an SDL device (events are fed by something
+     * else, like a replayed recording)
+     * @param guid SDL-style joystick GUID string, if known
+     */
+    Controller(SDL_JoystickID, const std::string&, const std::string& guid = std::string());
     ~Controller();
 
     Controller(const Controller&) = delete;
@@ -58,10 +91,55 @@ namespace MSCtrl
      */
     void set_trigger_threshold(float value);
 
+    /**
+     * Set the rate at which gyro samples are delivered to listeners;
+     * consecutive samples are averaged down to it. 0 (default) keeps
+     * the sensor's own rate.
+     * @param rate Rate in Hz
+     */
+    void set_gyro_rate(float rate);
+
+    /**
+     * Reference-counted request for gyro samples. The sensor is only
+     * enabled while there is at least one request, and samples are
+     * discarded for a short while after it has been enabled.
+     */
+    void request_gyro();
+    void release_gyro();
+
+    /**
+     * Same as request_gyro() for the accelerometer (without warm-up)
+     */
+    void request_accel();
+    void release_accel();
+
+    /**
+     * Use a known gyro bias (rad/s) right away instead of calibrating
+     * first; it is still refined once the controller is held still.
+     */
+    void set_gyro_bias(float, float, float);
+
     void add_listener(Listener*);
     void remove_listener(Listener*);
 
-    std::string name() const;
+    const std::string& name() const {
+      return m_name;
+    }
+
+    /**
+     * Joystick GUID as a string; may be empty
+     */
+    const std::string& guid() const {
+      return m_guid;
+    }
+
+    SDL_JoystickID id() const {
+      return m_id;
+    }
+
+    static uint16_t button_bit(Button btn) {
+      return 1U << static_cast<unsigned>(btn);
+    }
 
     static std::string button_name(Button);
     static Button button_from_name(const std::string&);
@@ -70,10 +148,65 @@ namespace MSCtrl
     static std::string axis_name(Axis);
     static Axis axis_from_name(const std::string&);
 
+    bool matches(SDL_JoystickID id) const {
+      return id == m_id;
+    }
+
+    /**
+     * Event entry points for input frontends; buttons and axes use
+     * the SDL_CONTROLLER_BUTTON_* and SDL_CONTROLLER_AXIS_* codes,
+     * gyro rates are in rad/s with a timestamp in us (from the sensor
+     * clock if possible).
+     */
+    void on_button_press(uint8_t);
+    void on_button_release(uint8_t);
+    void on_axis_motion(uint8_t, int16_t);
+    void on_gyro_update(uint64_t, float, float, float);
+
+    /**
+     * Accelerations are in m/s^2, with the same timestamps as the gyro
+     */
+    void on_accel_update(uint64_t, float, float, float);
+
+    /**
+     * Gyro angles, updated before gyro listeners are called
+     */
+    const IMUIntegrator& imu() const {
+      return m_IMU;
+    }
+
   private:
     SDL_GameController* m_handle;
+    SDL_JoystickID m_id;
+    std::string m_name;
+    std::string m_guid;
     float m_trigger_threshold;
-    std::list<Listener*> m_listeners;
+
+    // Per event type dispatch tables, built when listeners are added
+    std::vector<Listener*> m_button_listeners;
+    std::vector<Listener*> m_axis_listeners;
+    std::vector<Listener*> m_gyro_listeners;
+    std::vector<Listener*> m_calibration_listeners;
+    std::vector<Listener*> m_accel_listeners;
+
+    IMUIntegrator m_IMU;
+
+    enum class GyroState {
+      Off,
+      Enabling,
+      WarmingUp,
+      Running
+    };
+    GyroState m_gyro_state;
+    unsigned m_gyro_requests;
+    float m_gyro_rate;
+    unsigned m_gyro_decimation;
+    unsigned m_gyro_pending;
+    float m_gyro_sum[3];
+    uint64_t m_gyro_warmup_end;
+
+    unsigned m_accel_requests;
+
     float m_last_left;
     float m_last_right;
 
@@ -81,12 +214,10 @@ namespace MSCtrl
 
     Controller(int);
 
-    bool matches(SDL_JoystickID) const;
-
-    void on_button_press(uint8_t);
-    void on_button_release(uint8_t);
-    void on_axis_motion(uint8_t, int16_t);
-    void on_gyro_update(uint32_t, float, float, float);
+    void dispatch_button_state(Button, bool);
+    void enable_gyro(bool);
+    void update_gyro_decimation();
+    void enable_accel(bool);
 
     bool map_button(uint8_t, Button&);
     bool map_axis(uint8_t, Axis&);
@@ -0,0 +1,436 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "EvdevInput.h"
+#include "SDLMain.h"
+
+using namespace std;
+
+namespace
+{
+  // Keep clear of SDL joystick instance ids
+  SDL_JoystickID s_next_id = 0x10000;
+
+  bool test_bit(const unsigned long* bits, unsigned bit)
+  {
+    return (bits[bit / (8 * sizeof(unsigned long))] >> (bit % (8 * sizeof(unsigned long)))) & 1;
+  }
+
+  string ioctl_string(int fd, unsigned long request)
+  {
+    char buffer[256];
+    int len = ioctl(fd, request, buffer);
+    if (len <= 0)
+      return "";
+    buffer[min(len, 255)] = 0;
+    return buffer;
+  }
+
+  uint64_t event_time(const struct input_event& evt)
+  {
+    return static_cast<uint64_t>(evt.input_event_sec) * 1000000000ULL + evt.input_event_usec * 1000ULL;
+  }
+
+  bool map_button(uint16_t code, uint8_t& dst)
+  {
+    switch (code) {
+      case BTN_SOUTH:
+        dst = SDL_CONTROLLER_BUTTON_A;
+        break;
+      case BTN_EAST:
+        dst = SDL_CONTROLLER_BUTTON_B;
+        break;
+      case BTN_WEST:
+        dst = SDL_CONTROLLER_BUTTON_X;
+        break;
+      case BTN_NORTH:
+        dst = SDL_CONTROLLER_BUTTON_Y;
+        break;
+      case BTN_TL:
+        dst = SDL_CONTROLLER_BUTTON_LEFTSHOULDER;
+        break;
+      case BTN_TR:
+        dst = SDL_CONTROLLER_BUTTON_RIGHTSHOULDER;
+        break;
+      case BTN_SELECT:
+        dst = SDL_CONTROLLER_BUTTON_BACK;
+        break;
+      case BTN_START:
+        dst = SDL_CONTROLLER_BUTTON_START;
+        break;
+      case BTN_MODE:
+        dst = SDL_CONTROLLER_BUTTON_GUIDE;
+        break;
+      case BTN_THUMBL:
+        dst = SDL_CONTROLLER_BUTTON_LEFTSTICK;
+        break;
+      case BTN_THUMBR:
+        dst = SDL_CONTROLLER_BUTTON_RIGHTSTICK;
+        break;
+      case BTN_DPAD_UP:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_UP;
+        break;
+      case BTN_DPAD_DOWN:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_DOWN;
+        break;
+      case BTN_DPAD_LEFT:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_LEFT;
+        break;
+      case BTN_DPAD_RIGHT:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_RIGHT;
+        break;
+      default:
+        return false;
+    }
+
+    return true;
+  }
+
+  bool map_axis(uint16_t code, uint8_t& dst)
+  {
+    switch (code) {
+      case ABS_X:
+        dst = SDL_CONTROLLER_AXIS_LEFTX;
+        break;
+      case ABS_Y:
+        dst = SDL_CONTROLLER_AXIS_LEFTY;
+        break;
+      case ABS_RX:
+        dst = SDL_CONTROLLER_AXIS_RIGHTX;
+        break;
+      case ABS_RY:
+        dst = SDL_CONTROLLER_AXIS_RIGHTY;
+        break;
+      case ABS_Z:
+        dst = SDL_CONTROLLER_AXIS_TRIGGERLEFT;
+        break;
+      case ABS_RZ:
+        dst = SDL_CONTROLLER_AXIS_TRIGGERRIGHT;
+        break;
+      default:
+        return false;
+    }
+
+    return true;
+  }
+}
+
+namespace MSCtrl
+{
+  EvdevInput::EvdevInput(const string& path)
+    : m_path(path),
+      m_devices()
+  {
+  }
+
+  EvdevInput::~EvdevInput()
+  {
+    for (auto& dev : m_devices) {
+      close(dev->fd);
+      if (dev->motion_fd >= 0)
+        close(dev->motion_fd);
+    }
+  }
+
+  string EvdevInput::name() const
+  {
+    return fmt::format("evdev ({})", m_path);
+  }
+
+  void EvdevInput::start(SDLMain& main)
+  {
+    list<string> nodes;
+    if (DIR* dir = opendir("/dev/input")) {
+      while (struct dirent* entry = readdir(dir)) {
+        if (!strncmp(entry->d_name, "event", 5))
+          nodes.push_back(fmt::format("/dev/input/{}", entry->d_name));
+      }
+      closedir(dir);
+    }
+    nodes.sort();
+
+    if (m_path == "auto") {
+      for (const auto& node : nodes) {
+        int fd = ::open(node.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+          continue;
+
+        unsigned long keys[KEY_CNT / (8 * sizeof(unsigned long)) + 1] = {};
+        unsigned long props[INPUT_PROP_CNT / (8 * sizeof(unsigned long)) + 1] = {};
+        bool gamepad = (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) >= 0) && test_bit(keys, BTN_GAMEPAD) &&
+          (ioctl(fd, EVIOCGPROP(sizeof(props)), props) >= 0) && !test_bit(props, INPUT_PROP_ACCELEROMETER);
+        close(fd);
+
+        if (gamepad)
+          open_device(main, node, nodes);
+      }
+
+      if (m_devices.empty())
+        throw runtime_error("No gamepad found in /dev/input");
+    } else {
+      open_device(main, m_path, nodes);
+    }
+  }
+
+  vector<int> EvdevInput::fds() const
+  {
+    vector<int> result;
+    for (auto& dev : m_devices) {
+      result.push_back(dev->fd);
+      if (dev->motion_fd >= 0)
+        result.push_back(dev->motion_fd);
+    }
+    return result;
+  }
+
+  void EvdevInput::open_device(SDLMain& main, const string& path, const list<string>& candidates)
+  {
+    unique_ptr<Device> dev(new Device());
+    dev->motion_fd = -1;
+    dev->fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (dev->fd < 0)
+      throw runtime_error(fmt::format("Cannot open {}: {}", path, strerror(errno)));
+
+    // Kernel timestamps on the same clock as ours
+    int clock = CLOCK_MONOTONIC;
+    if (ioctl(dev->fd, EVIOCSCLOCKID, &clock) < 0)
+      spdlog::warn("Cannot use monotonic timestamps for {}: {}", path, strerror(errno));
+
+    dev->name = ioctl_string(dev->fd, EVIOCGNAME(256));
+    string uniq = ioctl_string(dev->fd, EVIOCGUNIQ(256));
+
+    // Same layout as SDL's Linux joystick GUIDs (without the name CRC)
+    string guid;
+    struct input_id input_id;
+    if (ioctl(dev->fd, EVIOCGID, &input_id) >= 0) {
+      uint16_t words[8] = { input_id.bustype, 0, input_id.vendor, 0, input_id.product, 0, input_id.version, 0 };
+      for (uint16_t word : words)
+        guid += fmt::format("{:02x}{:02x}", word & 0xFF, word >> 8);
+    }
+
+    for (unsigned code = ABS_X; code <= ABS_RZ; ++code) {
+      if (ioctl(dev->fd, EVIOCGABS(code), &dev->abs[code]) < 0 || (dev->abs[code].maximum <= dev->abs[code].minimum)) {
+        dev->abs[code].minimum = -32768;
+        dev->abs[code].maximum = 32767;
+      }
+    }
+
+    // The motion sensors are a separate node with the same unique id
+    // (MAC address), or named after the gamepad
+    for (const auto& node : candidates) {
+      if (node == path)
+        continue;
+
+      int fd = ::open(node.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (fd < 0)
+        continue;
+
+      unsigned long props[INPUT_PROP_CNT / (8 * sizeof(unsigned long)) + 1] = {};
+      if ((ioctl(fd, EVIOCGPROP(sizeof(props)), props) >= 0) && test_bit(props, INPUT_PROP_ACCELEROMETER)) {
+        string motion_uniq = ioctl_string(fd, EVIOCGUNIQ(256));
+        string motion_name = ioctl_string(fd, EVIOCGNAME(256));
+        if ((!uniq.empty() && (motion_uniq == uniq)) || (motion_name == dev->name + " Motion Sensors")) {
+          dev->motion_fd = fd;
+          break;
+        }
+      }
+
+      close(fd);
+    }
+
+    if (dev->motion_fd >= 0) {
+      int clock = CLOCK_MONOTONIC;
+      ioctl(dev->motion_fd, EVIOCSCLOCKID, &clock);
+
+      for (unsigned axis = 0; axis < 3; ++axis) {
+        struct input_absinfo info;
+        dev->gyro_resolution[axis] = ((ioctl(dev->motion_fd, EVIOCGABS(ABS_RX + axis), &info) >= 0) && (info.resolution > 0)) ? info.resolution : 1.0f;
+        dev->gyro[axis] = 0.0f;
+        dev->accel_resolution[axis] = ((ioctl(dev->motion_fd, EVIOCGABS(ABS_X + axis), &info) >= 0) && (info.resolution > 0)) ? info.resolution : 1.0f;
+        dev->accel[axis] = 0.0f;
+      }
+    } else {
+      spdlog::warn("No motion sensors found for {}", dev->name);
+    }
+
+    dev->hat_x = 0;
+    dev->hat_y = 0;
+    dev->sensor_clock = 0;
+    dev->has_sensor_clock = false;
+    dev->gyro_timestamp = 0;
+    dev->gyro_pending = false;
+    dev->accel_pending = false;
+    dev->id = s_next_id++;
+    dev->ctrl = main.open_controller(dev->id, dev->name, guid);
+
+    if (!dev->ctrl) {
+      close(dev->fd);
+      if (dev->motion_fd >= 0)
+        close(dev->motion_fd);
+      return;
+    }
+
+    spdlog::info("Opened {} ({}{})", dev->name, path, (dev->motion_fd >= 0) ? ", with motion sensors" : "");
+    m_devices.emplace_back(dev.release());
+  }
+
+  void EvdevInput::close_device(SDLMain& main, Device& dev)
+  {
+    spdlog::info("{} removed", dev.name);
+
+    close(dev.fd);
+    if (dev.motion_fd >= 0)
+      close(dev.motion_fd);
+    main.close_controller(dev.id);
+
+    m_devices.remove_if([&](const unique_ptr<Device>& other) { return other.get() == &dev; });
+  }
+
+  void EvdevInput::on_readable(SDLMain& main, int fd)
+  {
+    auto pos = find_if(m_devices.begin(), m_devices.end(), [&](const unique_ptr<Device>& dev) { return (dev->fd == fd) || (dev->motion_fd == fd); });
+    if (pos == m_devices.end())
+      return;
+
+    Device& dev = **pos;
+    struct input_event events[64];
+
+    while (true) {
+      ssize_t len = read(fd, events, sizeof(events));
+      if (len < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN)
+          return;
+        // ENODEV when unplugged
+        close_device(main, dev);
+        return;
+      }
+
+      for (unsigned i = 0; i < len / sizeof(struct input_event); ++i) {
+        if (fd == dev.fd)
+          handle_gamepad_event(main, dev, events[i]);
+        else
+          handle_motion_event(main, dev, events[i]);
+      }
+    }
+  }
+
+  void EvdevInput::handle_gamepad_event(SDLMain& main, Device& dev, const struct input_event& evt)
+  {
+    uint8_t code;
+
+    switch (evt.type) {
+      case EV_KEY:
+        // Ignore autorepeat
+        if ((evt.value != 2) && map_button(evt.code, code)) {
+          main.stamp_event(LatencyStats::EventType::Button, event_time(evt));
+          if (evt.value)
+            dev.ctrl->on_button_press(code);
+          else
+            dev.ctrl->on_button_release(code);
+        }
+        break;
+      case EV_ABS:
+        if (evt.code == ABS_HAT0X) {
+          main.stamp_event(LatencyStats::EventType::Button, event_time(evt));
+          set_hat(dev, dev.hat_x, evt.value, SDL_CONTROLLER_BUTTON_DPAD_LEFT, SDL_CONTROLLER_BUTTON_DPAD_RIGHT);
+        } else if (evt.code == ABS_HAT0Y) {
+          main.stamp_event(LatencyStats::EventType::Button, event_time(evt));
+          set_hat(dev, dev.hat_y, evt.value, SDL_CONTROLLER_BUTTON_DPAD_UP, SDL_CONTROLLER_BUTTON_DPAD_DOWN);
+        } else if (map_axis(evt.code, code)) {
+          const struct input_absinfo& info = dev.abs[evt.code];
+          long value;
+
+          // Scale to the SDL ranges: -32768..32767 for sticks, 0..32767 for triggers
+          if ((code == SDL_CONTROLLER_AXIS_TRIGGERLEFT) || (code == SDL_CONTROLLER_AXIS_TRIGGERRIGHT)) {
+            value = 32767L * (evt.value - info.minimum) / (info.maximum - info.minimum);
+          } else {
+            value = 65535L * (evt.value - info.minimum) / (info.maximum - info.minimum) - 32768;
+          }
+
+          main.stamp_event(LatencyStats::EventType::Axis, event_time(evt));
+          dev.ctrl->on_axis_motion(code, static_cast<int16_t>(max(-32768L, min(32767L, value))));
+        }
+        break;
+      case EV_SYN:
+        if (evt.code == SYN_DROPPED)
+          spdlog::warn("Events dropped by the kernel for {}", dev.name);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void EvdevInput::handle_motion_event(SDLMain& main, Device& dev, const struct input_event& evt)
+  {
+    switch (evt.type) {
+      case EV_ABS:
+        if ((evt.code >= ABS_RX) && (evt.code <= ABS_RZ)) {
+          unsigned axis = evt.code - ABS_RX;
+          dev.gyro[axis] = evt.value / dev.gyro_resolution[axis] * M_PI / 180;
+          dev.gyro_pending = true;
+        } else if (evt.code <= ABS_Z) {
+          unsigned axis = evt.code - ABS_X;
+          dev.accel[axis] = evt.value / dev.accel_resolution[axis] * 9.80665f;
+          dev.accel_pending = true;
+        }
+        break;
+      case EV_MSC:
+        if (evt.code == MSC_TIMESTAMP) {
+          // Sensor clock in us; it wraps every 71 minutes so accumulate deltas
+          dev.gyro_timestamp += static_cast<uint32_t>(evt.value - dev.sensor_clock);
+          dev.sensor_clock = evt.value;
+          dev.has_sensor_clock = true;
+        }
+        break;
+      case EV_SYN:
+        if ((evt.code == SYN_REPORT) && (dev.gyro_pending || dev.accel_pending)) {
+          // Fall back to the kernel timestamp if the driver does not report the sensor clock
+          if (!dev.has_sensor_clock)
+            dev.gyro_timestamp = event_time(evt) / 1000;
+
+          main.stamp_event(LatencyStats::EventType::Gyro, event_time(evt));
+          if (dev.accel_pending)
+            dev.ctrl->on_accel_update(dev.gyro_timestamp, dev.accel[0], dev.accel[1], dev.accel[2]);
+          if (dev.gyro_pending)
+            dev.ctrl->on_gyro_update(dev.gyro_timestamp, dev.gyro[0], dev.gyro[1], dev.gyro[2]);
+          dev.gyro_pending = false;
+          dev.accel_pending = false;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void EvdevInput::set_hat(Device& dev, int& current, int value, uint8_t negative, uint8_t positive)
+  {
+    if (value == current)
+      return;
+
+    if (current < 0)
+      dev.ctrl->on_button_release(negative);
+    else if (current > 0)
+      dev.ctrl->on_button_release(positive);
+
+    if (value < 0)
+      dev.ctrl->on_button_press(negative);
+    else if (value > 0)
+      dev.ctrl->on_button_press(positive);
+
+    current = value;
+  }
+}
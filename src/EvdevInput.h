@@ -0,0 +1,77 @@
+
+#ifndef _MSCTRL_EVDEVINPUT_H
+#define _MSCTRL_EVDEVINPUT_H
+
+#include <list>
+#include <memory>
+
+#include <linux/input.h>
+
+#include <src/InputSource.h>
+#include <src/Controller.h>
+
+namespace MSCtrl
+{
+  /**
+   * Reads gamepads directly from their /dev/input/event* nodes, along
+   * with the separate motion sensor node exposed by hid-playstation
+   * and hid-sony, bypassing SDL. Event timestamps come from the kernel
+   * (CLOCK_MONOTONIC) and are used for latency statistics.
+   */
+  class EvdevInput : public InputSource
+  {
+  public:
+    /**
+     * @param path Gamepad event node, or "auto" to use all gamepads
+     * found in /dev/input
+     */
+    EvdevInput(const std::string& path);
+    ~EvdevInput();
+
+    EvdevInput(const EvdevInput&) = delete;
+    EvdevInput& operator=(const EvdevInput&) = delete;
+
+    std::string name() const override;
+
+    void start(SDLMain&) override;
+    std::vector<int> fds() const override;
+    void on_readable(SDLMain&, int fd) override;
+
+  private:
+    struct Device {
+      SDL_JoystickID id;
+      std::string name;
+      int fd;
+      int motion_fd;
+      Controller* ctrl;
+
+      // Stick and trigger calibration, indexed by ABS_X..ABS_RZ
+      struct input_absinfo abs[ABS_RZ + 1];
+      int hat_x;
+      int hat_y;
+
+      // Gyro resolution (units per deg/s), accelerometer resolution
+      // (units per g), and samples being assembled
+      float gyro_resolution[3];
+      float gyro[3];
+      float accel_resolution[3];
+      float accel[3];
+      bool accel_pending;
+      uint32_t sensor_clock;
+      bool has_sensor_clock;
+      uint64_t gyro_timestamp;
+      bool gyro_pending;
+    };
+
+    std::string m_path;
+    std::list<std::unique_ptr<Device>> m_devices;
+
+    void open_device(SDLMain&, const std::string& path, const std::list<std::string>& candidates);
+    void close_device(SDLMain&, Device&);
+    void handle_gamepad_event(SDLMain&, Device&, const struct input_event&);
+    void handle_motion_event(SDLMain&, Device&, const struct input_event&);
+    void set_hat(Device&, int& current, int value, uint8_t negative, uint8_t positive);
+  };
+}
+
+#endif /* _MSCTRL_EVDEVINPUT_H */
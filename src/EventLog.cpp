@@ -0,0 +1,148 @@
+
+#include <stdexcept>
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "EventLog.h"
+
+using namespace std;
+
+namespace
+{
+  const char Magic[4] = { 'M', 'S', 'E', 'V' };
+
+  template <typename T> void put(ofstream& ofs, T value)
+  {
+    ofs.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  template <typename T> bool get(ifstream& ifs, T& value)
+  {
+    return bool(ifs.read(reinterpret_cast<char*>(&value), sizeof(value)));
+  }
+}
+
+namespace MSCtrl
+{
+  EventLogWriter::EventLogWriter(const string& filename)
+    : m_stream(filename, ios::binary | ios::trunc),
+      m_filename(filename),
+      m_start(0)
+  {
+    if (!m_stream)
+      throw runtime_error(fmt::format("Cannot open \"{}\" for writing", filename));
+
+    m_stream.write(Magic, sizeof(Magic));
+    put(m_stream, EventLog::Version);
+  }
+
+  void EventLogWriter::write(EventLog::Record& record, uint64_t now)
+  {
+    if (m_start == 0)
+      m_start = now;
+
+    record.time = now - m_start;
+
+    uint16_t size = 0;
+    switch (record.type) {
+      case EventLog::RecordType::DeviceAdded:
+        size = record.name.size();
+        break;
+      case EventLog::RecordType::AxisMotion:
+        size = sizeof(record.value);
+        break;
+      case EventLog::RecordType::SensorUpdate:
+        size = sizeof(record.sensor_timestamp) + sizeof(record.data);
+        break;
+      default:
+        break;
+    }
+
+    put(m_stream, record.time);
+    put(m_stream, record.which);
+    put(m_stream, static_cast<uint8_t>(record.type));
+    put(m_stream, record.code);
+    put(m_stream, size);
+
+    switch (record.type) {
+      case EventLog::RecordType::DeviceAdded:
+        m_stream.write(record.name.data(), size);
+        // Devices are rare; make sure they are on disk
+        m_stream.flush();
+        break;
+      case EventLog::RecordType::AxisMotion:
+        put(m_stream, record.value);
+        break;
+      case EventLog::RecordType::SensorUpdate:
+        put(m_stream, record.sensor_timestamp);
+        for (auto value : record.data)
+          put(m_stream, value);
+        break;
+      default:
+        break;
+    }
+
+    if (!m_stream)
+      throw runtime_error(fmt::format("Error writing to \"{}\"", m_filename));
+  }
+
+  EventLogReader::EventLogReader(const string& filename)
+    : m_stream(filename, ios::binary),
+      m_filename(filename)
+  {
+    if (!m_stream)
+      throw runtime_error(fmt::format("Cannot open \"{}\"", filename));
+
+    char magic[sizeof(Magic)];
+    uint16_t version;
+    if (!m_stream.read(magic, sizeof(magic)) || memcmp(magic, Magic, sizeof(Magic)) || !get(m_stream, version))
+      throw runtime_error(fmt::format("\"{}\" is not an event recording", filename));
+    if (version != EventLog::Version)
+      throw runtime_error(fmt::format("Unsupported event recording version {} in \"{}\"", version, filename));
+  }
+
+  bool EventLogReader::read(EventLog::Record& record)
+  {
+    uint8_t type;
+    uint16_t size;
+
+    if (!get(m_stream, record.time))
+      return false;
+
+    if (!get(m_stream, record.which) || !get(m_stream, type) || !get(m_stream, record.code) || !get(m_stream, size))
+      throw runtime_error(fmt::format("Truncated record in \"{}\"", m_filename));
+
+    record.type = static_cast<EventLog::RecordType>(type);
+
+    bool ok = true;
+    switch (record.type) {
+      case EventLog::RecordType::DeviceAdded:
+        record.name.resize(size);
+        ok = bool(m_stream.read(&record.name[0], size));
+        break;
+      case EventLog::RecordType::AxisMotion:
+        ok = (size == sizeof(record.value)) && get(m_stream, record.value);
+        break;
+      case EventLog::RecordType::SensorUpdate:
+        ok = (size == sizeof(record.sensor_timestamp) + sizeof(record.data)) && get(m_stream, record.sensor_timestamp);
+        for (auto& value : record.data)
+          ok = ok && get(m_stream, value);
+        break;
+      case EventLog::RecordType::DeviceRemoved:
+      case EventLog::RecordType::ButtonDown:
+      case EventLog::RecordType::ButtonUp:
+        ok = (size == 0);
+        break;
+      default:
+        // Unknown record type from a newer version; skip it
+        ok = bool(m_stream.ignore(size));
+        break;
+    }
+
+    if (!ok)
+      throw runtime_error(fmt::format("Invalid record in \"{}\"", m_filename));
+
+    return true;
+  }
+}
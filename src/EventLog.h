@@ -0,0 +1,87 @@
+
+#ifndef _MSCTRL_EVENTLOG_H
+#define _MSCTRL_EVENTLOG_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+namespace MSCtrl
+{
+  /**
+   * Binary controller event stream, used to record and replay
+   * sessions. The file starts with the "MSEV" magic and a 16 bits
+   * version, followed by records made of a 16 bytes header
+   *   u64 time (ns since the first record)
+   *   i32 joystick instance id
+   *   u8  type
+   *   u8  code (button, axis or sensor type)
+   *   u16 payload size
+   * and a payload depending on the type:
+   *   DeviceAdded: controller name
+   *   AxisMotion: i16 value
+   *   SensorUpdate: u64 sensor timestamp (us), 3 x f32 data
+   * Values are in host byte order (little-endian on the Raspberry Pi
+   * and x86), so a recording only replays on a machine of the same
+   * endianness.
+   */
+  class EventLog
+  {
+  public:
+    enum class RecordType : uint8_t {
+      DeviceAdded = 1,
+      DeviceRemoved,
+      ButtonDown,
+      ButtonUp,
+      AxisMotion,
+      SensorUpdate
+    };
+
+    struct Record {
+      uint64_t time;
+      int32_t which;
+      RecordType type;
+      uint8_t code;
+      int16_t value;
+      uint64_t sensor_timestamp;
+      float data[3];
+      std::string name;
+    };
+
+    static const uint16_t Version = 1;
+  };
+
+  class EventLogWriter
+  {
+  public:
+    EventLogWriter(const std::string& filename);
+
+    /**
+     * Append a record; its time is set from the given monotonic time,
+     * relative to the first record written (which is at 0).
+     */
+    void write(EventLog::Record&, uint64_t now);
+
+  private:
+    std::ofstream m_stream;
+    std::string m_filename;
+    uint64_t m_start;
+  };
+
+  class EventLogReader
+  {
+  public:
+    EventLogReader(const std::string& filename);
+
+    /**
+     * Read the next record; returns false at end of file
+     */
+    bool read(EventLog::Record&);
+
+  private:
+    std::ifstream m_stream;
+    std::string m_filename;
+  };
+}
+
+#endif /* _MSCTRL_EVENTLOG_H */
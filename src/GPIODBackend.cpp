@@ -0,0 +1,191 @@
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "GPIODBackend.h"
+
+using namespace std;
+
+namespace MSCtrl
+{
+  GPIODBackend::GPIODBackend(const string& path)
+    : m_path(path),
+      m_chip(gpiod_chip_open(path.c_str())),
+#ifdef GPIOD_API_V2
+      m_request(nullptr),
+#else
+      m_bulk(),
+      m_requested(false),
+#endif
+      m_values(),
+      m_offsets(),
+      m_count(0),
+      m_levels(0),
+#ifdef GPIOD_API_V2
+      m_input_request(nullptr),
+#else
+      m_input_bulk(),
+      m_inputs_requested(false),
+#endif
+      m_input_values(),
+      m_input_offsets(),
+      m_input_count(0)
+  {
+    if (!m_chip)
+      throw runtime_error(fmt::format("Cannot open GPIO chip {}: {}", path, strerror(errno)));
+
+    spdlog::info("GPIO chip {} opened", path);
+  }
+
+  GPIODBackend::~GPIODBackend()
+  {
+#ifdef GPIOD_API_V2
+    if (m_input_request)
+      gpiod_line_request_release(m_input_request);
+    if (m_request)
+      gpiod_line_request_release(m_request);
+#else
+    if (m_inputs_requested)
+      gpiod_line_release_bulk(&m_input_bulk);
+    if (m_requested)
+      gpiod_line_release_bulk(&m_bulk);
+#endif
+    gpiod_chip_close(m_chip);
+  }
+
+  void GPIODBackend::open(uint32_t pins)
+  {
+    if (m_count != 0)
+      throw runtime_error("GPIO lines already requested");
+
+    for (unsigned port = 0; port < 32; ++port) {
+      if (pins & (1U << port))
+        m_offsets[m_count++] = port;
+    }
+
+#ifdef GPIOD_API_V2
+    gpiod_line_settings* settings = gpiod_line_settings_new();
+    gpiod_line_config* line_config = gpiod_line_config_new();
+    gpiod_request_config* request_config = gpiod_request_config_new();
+
+    if (settings && line_config && request_config) {
+      gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_OUTPUT);
+      gpiod_line_settings_set_output_value(settings, GPIOD_LINE_VALUE_INACTIVE);
+      gpiod_request_config_set_consumer(request_config, "msctrl");
+
+      if (gpiod_line_config_add_line_settings(line_config, m_offsets.data(), m_count, settings) == 0)
+        m_request = gpiod_chip_request_lines(m_chip, request_config, line_config);
+    }
+    int error = errno;
+
+    gpiod_request_config_free(request_config);
+    gpiod_line_config_free(line_config);
+    gpiod_line_settings_free(settings);
+
+    if (!m_request)
+      throw runtime_error(fmt::format("Cannot request GPIO lines on {}: {}", m_path, strerror(error)));
+
+    m_values.fill(GPIOD_LINE_VALUE_INACTIVE);
+#else
+    if (gpiod_chip_get_lines(m_chip, m_offsets.data(), m_count, &m_bulk) < 0)
+      throw runtime_error(fmt::format("Cannot get GPIO lines on {}: {}", m_path, strerror(errno)));
+
+    m_values.fill(0);
+    if (gpiod_line_request_bulk_output(&m_bulk, "msctrl", m_values.data()) < 0)
+      throw runtime_error(fmt::format("Cannot request GPIO lines on {}: {}", m_path, strerror(errno)));
+
+    m_requested = true;
+#endif
+
+    spdlog::info("Requested {} GPIO lines on {}", m_count, m_path);
+  }
+
+  void GPIODBackend::write(uint32_t set, uint32_t clear)
+  {
+    m_levels = (m_levels | set) & ~clear;
+
+    for (unsigned i = 0; i < m_count; ++i) {
+#ifdef GPIOD_API_V2
+      m_values[i] = (m_levels & (1U << m_offsets[i])) ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE;
+#else
+      m_values[i] = (m_levels & (1U << m_offsets[i])) ? 1 : 0;
+#endif
+    }
+
+#ifdef GPIOD_API_V2
+    if (gpiod_line_request_set_values(m_request, m_values.data()) < 0)
+#else
+    if (gpiod_line_set_value_bulk(&m_bulk, m_values.data()) < 0)
+#endif
+      throw runtime_error(fmt::format("Cannot set GPIO values on {}: {}", m_path, strerror(errno)));
+  }
+
+  void GPIODBackend::open_inputs(uint32_t pins)
+  {
+    if (m_input_count != 0)
+      throw runtime_error("GPIO input lines already requested");
+
+    for (unsigned port = 0; port < 32; ++port) {
+      if (pins & (1U << port))
+        m_input_offsets[m_input_count++] = port;
+    }
+
+#ifdef GPIOD_API_V2
+    gpiod_line_settings* settings = gpiod_line_settings_new();
+    gpiod_line_config* line_config = gpiod_line_config_new();
+    gpiod_request_config* request_config = gpiod_request_config_new();
+
+    if (settings && line_config && request_config) {
+      gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_INPUT);
+      gpiod_request_config_set_consumer(request_config, "msctrl");
+
+      if (gpiod_line_config_add_line_settings(line_config, m_input_offsets.data(), m_input_count, settings) == 0)
+        m_input_request = gpiod_chip_request_lines(m_chip, request_config, line_config);
+    }
+    int error = errno;
+
+    gpiod_request_config_free(request_config);
+    gpiod_line_config_free(line_config);
+    gpiod_line_settings_free(settings);
+
+    if (!m_input_request)
+      throw runtime_error(fmt::format("Cannot request GPIO input lines on {}: {}", m_path, strerror(error)));
+#else
+    if (gpiod_chip_get_lines(m_chip, m_input_offsets.data(), m_input_count, &m_input_bulk) < 0)
+      throw runtime_error(fmt::format("Cannot get GPIO lines on {}: {}", m_path, strerror(errno)));
+
+    if (gpiod_line_request_bulk_input(&m_input_bulk, "msctrl") < 0)
+      throw runtime_error(fmt::format("Cannot request GPIO input lines on {}: {}", m_path, strerror(errno)));
+
+    m_inputs_requested = true;
+#endif
+
+    spdlog::info("Requested {} GPIO input lines on {}", m_input_count, m_path);
+  }
+
+  uint32_t GPIODBackend::read()
+  {
+#ifdef GPIOD_API_V2
+    if (gpiod_line_request_get_values(m_input_request, m_input_values.data()) < 0)
+#else
+    if (gpiod_line_get_value_bulk(&m_input_bulk, m_input_values.data()) < 0)
+#endif
+      throw runtime_error(fmt::format("Cannot read GPIO values on {}: {}", m_path, strerror(errno)));
+
+    uint32_t levels = 0;
+    for (unsigned i = 0; i < m_input_count; ++i) {
+#ifdef GPIOD_API_V2
+      if (m_input_values[i] == GPIOD_LINE_VALUE_ACTIVE)
+#else
+      if (m_input_values[i])
+#endif
+        levels |= 1U << m_input_offsets[i];
+    }
+
+    return levels;
+  }
+}
@@ -0,0 +1,67 @@
+
+#ifndef _MSCTRL_GPIODBACKEND_H
+#define _MSCTRL_GPIODBACKEND_H
+
+#include <array>
+
+#include <gpiod.h>
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  /**
+   * Drives GPIOs through the kernel GPIO character device using
+   * libgpiod (v1 or v2 API). All lines are requested at once and
+   * updated with a single ioctl per write. GPIO numbers are line
+   * offsets on the chip. Works as a regular user on Raspberry Pi OS,
+   * and with the gpio-sim/gpio-mockup modules on any Linux box.
+   */
+  class GPIODBackend : public OutputBackend
+  {
+  public:
+    GPIODBackend(const std::string& chip = "/dev/gpiochip0");
+    ~GPIODBackend();
+
+    GPIODBackend(const GPIODBackend&) = delete;
+    GPIODBackend& operator=(const GPIODBackend&) = delete;
+
+    std::string name() const override {
+      return "gpiod";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+    void open_inputs(uint32_t) override;
+    uint32_t read() override;
+
+  private:
+    std::string m_path;
+    gpiod_chip* m_chip;
+#ifdef GPIOD_API_V2
+    gpiod_line_request* m_request;
+    std::array<gpiod_line_value, 32> m_values;
+#else
+    gpiod_line_bulk m_bulk;
+    bool m_requested;
+    std::array<int, 32> m_values;
+#endif
+    std::array<unsigned, 32> m_offsets;
+    unsigned m_count;
+    uint32_t m_levels;
+
+    // Input lines, requested separately
+#ifdef GPIOD_API_V2
+    gpiod_line_request* m_input_request;
+    std::array<gpiod_line_value, 32> m_input_values;
+#else
+    gpiod_line_bulk m_input_bulk;
+    bool m_inputs_requested;
+    std::array<int, 32> m_input_values;
+#endif
+    std::array<unsigned, 32> m_input_offsets;
+    unsigned m_input_count;
+  };
+}
+
+#endif /* _MSCTRL_GPIODBACKEND_H */
@@ -0,0 +1,91 @@
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "GPIOMemBackend.h"
+
+using namespace std;
+
+namespace
+{
+  // Register offsets, in 32 bits words
+  const unsigned GPFSEL0 = 0;
+  const unsigned GPSET0 = 7;
+  const unsigned GPCLR0 = 10;
+  const unsigned GPLEV0 = 13;
+
+  const size_t MAP_SIZE = 4096;
+}
+
+namespace MSCtrl
+{
+  GPIOMemBackend::GPIOMemBackend(const string& device)
+    : m_regs(nullptr)
+  {
+    int fd = ::open(device.c_str(), O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd < 0)
+      throw runtime_error(fmt::format("Cannot open {}: {}", device, strerror(errno)));
+
+    void* addr = mmap(nullptr, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+
+    if (addr == MAP_FAILED)
+      throw runtime_error(fmt::format("Cannot map {}: {}", device, strerror(error)));
+
+    m_regs = static_cast<volatile uint32_t*>(addr);
+
+    spdlog::info("GPIO registers mapped from {}", device);
+  }
+
+  GPIOMemBackend::~GPIOMemBackend()
+  {
+    munmap(const_cast<uint32_t*>(m_regs), MAP_SIZE);
+  }
+
+  void GPIOMemBackend::open(uint32_t pins)
+  {
+    for (unsigned port = 0; port < 32; ++port) {
+      if ((pins & (1U << port)) == 0)
+        continue;
+
+      // 3 bits per GPIO, 10 GPIOs per function select register; 001 is output
+      volatile uint32_t& fsel = m_regs[GPFSEL0 + port / 10];
+      unsigned shift = (port % 10) * 3;
+      fsel = (fsel & ~(7U << shift)) | (1U << shift);
+    }
+  }
+
+  void GPIOMemBackend::write(uint32_t set, uint32_t clear)
+  {
+    if (set != 0)
+      m_regs[GPSET0] = set;
+    if (clear != 0)
+      m_regs[GPCLR0] = clear;
+  }
+
+  void GPIOMemBackend::open_inputs(uint32_t pins)
+  {
+    for (unsigned port = 0; port < 32; ++port) {
+      if ((pins & (1U << port)) == 0)
+        continue;
+
+      // 000 is input
+      volatile uint32_t& fsel = m_regs[GPFSEL0 + port / 10];
+      fsel = fsel & ~(7U << ((port % 10) * 3));
+    }
+  }
+
+  uint32_t GPIOMemBackend::read()
+  {
+    return m_regs[GPLEV0];
+  }
+}
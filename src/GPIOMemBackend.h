@@ -0,0 +1,37 @@
+
+#ifndef _MSCTRL_GPIOMEMBACKEND_H
+#define _MSCTRL_GPIOMEMBACKEND_H
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  /**
+   * Drives the BCM283x/BCM2711 GPIO registers directly through
+   * /dev/gpiomem. This does not need root (only membership of the gpio
+   * group) and starts no background thread.
+   */
+  class GPIOMemBackend : public OutputBackend
+  {
+  public:
+    GPIOMemBackend(const std::string& device = "/dev/gpiomem");
+    ~GPIOMemBackend();
+
+    GPIOMemBackend(const GPIOMemBackend&) = delete;
+    GPIOMemBackend& operator=(const GPIOMemBackend&) = delete;
+
+    std::string name() const override {
+      return "gpiomem";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+    void open_inputs(uint32_t) override;
+    uint32_t read() override;
+
+  private:
+    volatile uint32_t* m_regs;
+  };
+}
+
+#endif /* _MSCTRL_GPIOMEMBACKEND_H */
@@ -18,15 +18,17 @@ namespace MSCtrl
       m_button_state(false),
       m_threshold(20.0f * M_PI / 180),
       m_angle_delta(3.0f * M_PI / 180),
-      m_IMU(GyroMap::axis_name(axis)),
-      m_trigger_buttons(),
-      m_pressed_buttons()
+      m_horizon(0.0f),
+      m_lazy_sensor(false),
+      m_reference(0.0f),
+      m_trigger_buttons(0),
+      m_pressed_buttons(0)
   {
   }
 
   void GyroMap::add_trigger_button(Controller::Button btn)
   {
-    m_trigger_buttons.insert(btn);
+    m_trigger_buttons |= Controller::button_bit(btn);
   }
 
   void GyroMap::set_angle_threshold(float threshold)
@@ -42,37 +44,51 @@ namespace MSCtrl
     m_angle_delta = delta * M_PI / 180;
   }
 
+  void GyroMap::set_prediction_horizon(float horizon)
+  {
+    if (horizon < 0)
+      throw runtime_error(fmt::format("Prediction horizon {} is negative", horizon));
+
+    m_horizon = horizon / 1000;
+  }
+
   void GyroMap::add_to(Controller& ctrl)
   {
-    spdlog::info("Add gyro mapping to {}; axis={}, threshold={:.2f}, hysteresis={:.2f}", ctrl.name(), GyroMap::axis_name(m_axis), m_threshold, m_angle_delta);
+    spdlog::info("Add gyro mapping to {}; axis={}, threshold={:.2f}, hysteresis={:.2f}, horizon={:.0f}ms", ctrl.name(), GyroMap::axis_name(m_axis), m_threshold, m_angle_delta, m_horizon * 1000);
 
     Controller::Listener::add_to(ctrl);
+
+    // Lazy mappings request the gyro when their trigger is engaged
+    if (m_lazy_sensor) {
+      if (m_trigger_buttons != 0)
+        return;
+      spdlog::warn("Gyro mapping {} has no trigger buttons, the gyro will always be on", axis_name(m_axis));
+    }
+
+    ctrl.request_gyro();
   }
 
   void GyroMap::on_button_state(Controller& ctrl, Controller::Button btn, bool state)
   {
-    if (m_trigger_buttons.size() == 0)
+    uint16_t bit = Controller::button_bit(btn);
+    if ((m_trigger_buttons & bit) == 0)
       return;
 
-    unsigned prev_count = m_pressed_buttons.size();
-
-    if (m_trigger_buttons.find(btn) != m_trigger_buttons.end()) {
-      if (state) {
-        m_pressed_buttons.insert(btn);
-      } else {
-        auto pos = m_pressed_buttons.find(btn);
-        if (pos != m_pressed_buttons.end())
-          m_pressed_buttons.erase(pos);
-      }
-    }
+    uint16_t prev_pressed = m_pressed_buttons;
+    m_pressed_buttons = state ? (m_pressed_buttons | bit) : (m_pressed_buttons & ~bit);
 
-    unsigned curr_count = m_pressed_buttons.size();
+    if (prev_pressed == m_pressed_buttons)
+      return;
 
-    if ((prev_count != curr_count) && (curr_count == m_trigger_buttons.size())) {
+    if (m_pressed_buttons == m_trigger_buttons) {
       spdlog::info("Enable gyro on {} ({})", ctrl.name(), axis_name(m_axis));
-      m_IMU.reset();
-    } else if ((prev_count != curr_count) && (prev_count == m_trigger_buttons.size())) {
+      if (m_lazy_sensor)
+        ctrl.request_gyro();
+      m_reference = ctrl.imu().angle(imu_axis(m_axis));
+    } else if (prev_pressed == m_trigger_buttons) {
       spdlog::info("Disable gyro on {} ({})", ctrl.name(), axis_name(m_axis));
+      if (m_lazy_sensor)
+        ctrl.release_gyro();
       if (m_button_state) {
         spdlog::info("Gyro release of {} on {} ({}) (disabled)", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis));
         m_ms.set_button_state(m_button, false);
@@ -81,63 +97,52 @@ namespace MSCtrl
     }
   }
 
-  void GyroMap::on_gyro_update(Controller& ctrl, uint32_t timestamp, float dx, float dy, float dz)
+  void GyroMap::on_gyro_update(Controller& ctrl, uint64_t timestamp, float dx, float dy, float dz)
   {
-    // Always update IMU
-    switch (m_axis) {
-      case Axis::PosX:
-      case Axis::NegX:
-        if (!m_IMU.update(ctrl, timestamp, dx))
-          return;
-        break;
-      case Axis::PosY:
-      case Axis::NegY:
-        if (!m_IMU.update(ctrl, timestamp, dy))
-          return;
-        break;
-      case Axis::PosZ:
-      case Axis::NegZ:
-        if (!m_IMU.update(ctrl, timestamp, dz))
-          return;
-        break;
-    }
-
-    if ((m_trigger_buttons.size() != 0) && (m_trigger_buttons.size() != m_pressed_buttons.size()))
+    if (m_pressed_buttons != m_trigger_buttons)
       return;
 
+    float angle = ctrl.imu().angle(imu_axis(m_axis)) - m_reference;
+
+    if (m_horizon > 0.0f) {
+      float rates[3] = { dx, dy, dz };
+      IMUIntegrator::Axis axis = imu_axis(m_axis);
+      angle += (rates[axis] - ctrl.imu().bias(axis)) * m_horizon;
+    }
+
     switch (m_axis) {
       case Axis::PosX:
       case Axis::NegX:
-        if (m_button_state && (((m_axis == Axis::PosX) && (m_IMU.value() <= m_threshold - m_angle_delta)) || ((m_axis == Axis::NegX) && (m_IMU.value() >= -m_threshold + m_angle_delta)))) {
-          spdlog::debug("Gyro release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), m_IMU.value());
+        if (m_button_state && (((m_axis == Axis::PosX) && (angle <= m_threshold - m_angle_delta)) || ((m_axis == Axis::NegX) && (angle >= -m_threshold + m_angle_delta)))) {
+          spdlog::debug("Gyro release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), angle);
           m_ms.set_button_state(m_button, false);
           m_button_state = false;
-        } else if (!m_button_state && (((m_axis == Axis::PosX) && (m_IMU.value() >= m_threshold)) || ((m_axis == Axis::NegX) && (m_IMU.value() <= -m_threshold)))) {
-          spdlog::debug("Gyro press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), m_IMU.value());
+        } else if (!m_button_state && (((m_axis == Axis::PosX) && (angle >= m_threshold)) || ((m_axis == Axis::NegX) && (angle <= -m_threshold)))) {
+          spdlog::debug("Gyro press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), angle);
           m_ms.set_button_state(m_button, true);
           m_button_state = true;
         }
         break;
       case Axis::PosY:
       case Axis::NegY:
-        if (m_button_state && (((m_axis == Axis::PosY) && (m_IMU.value() <= m_threshold - m_angle_delta)) || ((m_axis == Axis::NegY) && (m_IMU.value() >= -m_threshold + m_angle_delta)))) {
-          spdlog::debug("Gyro release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), m_IMU.value());
+        if (m_button_state && (((m_axis == Axis::PosY) && (angle <= m_threshold - m_angle_delta)) || ((m_axis == Axis::NegY) && (angle >= -m_threshold + m_angle_delta)))) {
+          spdlog::debug("Gyro release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), angle);
           m_ms.set_button_state(m_button, false);
           m_button_state = false;
-        } else if (!m_button_state && (((m_axis == Axis::PosY) && (m_IMU.value() >= m_threshold)) || ((m_axis == Axis::NegY) && (m_IMU.value() <= -m_threshold)))) {
-          spdlog::debug("Gyro press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), m_IMU.value());
+        } else if (!m_button_state && (((m_axis == Axis::PosY) && (angle >= m_threshold)) || ((m_axis == Axis::NegY) && (angle <= -m_threshold)))) {
+          spdlog::debug("Gyro press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), angle);
           m_ms.set_button_state(m_button, true);
           m_button_state = true;
         }
         break;
       case Axis::PosZ:
       case Axis::NegZ:
-        if (m_button_state && (((m_axis == Axis::PosZ) && (m_IMU.value() <= m_threshold - m_angle_delta)) || ((m_axis == Axis::NegZ) && (m_IMU.value() >= -m_threshold + m_angle_delta)))) {
-          spdlog::debug("Gyro release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), m_IMU.value());
+        if (m_button_state && (((m_axis == Axis::PosZ) && (angle <= m_threshold - m_angle_delta)) || ((m_axis == Axis::NegZ) && (angle >= -m_threshold + m_angle_delta)))) {
+          spdlog::debug("Gyro release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), angle);
           m_ms.set_button_state(m_button, false);
           m_button_state = false;
-        } else if (!m_button_state && (((m_axis == Axis::PosZ) && (m_IMU.value() >= m_threshold)) || ((m_axis == Axis::NegZ) && (m_IMU.value() <= -m_threshold)))) {
-          spdlog::debug("Gyro press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), m_IMU.value());
+        } else if (!m_button_state && (((m_axis == Axis::PosZ) && (angle >= m_threshold)) || ((m_axis == Axis::NegZ) && (angle <= -m_threshold)))) {
+          spdlog::debug("Gyro press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), axis_name(m_axis), angle);
           m_ms.set_button_state(m_button, true);
           m_button_state = true;
         }
@@ -145,6 +150,23 @@ namespace MSCtrl
     }
   }
 
+  IMUIntegrator::Axis GyroMap::imu_axis(GyroMap::Axis axis)
+  {
+    switch (axis) {
+      case Axis::PosX:
+      case Axis::NegX:
+        return IMUIntegrator::X;
+      case Axis::PosY:
+      case Axis::NegY:
+        return IMUIntegrator::Y;
+      case Axis::PosZ:
+      case Axis::NegZ:
+        break;
+    }
+
+    return IMUIntegrator::Z;
+  }
+
   string GyroMap::axis_name(GyroMap::Axis axis)
   {
     switch (axis) {
@@ -2,8 +2,6 @@
 #ifndef _MSCTRL_GYROMAP_H
 #define _MSCTRL_GYROMAP_H
 
-#include <set>
-
 #include <src/Configure.h>
 #include <src/MasterSystem.h>
 #include <src/Controller.h>
@@ -40,25 +38,49 @@ namespace MSCtrl
      */
     void set_angle_delta(float delta);
 
+    /**
+     * Predict threshold crossings: the angle is extrapolated with the
+     * current angular velocity over this horizon, in ms (0 disables)
+     */
+    void set_prediction_horizon(float horizon);
+
+    /**
+     * Only turn the controller's gyro on while the trigger buttons are
+     * held, instead of all the time
+     */
+    void set_lazy_sensor(bool lazy) {
+      m_lazy_sensor = lazy;
+    }
+
+    unsigned subscriptions() const override {
+      return (m_trigger_buttons != 0) ? (ButtonEvents | GyroEvents) : GyroEvents;
+    }
+
     void add_to(Controller&) override;
     void on_button_state(Controller&, Controller::Button, bool) override;
-    void on_gyro_update(Controller&, uint32_t, float, float, float) override;
+    void on_gyro_update(Controller&, uint64_t, float, float, float) override;
 
     static std::string axis_name(Axis);
     static Axis axis_from_name(const std::string&);
 
   private:
+    static IMUIntegrator::Axis imu_axis(Axis);
+
     MasterSystem& m_ms;
     Axis m_axis;
     MasterSystem::Button m_button;
     bool m_button_state;
     float m_threshold;
     float m_angle_delta;
+    float m_horizon;
+    bool m_lazy_sensor;
 
-    IMUIntegrator m_IMU;
+    // Controller angle when the trigger was engaged
+    float m_reference;
 
-    std::set<Controller::Button> m_trigger_buttons;
-    std::set<Controller::Button> m_pressed_buttons;
+    // Bit masks of Controller::Button
+    uint16_t m_trigger_buttons;
+    uint16_t m_pressed_buttons;
   };
 }
 
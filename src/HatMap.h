@@ -12,6 +12,10 @@ namespace MSCtrl
   public:
     HatMap(MasterSystem&);
 
+    unsigned subscriptions() const override {
+      return ButtonEvents;
+    }
+
     void add_to(Controller&) override;
     void on_button_state(Controller&, Controller::Button, bool) override;
 
@@ -0,0 +1,266 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/hidraw.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "HidrawInput.h"
+#include "SDLMain.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // Keep clear of SDL joystick instance ids, and of evdev's and UDP's
+  SDL_JoystickID s_next_id = 0x30000;
+
+  const uint16_t SonyVendor = 0x054C;
+  const uint16_t DS4Dongle = 0x0BA0;
+
+  // Calibration feature reports: 0x02 for a DualShock 4 on USB
+  // (including the dongle), 0x05 otherwise, where Bluetooth adds a CRC
+  const uint8_t DS4USBCalibration = 0x02;
+  const uint8_t Calibration = 0x05;
+  const size_t DS4USBCalibrationSize = 37;
+  const size_t CalibrationSize = 41;
+
+  const size_t MaxReportSize = 128;
+}
+
+namespace MSCtrl
+{
+  HidrawInput::HidrawInput(const string& path)
+    : m_path(path),
+      m_devices()
+  {
+  }
+
+  HidrawInput::~HidrawInput()
+  {
+    for (auto& dev : m_devices) {
+      if (dev->invalid != 0)
+        spdlog::info("{}: {} reports ignored", dev->name, dev->invalid);
+      close(dev->fd);
+    }
+  }
+
+  string HidrawInput::name() const
+  {
+    return fmt::format("hidraw ({})", m_path);
+  }
+
+  bool HidrawInput::identify(uint16_t vendor, uint16_t product, SonyReport::Model& model)
+  {
+    if (vendor != SonyVendor)
+      return false;
+
+    switch (product) {
+      case 0x05C4:
+      case 0x09CC:
+      case DS4Dongle:
+        model = SonyReport::Model::DualShock4;
+        return true;
+      case 0x0CE6:
+      case 0x0DF2: // Edge
+        model = SonyReport::Model::DualSense;
+        return true;
+    }
+
+    return false;
+  }
+
+  void HidrawInput::start(SDLMain& main)
+  {
+    if (m_path != "auto") {
+      open_device(main, m_path);
+      return;
+    }
+
+    list<string> nodes;
+    if (DIR* dir = opendir("/dev")) {
+      while (struct dirent* entry = readdir(dir)) {
+        if (!strncmp(entry->d_name, "hidraw", 6))
+          nodes.push_back(fmt::format("/dev/{}", entry->d_name));
+      }
+      closedir(dir);
+    }
+    nodes.sort();
+
+    for (const auto& node : nodes) {
+      int fd = ::open(node.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        continue;
+
+      struct hidraw_devinfo info;
+      SonyReport::Model model;
+      bool supported = (ioctl(fd, HIDIOCGRAWINFO, &info) >= 0) && identify(info.vendor, info.product, model);
+      close(fd);
+
+      if (supported)
+        open_device(main, node);
+    }
+
+    if (m_devices.empty())
+      throw runtime_error("No DualShock 4 or DualSense found in /dev/hidraw*");
+  }
+
+  vector<int> HidrawInput::fds() const
+  {
+    vector<int> result;
+    for (auto& dev : m_devices)
+      result.push_back(dev->fd);
+    return result;
+  }
+
+  void HidrawInput::open_device(SDLMain& main, const string& path)
+  {
+    unique_ptr<Device> dev(new Device());
+
+    // Read-write for the feature reports
+    dev->fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (dev->fd < 0)
+      throw runtime_error(fmt::format("Cannot open {}: {}", path, strerror(errno)));
+
+    struct hidraw_devinfo info;
+    if ((ioctl(dev->fd, HIDIOCGRAWINFO, &info) < 0) || !identify(info.vendor, info.product, dev->model)) {
+      close(dev->fd);
+      throw runtime_error(fmt::format("{} is not a DualShock 4 or DualSense", path));
+    }
+
+    char name[256];
+    int len = ioctl(dev->fd, HIDIOCGRAWNAME(sizeof(name)), name);
+    dev->name = (len > 0) ? string(name, strnlen(name, min<size_t>(len, sizeof(name)))) : path;
+
+    // Same layout as SDL's Linux joystick GUIDs (without the name CRC)
+    string guid;
+    uint16_t words[8] = { static_cast<uint16_t>(info.bustype), 0, static_cast<uint16_t>(info.vendor), 0,
+                          static_cast<uint16_t>(info.product), 0, 0, 0 };
+    for (uint16_t word : words)
+      guid += fmt::format("{:02x}{:02x}", word & 0xFF, word >> 8);
+
+    // The dongle orders the calibration like Bluetooth pads. Reading
+    // the calibration also switches a DualShock 4 on Bluetooth to full
+    // reports.
+    bool interleaved = (dev->model == SonyReport::Model::DualShock4) &&
+      ((info.bustype != BUS_USB) || (static_cast<uint16_t>(info.product) == DS4Dongle));
+    dev->calibration = SonyReport::default_calibration();
+    read_calibration(*dev, interleaved, info.bustype == BUS_USB);
+
+    dev->has_state = false;
+    dev->sensor_ticks = 0;
+    dev->invalid = 0;
+    dev->id = s_next_id++;
+    dev->ctrl = main.open_controller(dev->id, dev->name, guid);
+
+    if (!dev->ctrl) {
+      close(dev->fd);
+      return;
+    }
+
+    spdlog::info("Opened {} ({}, {})", dev->name, path, (info.bustype == BUS_USB) ? "USB" : "Bluetooth");
+    m_devices.emplace_back(dev.release());
+  }
+
+  void HidrawInput::read_calibration(Device& dev, bool interleaved, bool usb)
+  {
+    bool ds4_usb = usb && (dev.model == SonyReport::Model::DualShock4);
+    uint8_t report[CalibrationSize] = {};
+    report[0] = ds4_usb ? DS4USBCalibration : Calibration;
+
+    int len = ioctl(dev.fd, HIDIOCGFEATURE(ds4_usb ? DS4USBCalibrationSize : CalibrationSize), report);
+    if ((len < 0) || !SonyReport::parse_calibration(interleaved, report, len, dev.calibration))
+      spdlog::warn("No valid sensor calibration for {}, using nominal values", dev.name);
+  }
+
+  void HidrawInput::close_device(SDLMain& main, Device& dev)
+  {
+    spdlog::info("{} removed", dev.name);
+
+    close(dev.fd);
+    main.close_controller(dev.id);
+
+    m_devices.remove_if([&](const unique_ptr<Device>& other) { return other.get() == &dev; });
+  }
+
+  void HidrawInput::on_readable(SDLMain& main, int fd)
+  {
+    auto pos = find_if(m_devices.begin(), m_devices.end(), [&](const unique_ptr<Device>& dev) { return dev->fd == fd; });
+    if (pos == m_devices.end())
+      return;
+
+    Device& dev = **pos;
+    uint8_t data[MaxReportSize];
+
+    // One report per read
+    while (true) {
+      ssize_t len = read(fd, data, sizeof(data));
+      if (len < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN)
+          return;
+        // ENODEV when unplugged
+        close_device(main, dev);
+        return;
+      }
+
+      SonyReport report;
+      if (report.decode(dev.model, dev.calibration, data, len)) {
+        apply(main, dev, report, monotonic_ns());
+        main.commit_snapshot();
+      } else {
+        ++dev.invalid;
+      }
+    }
+  }
+
+  void HidrawInput::apply(SDLMain& main, Device& dev, const SonyReport& report, uint64_t now)
+  {
+    if (!dev.has_state) {
+      // Everything released and centered, as SDL starts
+      memset(&dev.state, 0, sizeof(dev.state));
+      dev.state.timestamp = report.timestamp;
+      dev.has_state = true;
+    }
+
+    uint32_t changed = dev.state.buttons ^ report.buttons;
+    for (unsigned btn = 0; changed && (btn < SDL_CONTROLLER_BUTTON_MAX); ++btn) {
+      if (changed & (1U << btn)) {
+        main.stamp_event(LatencyStats::EventType::Button, now);
+        if (report.buttons & (1U << btn))
+          dev.ctrl->on_button_press(btn);
+        else
+          dev.ctrl->on_button_release(btn);
+      }
+    }
+
+    for (unsigned axis = 0; axis < SonyReport::AxisCount; ++axis) {
+      if (report.axes[axis] != dev.state.axes[axis]) {
+        main.stamp_event(LatencyStats::EventType::Axis, now);
+        dev.ctrl->on_axis_motion(axis, report.axes[axis]);
+      }
+    }
+
+    // Ticks are accumulated rather than microseconds, so that rounding
+    // does not drift
+    dev.sensor_ticks += SonyReport::elapsed_ticks(dev.model, dev.state.timestamp, report.timestamp);
+    uint64_t timestamp = SonyReport::ticks_to_us(dev.model, dev.sensor_ticks);
+
+    main.stamp_event(LatencyStats::EventType::Gyro, now);
+    dev.ctrl->on_accel_update(timestamp, report.accel[0], report.accel[1], report.accel[2]);
+    dev.ctrl->on_gyro_update(timestamp, report.gyro[0], report.gyro[1], report.gyro[2]);
+
+    dev.state = report;
+  }
+}
@@ -0,0 +1,70 @@
+
+#ifndef _MSCTRL_HIDRAWINPUT_H
+#define _MSCTRL_HIDRAWINPUT_H
+
+#include <list>
+#include <memory>
+
+#include <src/InputSource.h>
+#include <src/Controller.h>
+#include <src/SonyReport.h>
+
+namespace MSCtrl
+{
+  /**
+   * Reads DualShock 4 and DualSense pads from their /dev/hidraw*
+   * node and decodes the input reports itself, bypassing both the
+   * kernel's evdev translation and SDL. Each report holds the whole
+   * state of the pad, which is compared with the previous one so that
+   * the controller only sees what changed; gyro samples are stamped
+   * with the pad's own sensor clock.
+   */
+  class HidrawInput : public InputSource
+  {
+  public:
+    /**
+     * @param path hidraw node, or "auto" to use all supported pads
+     */
+    HidrawInput(const std::string& path);
+    ~HidrawInput();
+
+    HidrawInput(const HidrawInput&) = delete;
+    HidrawInput& operator=(const HidrawInput&) = delete;
+
+    std::string name() const override;
+
+    void start(SDLMain&) override;
+    std::vector<int> fds() const override;
+    void on_readable(SDLMain&, int fd) override;
+
+    /**
+     * @return false if the USB ids are not those of a supported pad
+     */
+    static bool identify(uint16_t vendor, uint16_t product, SonyReport::Model&);
+
+  private:
+    struct Device {
+      SDL_JoystickID id;
+      std::string name;
+      int fd;
+      SonyReport::Model model;
+      SonyReport::Calibration calibration;
+      Controller* ctrl;
+
+      SonyReport state;
+      bool has_state;
+      uint64_t sensor_ticks;
+      uint64_t invalid;
+    };
+
+    std::string m_path;
+    std::list<std::unique_ptr<Device>> m_devices;
+
+    void open_device(SDLMain&, const std::string& path);
+    void close_device(SDLMain&, Device&);
+    void read_calibration(Device&, bool interleaved, bool usb);
+    void apply(SDLMain&, Device&, const SonyReport&, uint64_t now);
+  };
+}
+
+#endif /* _MSCTRL_HIDRAWINPUT_H */
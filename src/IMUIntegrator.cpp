@@ -1,4 +1,7 @@
 
+#include <algorithm>
+#include <cmath>
+
 #include <spdlog/spdlog.h>
 
 #include "IMUIntegrator.h"
@@ -6,67 +9,167 @@
 
 using namespace std;
 
+namespace
+{
+  // Samples per stillness window
+  const unsigned WindowSamples = 80;
+
+  // Maximum spread of the raw rates (rad/s) within a window for the
+  // controller to be considered still
+  const float StillnessSpread = 0.05f;
+
+  // Once this pad has measured its bias, a still window whose mean is
+  // further away than this (rad/s) is a slow steady rotation, not drift
+  const float MaxBiasStep = 0.02f;
+
+  // ...unless that many consecutive windows agree with each other: the
+  // measured bias was wrong (a first window that was a steady rotation)
+  const unsigned ReseedWindows = 5;
+
+  // Weight of a new still window in the bias estimate
+  const float BiasSmoothing = 0.25f;
+
+  // Bias change (rad/s) worth reporting to calibration listeners
+  const float ReportedBiasChange = 0.002f;
+}
+
 namespace MSCtrl
 {
-  IMUIntegrator::IMUIntegrator(const string& name)
-    : m_name(name),
-      m_last_timestamp(0),
-      m_value(0.0f),
-      m_last_value(0.0f),
+  IMUIntegrator::IMUIntegrator()
+    : m_angles(),
+      m_last_rates(),
 #ifdef ENABLE_GYRO_CALIBRATION
-      m_calib_value(0.0f),
+      m_bias(),
+      m_reported_bias(),
+      m_sum(),
+      m_min(),
+      m_max(),
+      m_outlier_mean(),
       m_count(0),
-      m_state(State::Calibrating)
-#else
-      m_state(State::Starting)
+      m_outliers(0),
+      m_has_bias(false),
+      m_measured(false),
 #endif
+      m_last_timestamp(0),
+      m_resync(true),
+      m_calibrated(false)
   {
   }
 
-  bool IMUIntegrator::update(Controller& ctrl, uint32_t timestamp, float value)
+  void IMUIntegrator::set_bias(float x, float y, float z)
   {
-    switch (m_state) {
 #ifdef ENABLE_GYRO_CALIBRATION
-      case State::Calibrating:
-        if (m_count == 0)
-          spdlog::info("Starting calibration on {} ({})", ctrl.name(), m_name);
-
-        m_calib_value += value;
-        if (++m_count == 80) {
-          m_calib_value /= m_count;
-
-          spdlog::info("{} ({}) calibrated: {:.3f}", ctrl.name(), m_name, m_calib_value);
-
-          m_last_timestamp = timestamp;
-          m_last_value = value;
-
-          m_state = State::Running;
-        }
-        break;
-#else
-      case State::Starting:
-        m_last_timestamp = timestamp;
-        m_last_value = value;
-        m_state = State::Running;
-        break;
+    m_bias[X] = m_reported_bias[X] = x;
+    m_bias[Y] = m_reported_bias[Y] = y;
+    m_bias[Z] = m_reported_bias[Z] = z;
+    m_has_bias = true;
+
+    // Only a starting point: it may come from another pad of the same
+    // model, so the first still window replaces it
+    m_measured = false;
 #endif
-      case State::Running:
-      {
+  }
+
 #ifdef ENABLE_GYRO_CALIBRATION
-        value -= m_calib_value;
+  void IMUIntegrator::track_bias(Controller& ctrl, const float* rates)
+  {
+    if (m_count == 0) {
+      for (unsigned i = 0; i < 4; ++i) {
+        m_sum[i] = 0.0f;
+        m_min[i] = m_max[i] = rates[i];
+      }
+    }
+
+    for (unsigned i = 0; i < 4; ++i) {
+      m_sum[i] += rates[i];
+      m_min[i] = min(m_min[i], rates[i]);
+      m_max[i] = max(m_max[i], rates[i]);
+    }
+
+    if (++m_count < WindowSamples)
+      return;
+
+    m_count = 0;
+
+    bool outlier = false;
+    for (unsigned i = 0; i < 3; ++i) {
+      if (m_max[i] - m_min[i] > StillnessSpread)
+        return;
+      if (m_measured && (fabsf(m_sum[i] / WindowSamples - m_bias[i]) > MaxBiasStep))
+        outlier = true;
+    }
+
+    bool reseed = !m_measured;
+    if (outlier) {
+      bool agrees = (m_outliers != 0);
+      for (unsigned i = 0; i < 3; ++i)
+        agrees = agrees && (fabsf(m_sum[i] / WindowSamples - m_outlier_mean[i]) <= MaxBiasStep);
+
+      m_outliers = agrees ? m_outliers + 1 : 1;
+      for (unsigned i = 0; i < 4; ++i)
+        m_outlier_mean[i] = m_sum[i] / WindowSamples;
+
+      if (m_outliers < ReseedWindows)
+        return;
+
+      spdlog::info("{} gyro bias was wrong, measuring it again", ctrl.name());
+      reseed = true;
+    }
+    m_outliers = 0;
+
+    float weight = reseed ? 1.0f : BiasSmoothing;
+    bool changed = !m_has_bias;
+
+    for (unsigned i = 0; i < 4; ++i) {
+      m_bias[i] += (m_sum[i] / WindowSamples - m_bias[i]) * weight;
+      changed = changed || (fabsf(m_bias[i] - m_reported_bias[i]) > ReportedBiasChange);
+    }
+
+    if (reseed)
+      spdlog::info("{} calibrated: X={:.3f}, Y={:.3f}, Z={:.3f}", ctrl.name(), m_bias[X], m_bias[Y], m_bias[Z]);
+    else if (changed)
+      spdlog::debug("{} gyro bias now X={:.3f}, Y={:.3f}, Z={:.3f}", ctrl.name(), m_bias[X], m_bias[Y], m_bias[Z]);
+
+    if (changed) {
+      for (unsigned i = 0; i < 4; ++i)
+        m_reported_bias[i] = m_bias[i];
+      m_calibrated = true;
+    }
+
+    m_has_bias = true;
+    m_measured = true;
+  }
 #endif
 
-        uint32_t dt = timestamp - m_last_timestamp;
+  bool IMUIntegrator::update(Controller& ctrl, uint64_t timestamp, float dx, float dy, float dz)
+  {
+    alignas(16) float rates[4] = { dx, dy, dz, 0.0f };
 
-        m_value += (m_last_value + value) / 2 * dt / 1000;
+#ifdef ENABLE_GYRO_CALIBRATION
+    track_bias(ctrl, rates);
 
-        m_last_value = value;
-        m_last_timestamp = timestamp;
+    for (unsigned i = 0; i < 4; ++i)
+      rates[i] -= m_bias[i];
+#endif
 
-        return true;
-      }
+    if (m_resync) {
+      for (unsigned i = 0; i < 4; ++i)
+        m_last_rates[i] = rates[i];
+      m_last_timestamp = timestamp;
+      m_resync = false;
+      return false;
     }
 
-    return false;
+    float dt = (timestamp - m_last_timestamp) * 0.5e-6f;
+
+    // Trapezoidal rule on all axes at once
+    for (unsigned i = 0; i < 4; ++i) {
+      m_angles[i] += (m_last_rates[i] + rates[i]) * dt;
+      m_last_rates[i] = rates[i];
+    }
+
+    m_last_timestamp = timestamp;
+
+    return true;
   }
 }
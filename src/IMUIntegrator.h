@@ -2,7 +2,7 @@
 #ifndef _MSCTRL_IMUINTEGRATOR_H
 #define _MSCTRL_IMUINTEGRATOR_H
 
-#include <string>
+#include <cstdint>
 
 #include <src/Configure.h>
 
@@ -10,39 +10,91 @@ namespace MSCtrl
 {
   class Controller;
 
+  /**
+   * Integrates the three gyro axes of a controller into angles (in
+   * radians). There is one per controller, shared by all gyro
+   * mappings; the angles are never reset, mappings keep their own
+   * reference instead.
+   *
+   * With ENABLE_GYRO_CALIBRATION, the gyro bias is estimated all the
+   * time from windows of samples during which the controller is still,
+   * so that drift (e.g. as the controller warms up) is compensated.
+   */
   class IMUIntegrator
   {
   public:
-    IMUIntegrator(const std::string&);
+    enum Axis {
+      X = 0,
+      Y = 1,
+      Z = 2
+    };
+
+    IMUIntegrator();
 
-    bool update(Controller&, uint32_t, float);
+    /**
+     * Returns false if the sample was only used to start timing
+     * @param timestamp Sample time in us
+     */
+    bool update(Controller&, uint64_t timestamp, float, float, float);
 
-    float value() const {
-      return m_value;
+    /**
+     * The sensor stopped; the next sample only restarts timing
+     */
+    void suspend() {
+      m_resync = true;
     }
 
-    void reset() {
-      m_value = 0.0f;
+    float angle(Axis axis) const {
+      return m_angles[axis];
     }
 
-  private:
-    std::string m_name;
-    uint32_t m_last_timestamp;
-    float m_value;
-    float m_last_value;
+    /**
+     * Start from a previously measured bias instead of none; it is
+     * replaced by the first still window of this pad
+     */
+    void set_bias(float, float, float);
+
+    float bias(Axis axis) const {
 #ifdef ENABLE_GYRO_CALIBRATION
-    float m_calib_value;
-    unsigned m_count;
+      return m_bias[axis];
+#else
+      return 0.0f;
 #endif
-    enum class State {
+    }
+
+    /**
+     * Returns true once after the bias has changed noticeably
+     */
+    bool take_calibration() {
+      bool calibrated = m_calibrated;
+      m_calibrated = false;
+      return calibrated;
+    }
+
+  private:
+    // Padded to 4 lanes so that the per-sample update is a single vector operation
+    alignas(16) float m_angles[4];
+    alignas(16) float m_last_rates[4];
 #ifdef ENABLE_GYRO_CALIBRATION
-      Calibrating,
-#else
-      Starting,
+    alignas(16) float m_bias[4];
+    alignas(16) float m_reported_bias[4];
+
+    // Current stillness window
+    alignas(16) float m_sum[4];
+    alignas(16) float m_min[4];
+    alignas(16) float m_max[4];
+    // Mean of the last still windows rejected as too far from the bias
+    alignas(16) float m_outlier_mean[4];
+    unsigned m_count;
+    unsigned m_outliers;
+    bool m_has_bias;
+    bool m_measured; // By this pad, rather than set_bias()
+
+    void track_bias(Controller&, const float*);
 #endif
-      Running
-    };
-    State m_state;
+    uint64_t m_last_timestamp;
+    bool m_resync;
+    bool m_calibrated;
   };
 }
 
@@ -0,0 +1,41 @@
+
+#ifndef _MSCTRL_INPUTSOURCE_H
+#define _MSCTRL_INPUTSOURCE_H
+
+#include <string>
+#include <vector>
+
+namespace MSCtrl
+{
+  class SDLMain;
+
+  /**
+   * Input frontend reading controllers from file descriptors instead
+   * of SDL events. When sources are configured, SDLMain waits on their
+   * descriptors with epoll instead of waiting for SDL events.
+   */
+  class InputSource
+  {
+  public:
+    virtual ~InputSource() {}
+
+    virtual std::string name() const = 0;
+
+    /**
+     * Open devices, and their controllers through SDLMain::open_controller
+     */
+    virtual void start(SDLMain&) = 0;
+
+    /**
+     * Descriptors to wait on; only called after start()
+     */
+    virtual std::vector<int> fds() const = 0;
+
+    /**
+     * Read and dispatch all pending events of a descriptor
+     */
+    virtual void on_readable(SDLMain&, int fd) = 0;
+  };
+}
+
+#endif /* _MSCTRL_INPUTSOURCE_H */
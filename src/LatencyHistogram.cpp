@@ -0,0 +1,148 @@
+
+#include <spdlog/spdlog.h>
+
+#include "LatencyHistogram.h"
+
+using namespace std;
+
+namespace MSCtrl
+{
+  LatencyHistogram::LatencyHistogram()
+    : m_buckets(),
+      m_count(0),
+      m_max(0)
+  {
+  }
+
+  void LatencyHistogram::record(uint64_t ns)
+  {
+    ++m_buckets[bucket_index(ns)];
+    ++m_count;
+    if (ns > m_max)
+      m_max = ns;
+  }
+
+  void LatencyHistogram::reset()
+  {
+    m_buckets.fill(0);
+    m_count = 0;
+    m_max = 0;
+  }
+
+  uint64_t LatencyHistogram::percentile(double p) const
+  {
+    if (m_count == 0)
+      return 0;
+
+    uint64_t rank = static_cast<uint64_t>(p / 100 * m_count + 0.5);
+    if (rank == 0)
+      rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned index = 0; index < BucketCount; ++index) {
+      seen += m_buckets[index];
+      if (seen >= rank)
+        return min(bucket_upper_bound(index), m_max);
+    }
+
+    return m_max;
+  }
+
+  unsigned LatencyHistogram::bucket_index(uint64_t ns)
+  {
+    if (ns < 16)
+      return ns;
+
+    unsigned exponent = 63 - __builtin_clzll(ns);
+    unsigned index = 16 + (exponent - 4) * 8 + ((ns >> (exponent - 3)) & 7);
+
+    return (index < BucketCount) ? index : BucketCount - 1;
+  }
+
+  uint64_t LatencyHistogram::bucket_upper_bound(unsigned index)
+  {
+    if (index < 16)
+      return index;
+
+    unsigned exponent = (index - 16) / 8 + 4;
+    uint64_t mantissa = 8 + (index - 16) % 8;
+
+    return ((mantissa + 1) << (exponent - 3)) - 1;
+  }
+
+  LatencyStats::LatencyStats()
+    : m_histograms(),
+      m_pending(),
+      m_current(EventType::Button),
+      m_current_time(0)
+  {
+  }
+
+  void LatencyStats::begin(EventType type, uint64_t now)
+  {
+    m_current = type;
+    m_current_time = now;
+  }
+
+  void LatencyStats::changed()
+  {
+    if (m_current_time == 0)
+      return;
+
+    uint64_t& pending = m_pending[static_cast<unsigned>(m_current)];
+    if (pending == 0)
+      pending = m_current_time;
+  }
+
+  void LatencyStats::record(uint64_t now)
+  {
+    for (unsigned type = 0; type < EventTypeCount; ++type) {
+      if (m_pending[type] != 0) {
+        m_histograms[type].record(now - m_pending[type]);
+        m_pending[type] = 0;
+      }
+    }
+  }
+
+  void LatencyStats::end(uint64_t now)
+  {
+    record(now);
+    m_current_time = 0;
+  }
+
+  void LatencyStats::discard()
+  {
+    m_pending.fill(0);
+    m_current_time = 0;
+  }
+
+  void LatencyStats::dump() const
+  {
+    for (unsigned type = 0; type < EventTypeCount; ++type) {
+      const LatencyHistogram& histogram = m_histograms[type];
+      if (histogram.count() == 0)
+        continue;
+
+      spdlog::info("{} to GPIO latency: n={}, p50={:.1f}us, p99={:.1f}us, max={:.1f}us",
+                   event_type_name(static_cast<EventType>(type)),
+                   histogram.count(),
+                   histogram.percentile(50) / 1000.0,
+                   histogram.percentile(99) / 1000.0,
+                   histogram.max() / 1000.0);
+    }
+  }
+
+  string LatencyStats::event_type_name(EventType type)
+  {
+    switch (type) {
+      case EventType::Button:
+        return "Button";
+      case EventType::Axis:
+        return "Axis";
+      case EventType::Gyro:
+        return "Gyro";
+    }
+
+    return "Unknown";
+  }
+}
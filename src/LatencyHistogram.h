@@ -0,0 +1,105 @@
+
+#ifndef _MSCTRL_LATENCYHISTOGRAM_H
+#define _MSCTRL_LATENCYHISTOGRAM_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace MSCtrl
+{
+  /**
+   * Fixed-bucket latency histogram; recording never allocates. Buckets
+   * are exact up to 16 ns, then 8 buckets per power of two (12.5%
+   * resolution) up to about 68 s.
+   */
+  class LatencyHistogram
+  {
+  public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+    void reset();
+
+    uint64_t count() const {
+      return m_count;
+    }
+
+    uint64_t max() const {
+      return m_max;
+    }
+
+    /**
+     * Upper bound of the bucket holding the given percentile
+     * @param p Percentile, between 0 and 100
+     */
+    uint64_t percentile(double p) const;
+
+  private:
+    static constexpr unsigned BucketCount = 16 + 32 * 8;
+
+    std::array<uint64_t, BucketCount> m_buckets;
+    uint64_t m_count;
+    uint64_t m_max;
+
+    static unsigned bucket_index(uint64_t);
+    static uint64_t bucket_upper_bound(unsigned);
+  };
+
+  /**
+   * Input to output latency, per input event type. An event is
+   * stamped when it is dequeued, and becomes pending only if its
+   * handling changes an output state; at the next commit that
+   * actually changes an output, the time elapsed since the oldest
+   * pending event of each type is recorded.
+   */
+  class LatencyStats
+  {
+  public:
+    enum class EventType {
+      Button,
+      Axis,
+      Gyro
+    };
+
+    static constexpr unsigned EventTypeCount = static_cast<unsigned>(EventType::Gyro) + 1;
+
+    LatencyStats();
+
+    void begin(EventType, uint64_t now);
+
+    /**
+     * The event being handled changed an output state
+     */
+    void changed();
+
+    /**
+     * Record the pending events, in the middle of handling an event
+     * that may still change an output
+     */
+    void record(uint64_t now);
+
+    void end(uint64_t now);
+
+    /**
+     * Forget pending events (the commit did not change any output)
+     */
+    void discard();
+
+    void dump() const;
+
+    const LatencyHistogram& histogram(EventType type) const {
+      return m_histograms[static_cast<unsigned>(type)];
+    }
+
+    static std::string event_type_name(EventType);
+
+  private:
+    std::array<LatencyHistogram, EventTypeCount> m_histograms;
+    std::array<uint64_t, EventTypeCount> m_pending;
+    EventType m_current;
+    uint64_t m_current_time;
+  };
+}
+
+#endif /* _MSCTRL_LATENCYHISTOGRAM_H */
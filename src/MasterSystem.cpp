@@ -1,30 +1,27 @@
 
-#include <iostream>
+#include <stdexcept>
 
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
-#ifdef ENABLE_GPIO
-#include <pigpio.h>
-#endif
 
 #include "MasterSystem.h"
+#include "utils.h"
 
 using namespace std;
 
 namespace MSCtrl
 {
   MasterSystem::MasterSystem()
-#ifdef ENABLE_GPIO
-    : m_map()
-#endif
+    : m_backend(),
+      m_latency(nullptr),
+      m_state(0),
+      m_committed(0),
+      m_claimed(0),
+      m_pin_masks(),
+      m_th_mask(1U << 23),
+      m_th_input(false),
+      m_write_lock()
   {
-#ifdef ENABLE_GPIO
-    gpioCfgSetInternals(gpioCfgGetInternals() | PI_CFG_NOSIGHANDLER);
-    if (gpioInitialise() < 0)
-      throw runtime_error("Cannot initialize GPIO");
-
-    spdlog::info("GPIO initialized");
-
     // Defaults (my own setup)
     set_gpio_map(Button::B1, 27U);
     set_gpio_map(Button::B2, 22U);
@@ -32,58 +29,155 @@ namespace MSCtrl
     set_gpio_map(Button::Down, 3U);
     set_gpio_map(Button::Left, 4U);
     set_gpio_map(Button::Right, 17U);
-#else
-    spdlog::info("GPIO disabled");
-#endif
   }
 
   MasterSystem::~MasterSystem()
   {
-#ifdef ENABLE_GPIO
-    gpioTerminate();
-#endif
   }
 
-#ifdef ENABLE_GPIO
   void MasterSystem::set_gpio_map(Button btn, unsigned port)
   {
-    m_map.insert(make_pair(btn, port));
-
-    int status;
-    if ((status = gpioSetMode(port, PI_OUTPUT)) != 0) {
-      switch (status) {
-        case PI_BAD_GPIO:
-          throw runtime_error(fmt::format("Bad GPIO port {}", port));
-        case PI_BAD_MODE:
-          throw runtime_error(fmt::format("Bad mode for GPIO {}", port));
-        default:
-          throw runtime_error(fmt::format("Unknown error initializing GPIO {}: {}", port, status));
+    if (m_backend)
+      throw runtime_error("GPIO mapping must be set before the output backend");
+    if (port > 31)
+      throw runtime_error(fmt::format("GPIO {} is not in bank 0", port));
+
+    m_pin_masks[static_cast<unsigned>(btn)] = 1U << port;
+  }
+
+  void MasterSystem::set_th_gpio(unsigned port)
+  {
+    if (m_backend)
+      throw runtime_error("GPIO mapping must be set before the output backend");
+    if (port > 31)
+      throw runtime_error(fmt::format("GPIO {} is not in bank 0", port));
+
+    m_th_mask = 1U << port;
+  }
+
+  void MasterSystem::enable_th_input()
+  {
+    if (m_th_input)
+      return;
+
+    m_th_input = true;
+    if (m_backend)
+      m_backend->open_inputs(m_th_mask);
+  }
+
+  uint32_t MasterSystem::output_pins() const
+  {
+    uint32_t pins = 0;
+    for (auto mask : m_pin_masks)
+      pins |= mask;
+    return pins;
+  }
+
+  void MasterSystem::set_backend(OutputBackend* backend)
+  {
+    m_backend.reset(backend);
+
+    m_backend->open(output_pins());
+    if (m_th_input)
+      m_backend->open_inputs(m_th_mask);
+
+    spdlog::info("Using {} output backend", m_backend->name());
+  }
+
+  void MasterSystem::set_button_state(Button btn, bool state)
+  {
+    uint8_t bit = button_bit(btn) & ~m_claimed;
+    if (m_backend && ((m_state ^ m_committed) & bit) && (((m_state & bit) != 0) != state)) {
+      // A press and release within the same batch
+      write_changes();
+      if (m_latency)
+        m_latency->record(monotonic_ns());
+    }
+
+    uint8_t previous = m_state;
+    if (state)
+      m_state |= button_bit(btn);
+    else
+      m_state &= ~button_bit(btn);
+
+    if (m_latency && (m_state != previous))
+      m_latency->changed();
+  }
+
+  void MasterSystem::claim_buttons(uint8_t mask)
+  {
+    if (m_claimed & mask)
+      throw runtime_error("Buttons are already driven by another peripheral");
+
+    m_claimed |= mask;
+  }
+
+  void MasterSystem::drive_buttons(uint8_t pressed, uint8_t mask)
+  {
+    uint32_t set_mask = 0, clear_mask = 0;
+    for (unsigned btn = 0; btn < ButtonCount; ++btn) {
+      if (mask & (1U << btn)) {
+        if (pressed & (1U << btn))
+          set_mask |= m_pin_masks[btn];
+        else
+          clear_mask |= m_pin_masks[btn];
       }
     }
+
+    lock_guard<mutex> lock(m_write_lock);
+    m_backend->write(set_mask, clear_mask);
   }
-#endif
 
-  void MasterSystem::set_button_state(Button btn, bool state)
+  void MasterSystem::commit()
   {
-#ifdef ENABLE_GPIO
-    unsigned port = m_map[btn];
-
-    spdlog::debug("Set GPIO {} to {}", port, state ? "HI" : "LO");
-
-    int status;
-    if ((status = gpioWrite(port, state ? 1 : 0)) != 0) {
-      switch (status) {
-        case PI_BAD_GPIO:
-          throw runtime_error(fmt::format("Bad GPIO port {}", port));
-        case PI_BAD_LEVEL:
-          throw runtime_error(fmt::format("Bad level for GPIO {}", port));
-        default:
-          throw runtime_error(fmt::format("Unknown error setting state {} for GPIO {}: {}", state, port, status));
+    if (!write_changes()) {
+      if (m_latency)
+        m_latency->discard();
+      return;
+    }
+
+    if (m_latency)
+      m_latency->end(monotonic_ns());
+  }
+
+  bool MasterSystem::write_changes()
+  {
+    uint8_t diff = (m_state ^ m_committed) & ~m_claimed;
+    if (diff == 0)
+      return false;
+
+    uint32_t set_mask = 0, clear_mask = 0;
+    for (unsigned btn = 0; btn < ButtonCount; ++btn) {
+      if (diff & (1U << btn)) {
+        spdlog::debug("{} button {}", (m_state & (1U << btn)) ? "Press" : "Release", MasterSystem::button_name(static_cast<Button>(btn)));
+        if (m_state & (1U << btn))
+          set_mask |= m_pin_masks[btn];
+        else
+          clear_mask |= m_pin_masks[btn];
       }
     }
-#else
-    spdlog::info("{} button {}", state ? "Press" : "Release", MasterSystem::button_name(btn));
-#endif
+
+    {
+      lock_guard<mutex> lock(m_write_lock);
+      m_backend->write(set_mask, clear_mask);
+    }
+
+    m_committed = m_state;
+    return true;
+  }
+
+  uint8_t MasterSystem::nibble_buttons(uint8_t nibble)
+  {
+    uint8_t pressed = 0;
+    if (!(nibble & 0x01))
+      pressed |= button_bit(Button::Up);
+    if (!(nibble & 0x02))
+      pressed |= button_bit(Button::Down);
+    if (!(nibble & 0x04))
+      pressed |= button_bit(Button::Left);
+    if (!(nibble & 0x08))
+      pressed |= button_bit(Button::Right);
+    return pressed;
   }
 
   string MasterSystem::button_name(MasterSystem::Button btn)
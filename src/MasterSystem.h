@@ -2,9 +2,15 @@
 #ifndef _MSCTRL_MASTERSYSTEM_H
 #define _MSCTRL_MASTERSYSTEM_H
 
-#include <map>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <mutex>
 #include <string>
 
+#include <src/OutputBackend.h>
+#include <src/LatencyHistogram.h>
+
 namespace MSCtrl
 {
   class MasterSystem
@@ -19,20 +25,120 @@ namespace MSCtrl
       Right
     };
 
+    static constexpr unsigned ButtonCount = static_cast<unsigned>(Button::Right) + 1;
+
     MasterSystem();
     ~MasterSystem();
 
+    /**
+     * Set the state of a button in the shadow register. Nothing is
+     * written to the console until commit() is called, unless this
+     * undoes a change that has not been written yet: that one is
+     * written first so that the console sees both.
+     */
     void set_button_state(Button, bool);
 
+    /**
+     * Write all buttons whose state changed since the last commit at
+     * once. Does nothing if no level changed.
+     */
+    void commit();
+
+    /**
+     * Hand buttons over to a peripheral emulation driving them from
+     * its own thread with drive_buttons(); commit() leaves them alone
+     * from then on.
+     * @param mask Button bits
+     */
+    void claim_buttons(uint8_t mask);
+
+    /**
+     * Immediately write the state of claimed buttons. May be called
+     * from another thread than commit().
+     * @param pressed Button bits to press
+     * @param mask Button bits to write
+     */
+    void drive_buttons(uint8_t pressed, uint8_t mask);
+
+    /**
+     * Read the TH line (pin 7), driven by the console; see
+     * enable_th_input()
+     */
+    bool read_th() {
+      return (m_backend->read() & m_th_mask) != 0;
+    }
+
+    /**
+     * Configure the TH GPIO as an input, now or when the backend is
+     * set. Needed by peripherals that answer the console.
+     */
+    void enable_th_input();
+
+    static uint8_t button_bit(Button btn) {
+      return 1U << static_cast<unsigned>(btn);
+    }
+
+    /**
+     * Up, Down, Left and Right, which are D0 to D3 on the port
+     */
+    static constexpr uint8_t DataButtons = (1U << static_cast<unsigned>(Button::Up)) |
+      (1U << static_cast<unsigned>(Button::Down)) |
+      (1U << static_cast<unsigned>(Button::Left)) |
+      (1U << static_cast<unsigned>(Button::Right));
+
+    /**
+     * Data buttons to press so that the console reads a nibble on D0
+     * to D3 (a pressed line reads 0)
+     */
+    static uint8_t nibble_buttons(uint8_t nibble);
+
     static std::string button_name(Button);
     static Button button_from_name(const std::string&);
 
-#ifdef ENABLE_GPIO
+    /**
+     * Set the GPIO driving a button. Must be called before set_backend().
+     */
     void set_gpio_map(Button, unsigned);
 
+    /**
+     * Set the GPIO reading TH. Must be called before set_backend().
+     */
+    void set_th_gpio(unsigned);
+
+    /**
+     * Mask of the mapped GPIOs
+     */
+    uint32_t output_pins() const;
+
+    /**
+     * Set the output backend (takes ownership) and configure all
+     * mapped GPIOs as outputs.
+     */
+    void set_backend(OutputBackend*);
+
+    bool has_backend() const {
+      return bool(m_backend);
+    }
+
+    /**
+     * Record input to output latency at each commit (not owned)
+     */
+    void set_latency_stats(LatencyStats* stats) {
+      m_latency = stats;
+    }
+
   private:
-    std::map<Button, unsigned> m_map;
-#endif
+    std::unique_ptr<OutputBackend> m_backend;
+    LatencyStats* m_latency;
+    uint8_t m_state;
+    uint8_t m_committed;
+    uint8_t m_claimed;
+    std::array<uint32_t, ButtonCount> m_pin_masks;
+    uint32_t m_th_mask;
+    bool m_th_input;
+    std::mutex m_write_lock;
+
+    bool write_changes();
   };
 }
 
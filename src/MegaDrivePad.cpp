@@ -0,0 +1,181 @@
+
+#include <stdexcept>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "MegaDrivePad.h"
+
+using namespace std;
+
+namespace
+{
+  // The 6 button pad goes back to its first cycle after this long
+  // without a TH change
+  const uint64_t CycleTimeout = 1500000;
+}
+
+namespace MSCtrl
+{
+  MegaDrivePad::MegaDrivePad(MasterSystem& ms, bool six_buttons)
+    : PortResponder(ms,
+                    MasterSystem::DataButtons | MasterSystem::button_bit(MasterSystem::Button::B1) | MasterSystem::button_bit(MasterSystem::Button::B2),
+                    six_buttons ? "Mega Drive 6 button pad" : "Mega Drive 3 button pad"),
+      m_six_buttons(six_buttons),
+      m_table(),
+      m_controller_buttons(0),
+      m_pressed(0),
+      m_cycle(0),
+      m_last_edge(0)
+  {
+    set_mapping(Controller::Button::DPadUp, Button::Up);
+    set_mapping(Controller::Button::DPadDown, Button::Down);
+    set_mapping(Controller::Button::DPadLeft, Button::Left);
+    set_mapping(Controller::Button::DPadRight, Button::Right);
+    set_mapping(Controller::Button::X, Button::A);
+    set_mapping(Controller::Button::A, Button::B);
+    set_mapping(Controller::Button::B, Button::C);
+    set_mapping(Controller::Button::Start, Button::Start);
+    if (six_buttons) {
+      set_mapping(Controller::Button::LeftShoulder, Button::X);
+      set_mapping(Controller::Button::Y, Button::Y);
+      set_mapping(Controller::Button::RightShoulder, Button::Z);
+      set_mapping(Controller::Button::Back, Button::Mode);
+    }
+  }
+
+  MegaDrivePad::~MegaDrivePad()
+  {
+    stop();
+  }
+
+  void MegaDrivePad::set_mapping(Controller::Button src, Button dst)
+  {
+    if (!m_six_buttons && (dst >= Button::X))
+      throw runtime_error(fmt::format("The 3 button pad has no {} button", button_name(dst)));
+
+    // One Mega Drive button per controller button; several controller
+    // buttons may press the same one
+    m_table[static_cast<unsigned>(src)] = button_bit(dst);
+  }
+
+  void MegaDrivePad::add_to(Controller& ctrl)
+  {
+    spdlog::info("Add Mega Drive {} button pad mapping to {}", m_six_buttons ? 6 : 3, ctrl.name());
+
+    Controller::Listener::add_to(ctrl);
+  }
+
+  void MegaDrivePad::on_button_state(Controller& ctrl, Controller::Button btn, bool state)
+  {
+    uint16_t bit = Controller::button_bit(btn);
+    m_controller_buttons = state ? (m_controller_buttons | bit) : (m_controller_buttons & ~bit);
+
+    uint16_t pressed = 0;
+    for (unsigned src = 0; src < Controller::ButtonCount; ++src) {
+      if (m_controller_buttons & (1U << src))
+        pressed |= m_table[src];
+    }
+
+    if (pressed != m_pressed.load(memory_order_relaxed)) {
+      m_pressed.store(pressed, memory_order_relaxed);
+      changed();
+    }
+  }
+
+  uint8_t MegaDrivePad::respond(bool th, bool edge, uint64_t now)
+  {
+    if (m_six_buttons) {
+      // Also when TH stays still: the responder calls back at the deadline
+      if (now - m_last_edge >= CycleTimeout)
+        m_cycle = 0;
+
+      if (edge) {
+        m_last_edge = now;
+        set_deadline(now + CycleTimeout);
+
+        // Cycles start with TH going low
+        if (!th)
+          m_cycle = m_cycle % 4 + 1;
+      }
+    }
+
+    uint16_t pressed = m_pressed.load(memory_order_relaxed);
+    auto line = [pressed](Button btn, MasterSystem::Button dst) -> uint8_t {
+      return (pressed & button_bit(btn)) ? MasterSystem::button_bit(dst) : 0;
+    };
+
+    uint8_t output = 0;
+
+    if (th) {
+      if (m_six_buttons && (m_cycle == 3)) {
+        output |= line(Button::Z, MasterSystem::Button::Up);
+        output |= line(Button::Y, MasterSystem::Button::Down);
+        output |= line(Button::X, MasterSystem::Button::Left);
+        output |= line(Button::Mode, MasterSystem::Button::Right);
+      } else {
+        output |= line(Button::Up, MasterSystem::Button::Up);
+        output |= line(Button::Down, MasterSystem::Button::Down);
+        output |= line(Button::Left, MasterSystem::Button::Left);
+        output |= line(Button::Right, MasterSystem::Button::Right);
+      }
+      output |= line(Button::B, MasterSystem::Button::B1);
+      output |= line(Button::C, MasterSystem::Button::B2);
+    } else {
+      if (m_six_buttons && (m_cycle == 3)) {
+        output |= MasterSystem::DataButtons;
+      } else if (!m_six_buttons || (m_cycle != 4)) {
+        // Left and Right read 0 to tell the pad from a Master System one
+        output |= line(Button::Up, MasterSystem::Button::Up);
+        output |= line(Button::Down, MasterSystem::Button::Down);
+        output |= MasterSystem::button_bit(MasterSystem::Button::Left) | MasterSystem::button_bit(MasterSystem::Button::Right);
+      }
+      output |= line(Button::A, MasterSystem::Button::B1);
+      output |= line(Button::Start, MasterSystem::Button::B2);
+    }
+
+    return output;
+  }
+
+  string MegaDrivePad::button_name(Button btn)
+  {
+    switch (btn) {
+      case Button::Up:
+        return "U";
+      case Button::Down:
+        return "D";
+      case Button::Left:
+        return "L";
+      case Button::Right:
+        return "R";
+      case Button::A:
+        return "A";
+      case Button::B:
+        return "B";
+      case Button::C:
+        return "C";
+      case Button::Start:
+        return "START";
+      case Button::X:
+        return "X";
+      case Button::Y:
+        return "Y";
+      case Button::Z:
+        return "Z";
+      case Button::Mode:
+        return "MODE";
+    }
+
+    return "Unknown";
+  }
+
+  MegaDrivePad::Button MegaDrivePad::button_from_name(const string& name)
+  {
+    for (unsigned btn = 0; btn <= static_cast<unsigned>(Button::Mode); ++btn) {
+      if (button_name(static_cast<Button>(btn)) == name)
+        return static_cast<Button>(btn);
+    }
+
+    throw runtime_error(fmt::format("Invalid Mega Drive button name \"{}\"", name));
+  }
+}
@@ -0,0 +1,85 @@
+
+#ifndef _MSCTRL_MEGADRIVEPAD_H
+#define _MSCTRL_MEGADRIVEPAD_H
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include <src/PortResponder.h>
+
+namespace MSCtrl
+{
+  /**
+   * Mega Drive 3 or 6 button pad emulation, for the Power Base
+   * Converter. Which buttons are on D0-D3, TL (B1) and TR (B2) depends
+   * on TH:
+   *   TH high: Up, Down, Left, Right, B, C
+   *   TH low:  Up, Down, 0, 0, A, Start
+   * The 6 button pad counts TH cycles; on the third, TH low reads
+   * 0, 0, 0, 0 (identifying the pad), on the fourth TH high reads Z, Y,
+   * X, Mode and TH low reads 1, 1, 1, 1. The count is reset when TH
+   * has not changed for 1.5 ms.
+   */
+  class MegaDrivePad : public PortResponder
+  {
+  public:
+    enum class Button {
+      Up,
+      Down,
+      Left,
+      Right,
+      A,
+      B,
+      C,
+      Start,
+      X,
+      Y,
+      Z,
+      Mode
+    };
+
+    /**
+     * Controller D-pad to the pad's, X/A/B to A/B/C, LS/Y/RS to X/Y/Z,
+     * START and BACK to Start and Mode
+     */
+    MegaDrivePad(MasterSystem&, bool six_buttons);
+    ~MegaDrivePad();
+
+    /**
+     * Replace the mapping of a controller button
+     */
+    void set_mapping(Controller::Button src, Button dst);
+
+    unsigned subscriptions() const override {
+      return ButtonEvents;
+    }
+
+    void add_to(Controller&) override;
+    void on_button_state(Controller&, Controller::Button, bool) override;
+
+    static uint16_t button_bit(Button btn) {
+      return 1U << static_cast<unsigned>(btn);
+    }
+
+    static std::string button_name(Button);
+    static Button button_from_name(const std::string&);
+
+  protected:
+    uint8_t respond(bool, bool, uint64_t) override;
+
+  private:
+    bool m_six_buttons;
+    std::array<uint16_t, Controller::ButtonCount> m_table;
+
+    // Written by the event loop
+    uint16_t m_controller_buttons;
+    std::atomic<uint16_t> m_pressed;
+
+    // Responder thread state
+    unsigned m_cycle;
+    uint64_t m_last_edge;
+  };
+}
+
+#endif /* _MSCTRL_MEGADRIVEPAD_H */
@@ -0,0 +1,48 @@
+
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "MemoryBackend.h"
+
+using namespace std;
+
+namespace MSCtrl
+{
+  MemoryBackend::MemoryBackend()
+    : m_pins(0),
+      m_levels(0),
+      m_input_pins(0),
+      m_inputs(0),
+      m_writes()
+  {
+    m_writes.reserve(1024);
+  }
+
+  void MemoryBackend::open(uint32_t pins)
+  {
+    m_pins |= pins;
+  }
+
+  void MemoryBackend::open_inputs(uint32_t pins)
+  {
+    if (pins & m_pins)
+      throw runtime_error(fmt::format("GPIO mask {:#010x} is already configured as output", pins & m_pins));
+
+    m_input_pins |= pins;
+  }
+
+  uint32_t MemoryBackend::read()
+  {
+    return m_inputs & m_input_pins;
+  }
+
+  void MemoryBackend::write(uint32_t set, uint32_t clear)
+  {
+    if (((set | clear) & ~m_pins) != 0)
+      throw runtime_error(fmt::format("Write to GPIO mask {:#010x} which is not configured as output", (set | clear) & ~m_pins));
+
+    m_levels = (m_levels | set) & ~clear;
+    m_writes.push_back({ set, clear });
+  }
+}
@@ -0,0 +1,68 @@
+
+#ifndef _MSCTRL_MEMORYBACKEND_H
+#define _MSCTRL_MEMORYBACKEND_H
+
+#include <vector>
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  /**
+   * Backend that keeps output levels in memory and records every
+   * write, so that the output sequence can be checked. The history is
+   * not bounded, so this is for tests only and cannot be selected by
+   * name.
+   */
+  class MemoryBackend : public OutputBackend
+  {
+  public:
+    struct Write {
+      uint32_t set;
+      uint32_t clear;
+    };
+
+    MemoryBackend();
+
+    std::string name() const override {
+      return "memory";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+    void open_inputs(uint32_t) override;
+    uint32_t read() override;
+
+    /**
+     * Set the levels returned by read()
+     */
+    void set_inputs(uint32_t levels) {
+      m_inputs = levels;
+    }
+
+    uint32_t pins() const {
+      return m_pins;
+    }
+
+    uint32_t levels() const {
+      return m_levels;
+    }
+
+    const std::vector<Write>& writes() const {
+      return m_writes;
+    }
+
+    void clear_writes() {
+      m_writes.clear();
+    }
+
+  private:
+    uint32_t m_pins;
+    uint32_t m_levels;
+    uint32_t m_input_pins;
+    uint32_t m_inputs;
+    std::vector<Write> m_writes;
+  };
+}
+
+#endif /* _MSCTRL_MEMORYBACKEND_H */
@@ -0,0 +1,34 @@
+
+#ifndef _MSCTRL_NULLBACKEND_H
+#define _MSCTRL_NULLBACKEND_H
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  /**
+   * Backend that discards all output, for benchmarking
+   */
+  class NullBackend : public OutputBackend
+  {
+  public:
+    std::string name() const override {
+      return "null";
+    }
+
+    void open(uint32_t) override {
+    }
+
+    void write(uint32_t, uint32_t) override {
+    }
+
+    void open_inputs(uint32_t) override {
+    }
+
+    uint32_t read() override {
+      return 0;
+    }
+  };
+}
+
+#endif /* _MSCTRL_NULLBACKEND_H */
@@ -0,0 +1,87 @@
+
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+#include "OutputBackend.h"
+#include "StdoutBackend.h"
+#include "NullBackend.h"
+#include "GPIOMemBackend.h"
+#include "SerialBackend.h"
+#include "RingBackend.h"
+#ifdef ENABLE_GPIO
+#include "PigpioBackend.h"
+#endif
+#ifdef ENABLE_GPIOD
+#include "GPIODBackend.h"
+#endif
+
+using namespace std;
+
+namespace MSCtrl
+{
+  void OutputBackend::open_inputs(uint32_t)
+  {
+    throw runtime_error(fmt::format("The {} backend cannot read inputs", name()));
+  }
+
+  uint32_t OutputBackend::read()
+  {
+    throw runtime_error(fmt::format("The {} backend cannot read inputs", name()));
+  }
+
+  OutputBackend* OutputBackend::create(const string& spec)
+  {
+    // Backends may take an argument, as in gpiod:/dev/gpiochip4
+    auto sep = spec.find(':');
+    string name = spec.substr(0, sep);
+    string arg = (sep == string::npos) ? "" : spec.substr(sep + 1);
+
+#ifdef ENABLE_GPIO
+    if (name == "pigpio")
+      return new PigpioBackend();
+#endif
+#ifdef ENABLE_GPIOD
+    if (name == "gpiod")
+      return arg.empty() ? new GPIODBackend() : new GPIODBackend(arg);
+#endif
+    if (name == "gpiomem")
+      return arg.empty() ? new GPIOMemBackend() : new GPIOMemBackend(arg);
+    if (name == "serial")
+      return SerialBackend::create(arg);
+    if (name == "ring")
+      return arg.empty() ? new RingBackend() : new RingBackend(arg);
+    if (name == "stdout")
+      return new StdoutBackend();
+    if (name == "null")
+      return new NullBackend();
+
+    throw runtime_error(fmt::format("Unknown output backend \"{}\"", spec));
+  }
+
+  list<string> OutputBackend::names()
+  {
+    return {
+#ifdef ENABLE_GPIO
+      "pigpio",
+#endif
+#ifdef ENABLE_GPIOD
+      "gpiod",
+#endif
+      "gpiomem",
+      "serial",
+      "ring",
+      "stdout",
+      "null"
+    };
+  }
+
+  string OutputBackend::default_name()
+  {
+#ifdef ENABLE_GPIO
+    return "pigpio";
+#else
+    return "stdout";
+#endif
+  }
+}
@@ -0,0 +1,61 @@
+
+#ifndef _MSCTRL_OUTPUTBACKEND_H
+#define _MSCTRL_OUTPUTBACKEND_H
+
+#include <cstdint>
+#include <list>
+#include <string>
+
+namespace MSCtrl
+{
+  /**
+   * Drives the GPIO outputs connected to the console. GPIOs are
+   * identified by their bit in bank 0 (GPIO n is 1 << n).
+   */
+  class OutputBackend
+  {
+  public:
+    virtual ~OutputBackend() {}
+
+    virtual std::string name() const = 0;
+
+    /**
+     * Configure GPIOs as outputs. Called once with all pins before
+     * any write.
+     * @param pins Mask of GPIOs
+     */
+    virtual void open(uint32_t pins) = 0;
+
+    /**
+     * Change output levels
+     * @param set Mask of GPIOs to drive high
+     * @param clear Mask of GPIOs to drive low
+     */
+    virtual void write(uint32_t set, uint32_t clear) = 0;
+
+    /**
+     * Configure GPIOs as inputs, for lines driven by the console (TH).
+     * Throws if the backend cannot read.
+     * @param pins Mask of GPIOs
+     */
+    virtual void open_inputs(uint32_t pins);
+
+    /**
+     * Current levels of the GPIOs configured as inputs. Must be cheap:
+     * responders call it in a busy loop.
+     */
+    virtual uint32_t read();
+
+    /**
+     * Instantiate a backend by name, optionally followed by a colon
+     * and a device path (gpiod:/dev/gpiochip4); throws if it is
+     * unknown or not available in this build.
+     */
+    static OutputBackend* create(const std::string&);
+
+    static std::list<std::string> names();
+    static std::string default_name();
+  };
+}
+
+#endif /* _MSCTRL_OUTPUTBACKEND_H */
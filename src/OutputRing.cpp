@@ -0,0 +1,180 @@
+
+#include <stdexcept>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "OutputRing.h"
+
+using namespace std;
+
+namespace
+{
+  const uint32_t Magic = 0x4d535247; // MSRG
+  const uint32_t Version = 1;
+
+  // Shared between processes, so not FUTEX_PRIVATE_FLAG
+  long futex(atomic<uint32_t>* addr, int op, uint32_t value, const struct timespec* timeout = nullptr)
+  {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, value, timeout, nullptr, 0);
+  }
+}
+
+namespace MSCtrl
+{
+  static_assert(atomic<uint32_t>::is_always_lock_free && (sizeof(atomic<uint32_t>) == sizeof(uint32_t)),
+                "The ring indices must be plain futex words");
+
+  struct OutputRing::Shared {
+    uint32_t magic;
+    uint32_t version;
+
+    // Separate cache lines for what each side writes
+    alignas(64) atomic<uint32_t> head;
+    alignas(64) atomic<uint32_t> tail;
+    atomic<uint32_t> sleeping;
+
+    alignas(64) Entry entries[Capacity];
+  };
+
+  const char* const OutputRing::DefaultName = "/msctrl-outputs";
+
+  OutputRing::OutputRing(const string& name, Shared* shared, bool owner)
+    : m_name(name),
+      m_shared(shared),
+      m_owner(owner)
+  {
+  }
+
+  OutputRing::~OutputRing()
+  {
+    munmap(m_shared, sizeof(Shared));
+    if (m_owner)
+      shm_unlink(m_name.c_str());
+  }
+
+  OutputRing* OutputRing::create(const string& name, int uid)
+  {
+    // Left behind by a daemon that was killed
+    shm_unlink(name.c_str());
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+      throw runtime_error(fmt::format("Cannot create shared memory {}: {}", name, strerror(errno)));
+
+    if ((ftruncate(fd, sizeof(Shared)) < 0) || ((uid >= 0) && (fchown(fd, uid, -1) < 0))) {
+      int error = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      throw runtime_error(fmt::format("Cannot set up shared memory {}: {}", name, strerror(error)));
+    }
+
+    void* addr = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+      shm_unlink(name.c_str());
+      throw runtime_error(fmt::format("Cannot map shared memory {}: {}", name, strerror(error)));
+    }
+
+    Shared* shared = new (addr) Shared();
+    shared->head.store(0);
+    shared->tail.store(0);
+    shared->sleeping.store(0);
+    shared->version = Version;
+    shared->magic = Magic;
+
+    spdlog::info("Output ring {} created", name);
+
+    return new OutputRing(name, shared, true);
+  }
+
+  OutputRing* OutputRing::attach(const string& name)
+  {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+      throw runtime_error(fmt::format("Cannot open shared memory {} (is msctrl-outputd running?): {}", name, strerror(errno)));
+
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (static_cast<size_t>(st.st_size) < sizeof(Shared))) {
+      close(fd);
+      throw runtime_error(fmt::format("Shared memory {} is not an output ring", name));
+    }
+
+    void* addr = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+
+    if (addr == MAP_FAILED)
+      throw runtime_error(fmt::format("Cannot map shared memory {}: {}", name, strerror(error)));
+
+    Shared* shared = static_cast<Shared*>(addr);
+    if ((shared->magic != Magic) || (shared->version != Version)) {
+      munmap(addr, sizeof(Shared));
+      throw runtime_error(fmt::format("Shared memory {} is not a version {} output ring", name, Version));
+    }
+
+    spdlog::info("Output ring {} attached", name);
+
+    return new OutputRing(name, shared, false);
+  }
+
+  bool OutputRing::push(const Entry& entry)
+  {
+    uint32_t head = m_shared->head.load(memory_order_relaxed);
+    if (head - m_shared->tail.load(memory_order_acquire) >= Capacity)
+      return false;
+
+    m_shared->entries[head % Capacity] = entry;
+    m_shared->head.store(head + 1, memory_order_release);
+
+    // Pairs with the fence in wait(): either the consumer sees the new
+    // head before sleeping, or we see it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (m_shared->sleeping.load(memory_order_relaxed))
+      futex(&m_shared->head, FUTEX_WAKE, 1);
+
+    return true;
+  }
+
+  bool OutputRing::pop(Entry& entry)
+  {
+    uint32_t tail = m_shared->tail.load(memory_order_relaxed);
+    if (m_shared->head.load(memory_order_acquire) == tail)
+      return false;
+
+    entry = m_shared->entries[tail % Capacity];
+    m_shared->tail.store(tail + 1, memory_order_release);
+
+    return true;
+  }
+
+  void OutputRing::wait(uint64_t timeout_ns)
+  {
+    uint32_t tail = m_shared->tail.load(memory_order_relaxed);
+
+    m_shared->sleeping.store(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // The kernel checks the head again before sleeping
+    if (m_shared->head.load(memory_order_relaxed) == tail) {
+      struct timespec timeout = { static_cast<time_t>(timeout_ns / 1000000000), static_cast<long>(timeout_ns % 1000000000) };
+      futex(&m_shared->head, FUTEX_WAIT, tail, &timeout);
+    }
+
+    m_shared->sleeping.store(0, memory_order_relaxed);
+  }
+}
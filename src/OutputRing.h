@@ -0,0 +1,90 @@
+
+#ifndef _MSCTRL_OUTPUTRING_H
+#define _MSCTRL_OUTPUTRING_H
+
+#include <cstdint>
+#include <string>
+
+namespace MSCtrl
+{
+  /**
+   * Single producer, single consumer ring of output changes in POSIX
+   * shared memory, from msctrl (ring backend) to the msctrl-outputd
+   * process that owns the GPIOs. Indices are free-running; the
+   * consumer sleeps on a futex on the head index when the ring is
+   * empty, and the producer only makes the wake up system call when
+   * the consumer says it is sleeping.
+   */
+  class OutputRing
+  {
+  public:
+    enum class Kind : uint32_t {
+      Open,
+      Write
+    };
+
+    struct Entry {
+      // CLOCK_MONOTONIC time of the change, in ns
+      uint64_t time;
+      Kind kind;
+      // Open: pins to configure as outputs
+      uint32_t set;
+      uint32_t clear;
+    };
+
+    static constexpr unsigned Capacity = 256;
+    static const char* const DefaultName;
+
+    /**
+     * Create the shared memory object, replacing a stale one
+     * @param uid Owner of the object, or -1 to keep the creator's
+     */
+    static OutputRing* create(const std::string& name, int uid = -1);
+
+    /**
+     * Map an existing shared memory object
+     */
+    static OutputRing* attach(const std::string& name);
+
+    /**
+     * Unmaps; the creator also removes the object
+     */
+    ~OutputRing();
+
+    OutputRing(const OutputRing&) = delete;
+    OutputRing& operator=(const OutputRing&) = delete;
+
+    /**
+     * Producer side; wakes up the consumer if needed.
+     * @return false if the ring is full
+     */
+    bool push(const Entry&);
+
+    /**
+     * Consumer side
+     * @return false if the ring is empty
+     */
+    bool pop(Entry&);
+
+    /**
+     * Consumer side: sleep until the ring is not empty, or at most
+     * the given time
+     */
+    void wait(uint64_t timeout_ns);
+
+    const std::string& name() const {
+      return m_name;
+    }
+
+  private:
+    struct Shared;
+
+    OutputRing(const std::string&, Shared*, bool);
+
+    std::string m_name;
+    Shared* m_shared;
+    bool m_owner;
+  };
+}
+
+#endif /* _MSCTRL_OUTPUTRING_H */
@@ -0,0 +1,162 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include <time.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "Paddle.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  using namespace MSCtrl;
+
+  // Sleep until this long before each edge, then spin; wake-up latency
+  // is way beyond the period otherwise.
+  const uint64_t SpinSlack = 25000;
+
+  void wait_until(uint64_t deadline)
+  {
+    uint64_t now = monotonic_ns();
+
+    if (deadline > now + SpinSlack) {
+      struct timespec ts;
+      ts.tv_sec = (deadline - SpinSlack) / 1000000000ULL;
+      ts.tv_nsec = (deadline - SpinSlack) % 1000000000ULL;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+    }
+
+    while (monotonic_ns() < deadline)
+      ;
+  }
+}
+
+namespace MSCtrl
+{
+  Paddle::Paddle(MasterSystem& ms, Controller::Axis axis)
+    : m_ms(ms),
+      m_axis(axis),
+      m_period_ns(60000),
+      m_realtime(nullptr),
+      m_position(128),
+      m_stopping(false),
+      m_nibbles(0),
+      m_overruns(0),
+      m_max_late_ns(0),
+      m_thread()
+  {
+    m_ms.claim_buttons(MasterSystem::DataButtons | MasterSystem::button_bit(MasterSystem::Button::B2));
+  }
+
+  Paddle::~Paddle()
+  {
+    stop();
+  }
+
+  void Paddle::set_period(unsigned us)
+  {
+    if ((us < 10) || (us > 1000))
+      throw runtime_error(fmt::format("Paddle period {} us is not between 10 and 1000", us));
+
+    m_period_ns = us * 1000ULL;
+  }
+
+  void Paddle::set_realtime(Realtime* realtime)
+  {
+    m_realtime.reset(realtime);
+  }
+
+  void Paddle::add_to(Controller& ctrl)
+  {
+    spdlog::info("Add paddle mapping of {} to {}; period={}us", Controller::axis_name(m_axis), ctrl.name(), m_period_ns / 1000);
+
+    Controller::Listener::add_to(ctrl);
+  }
+
+  void Paddle::on_axis_motion(Controller& ctrl, Controller::Axis axis, float value)
+  {
+    if (axis != m_axis)
+      return;
+
+    // Triggers go from 0 to 1, sticks from -1 to 1
+    if ((axis != Controller::Axis::LeftTrigger) && (axis != Controller::Axis::RightTrigger))
+      value = (value + 1.0f) / 2.0f;
+
+    set_position(static_cast<uint8_t>(lroundf(min(max(value, 0.0f), 1.0f) * 255.0f)));
+  }
+
+  void Paddle::start()
+  {
+    if (m_thread.joinable())
+      return;
+
+    m_stopping.store(false);
+    m_thread = thread(&Paddle::run, this);
+  }
+
+  void Paddle::stop()
+  {
+    if (!m_thread.joinable())
+      return;
+
+    m_stopping.store(true);
+    m_thread.join();
+  }
+
+  void Paddle::dump_stats() const
+  {
+    auto stats = timing();
+    spdlog::info("Paddle: nibbles={}, overruns={}, max late={:.1f}us", stats.nibbles, stats.overruns, stats.max_late_ns / 1000.0);
+  }
+
+  Paddle::Timing Paddle::timing() const
+  {
+    return { m_nibbles.load(), m_overruns.load(), m_max_late_ns.load() };
+  }
+
+  void Paddle::run()
+  {
+    if (m_realtime)
+      m_realtime->apply_thread();
+
+    const uint8_t TR = MasterSystem::button_bit(MasterSystem::Button::B2);
+
+    uint8_t value = 0;
+    bool high = false;
+    uint64_t deadline = monotonic_ns();
+
+    while (!m_stopping.load(memory_order_relaxed)) {
+      // Both nibbles of a byte come from the same position, so that
+      // the console never reads a torn value.
+      if (!high)
+        value = position();
+
+      // Data first, then the flag: once the console sees TR change,
+      // the nibble is already there.
+      m_ms.drive_buttons(MasterSystem::nibble_buttons(high ? (value >> 4) : (value & 0x0F)), MasterSystem::DataButtons);
+      m_ms.drive_buttons(high ? 0 : TR, TR);
+
+      uint64_t late = monotonic_ns() - deadline;
+      if (late > m_max_late_ns.load(memory_order_relaxed))
+        m_max_late_ns.store(late, memory_order_relaxed);
+      m_nibbles.fetch_add(1, memory_order_relaxed);
+
+      deadline += m_period_ns;
+      if (late >= m_period_ns) {
+        // Missed at least one edge; start over from now instead of
+        // sending a burst of short nibbles.
+        m_overruns.fetch_add(1, memory_order_relaxed);
+        deadline = monotonic_ns() + m_period_ns;
+      }
+
+      wait_until(deadline);
+      high = !high;
+    }
+  }
+}
@@ -0,0 +1,86 @@
+
+#ifndef _MSCTRL_PADDLE_H
+#define _MSCTRL_PADDLE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <src/MasterSystem.h>
+#include <src/Peripheral.h>
+#include <src/Realtime.h>
+
+namespace MSCtrl
+{
+  /**
+   * HPD-200 Paddle Control emulation. The paddle position (0-255) is
+   * taken from a controller axis, and sent by a dedicated thread as
+   * two nibbles on Up/Down/Left/Right (D0 to D3), alternating every
+   * period: low nibble while B2 (TR) is low, high nibble while it is
+   * high. The paddle's button is B1, mapped like any other button.
+   */
+  class Paddle : public Peripheral
+  {
+  public:
+    struct Timing {
+      uint64_t nibbles;
+      uint64_t overruns;
+      uint64_t max_late_ns;
+    };
+
+    Paddle(MasterSystem&, Controller::Axis);
+    ~Paddle();
+
+    /**
+     * @param us Nibble period in microseconds (default 60)
+     */
+    void set_period(unsigned us);
+
+    /**
+     * Scheduling of the toggling thread (takes ownership). Without
+     * it, the thread inherits the event loop's.
+     */
+    void set_realtime(Realtime*);
+
+    unsigned subscriptions() const override {
+      return AxisEvents;
+    }
+
+    void add_to(Controller&) override;
+    void on_axis_motion(Controller&, Controller::Axis, float) override;
+
+    void set_position(uint8_t position) {
+      m_position.store(position, std::memory_order_relaxed);
+    }
+
+    uint8_t position() const {
+      return m_position.load(std::memory_order_relaxed);
+    }
+
+    void start() override;
+    void stop() override;
+    void dump_stats() const override;
+
+    /**
+     * Number of nibbles sent, how many were sent more than a period
+     * late, and the worst lateness
+     */
+    Timing timing() const;
+
+  private:
+    MasterSystem& m_ms;
+    Controller::Axis m_axis;
+    uint64_t m_period_ns;
+    std::unique_ptr<Realtime> m_realtime;
+    std::atomic<uint8_t> m_position;
+    std::atomic<bool> m_stopping;
+    std::atomic<uint64_t> m_nibbles;
+    std::atomic<uint64_t> m_overruns;
+    std::atomic<uint64_t> m_max_late_ns;
+    std::thread m_thread;
+
+    void run();
+  };
+}
+
+#endif /* _MSCTRL_PADDLE_H */
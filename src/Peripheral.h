@@ -0,0 +1,30 @@
+
+#ifndef _MSCTRL_PERIPHERAL_H
+#define _MSCTRL_PERIPHERAL_H
+
+#include <src/Controller.h>
+
+namespace MSCtrl
+{
+  /**
+   * Emulation of something else than a pad on the controller port. It
+   * claims some of the Master System buttons, drives them from its own
+   * thread, and is fed by controllers like any mapping.
+   */
+  class Peripheral : public Controller::Listener
+  {
+  public:
+    /**
+     * Start/stop the peripheral's thread
+     */
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+    /**
+     * Log timing statistics
+     */
+    virtual void dump_stats() const = 0;
+  };
+}
+
+#endif /* _MSCTRL_PERIPHERAL_H */
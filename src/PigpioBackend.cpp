@@ -0,0 +1,71 @@
+
+#include <stdexcept>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <pigpio.h>
+
+#include "PigpioBackend.h"
+
+using namespace std;
+
+namespace MSCtrl
+{
+  PigpioBackend::PigpioBackend()
+  {
+    gpioCfgSetInternals(gpioCfgGetInternals() | PI_CFG_NOSIGHANDLER);
+    if (gpioInitialise() < 0)
+      throw runtime_error("Cannot initialize GPIO");
+
+    spdlog::info("GPIO initialized");
+  }
+
+  PigpioBackend::~PigpioBackend()
+  {
+    gpioTerminate();
+  }
+
+  void PigpioBackend::open(uint32_t pins)
+  {
+    set_mode(pins, PI_OUTPUT);
+  }
+
+  void PigpioBackend::open_inputs(uint32_t pins)
+  {
+    set_mode(pins, PI_INPUT);
+  }
+
+  void PigpioBackend::set_mode(uint32_t pins, unsigned mode)
+  {
+    for (unsigned port = 0; port < 32; ++port) {
+      if ((pins & (1U << port)) == 0)
+        continue;
+
+      int status;
+      if ((status = gpioSetMode(port, mode)) != 0) {
+        switch (status) {
+          case PI_BAD_GPIO:
+            throw runtime_error(fmt::format("Bad GPIO port {}", port));
+          case PI_BAD_MODE:
+            throw runtime_error(fmt::format("Bad mode for GPIO {}", port));
+          default:
+            throw runtime_error(fmt::format("Unknown error initializing GPIO {}: {}", port, status));
+        }
+      }
+    }
+  }
+
+  void PigpioBackend::write(uint32_t set, uint32_t clear)
+  {
+    int status;
+    if ((set != 0) && ((status = gpioWrite_Bits_0_31_Set(set)) != 0))
+      throw runtime_error(fmt::format("Unknown error setting GPIO mask {:#010x}: {}", set, status));
+    if ((clear != 0) && ((status = gpioWrite_Bits_0_31_Clear(clear)) != 0))
+      throw runtime_error(fmt::format("Unknown error clearing GPIO mask {:#010x}: {}", clear, status));
+  }
+
+  uint32_t PigpioBackend::read()
+  {
+    return gpioRead_Bits_0_31();
+  }
+}
@@ -0,0 +1,29 @@
+
+#ifndef _MSCTRL_PIGPIOBACKEND_H
+#define _MSCTRL_PIGPIOBACKEND_H
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  class PigpioBackend : public OutputBackend
+  {
+  public:
+    PigpioBackend();
+    ~PigpioBackend();
+
+    std::string name() const override {
+      return "pigpio";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+    void open_inputs(uint32_t) override;
+    uint32_t read() override;
+
+  private:
+    void set_mode(uint32_t, unsigned);
+  };
+}
+
+#endif /* _MSCTRL_PIGPIOBACKEND_H */
@@ -0,0 +1,122 @@
+
+#include <spdlog/spdlog.h>
+
+#include "PortResponder.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // TH polls between yields
+  const unsigned YieldInterval = 64;
+}
+
+namespace MSCtrl
+{
+  PortResponder::PortResponder(MasterSystem& ms, uint8_t buttons, const string& name)
+    : m_ms(ms),
+      m_buttons(buttons),
+      m_name(name),
+      m_realtime(nullptr),
+      m_changed(false),
+      m_stopping(false),
+      m_deadline(0),
+      m_response_lock(),
+      m_response(),
+      m_thread()
+  {
+    m_ms.claim_buttons(buttons);
+    m_ms.enable_th_input();
+  }
+
+  PortResponder::~PortResponder()
+  {
+    stop();
+  }
+
+  void PortResponder::set_realtime(Realtime* realtime)
+  {
+    m_realtime.reset(realtime);
+  }
+
+  void PortResponder::start()
+  {
+    if (m_thread.joinable())
+      return;
+
+    m_stopping.store(false);
+    m_thread = thread(&PortResponder::run, this);
+  }
+
+  void PortResponder::stop()
+  {
+    if (!m_thread.joinable())
+      return;
+
+    m_stopping.store(true);
+    m_thread.join();
+  }
+
+  void PortResponder::dump_stats() const
+  {
+    LatencyHistogram response = response_times();
+    spdlog::info("{} response time: n={}, p50={:.1f}us, p99={:.1f}us, max={:.1f}us",
+                 m_name, response.count(),
+                 response.percentile(50) / 1000.0,
+                 response.percentile(99) / 1000.0,
+                 response.max() / 1000.0);
+  }
+
+  LatencyHistogram PortResponder::response_times() const
+  {
+    lock_guard<mutex> lock(m_response_lock);
+    return m_response;
+  }
+
+  void PortResponder::run()
+  {
+    if (m_realtime)
+      m_realtime->apply_thread();
+
+    bool th = m_ms.read_th();
+    uint8_t output = respond(th, false, monotonic_ns());
+    m_ms.drive_buttons(output, m_buttons);
+
+    unsigned idle = 0;
+    while (!m_stopping.load(memory_order_relaxed)) {
+      bool level = m_ms.read_th();
+      bool edge = (level != th);
+      bool expired = !edge && (m_deadline != 0) && (monotonic_ns() >= m_deadline);
+
+      if (!edge && !expired && !m_changed.load(memory_order_relaxed)) {
+        // Let other threads sharing the CPU run once in a while; this is
+        // only a syscall when the CPU is ours.
+        if (++idle == YieldInterval) {
+          idle = 0;
+          this_thread::yield();
+        }
+        continue;
+      }
+
+      uint64_t now = monotonic_ns();
+      th = level;
+      m_changed.exchange(false, memory_order_acquire);
+      if (expired)
+        m_deadline = 0;
+
+      uint8_t next = respond(th, edge, now);
+      if (next != output) {
+        m_ms.drive_buttons(next, m_buttons);
+        output = next;
+      }
+
+      if (edge) {
+        // Only contended while the statistics are being read
+        uint64_t elapsed = monotonic_ns() - now;
+        lock_guard<mutex> lock(m_response_lock);
+        m_response.record(elapsed);
+      }
+    }
+  }
+}
@@ -0,0 +1,97 @@
+
+#ifndef _MSCTRL_PORTRESPONDER_H
+#define _MSCTRL_PORTRESPONDER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <src/MasterSystem.h>
+#include <src/Peripheral.h>
+#include <src/LatencyHistogram.h>
+#include <src/Realtime.h>
+
+namespace MSCtrl
+{
+  /**
+   * Base for peripherals that answer the console toggling TH (pin 7).
+   * A dedicated thread busy-polls the TH input and calls respond() at
+   * each edge, and when the subclass signals that its state changed;
+   * the result is written to the claimed buttons right away. This
+   * keeps one CPU busy, so pin the thread to a spare one.
+   */
+  class PortResponder : public Peripheral
+  {
+  public:
+    /**
+     * @param buttons Buttons driven by the responder
+     * @param name For logging
+     */
+    PortResponder(MasterSystem&, uint8_t buttons, const std::string& name);
+    virtual ~PortResponder();
+
+    /**
+     * Scheduling of the responder thread (takes ownership). Without
+     * it, the thread inherits the event loop's.
+     */
+    void set_realtime(Realtime*);
+
+    /**
+     * Subclasses must call stop() in their destructor
+     */
+    void start() override;
+    void stop() override;
+    void dump_stats() const override;
+
+    /**
+     * Snapshot of the time from the detection of a TH edge to the end
+     * of the write
+     */
+    LatencyHistogram response_times() const;
+
+  protected:
+    /**
+     * Called from the responder thread
+     * @param th TH level
+     * @param edge True if TH just changed, false if only changed() was
+     * called or the deadline expired
+     * @param now monotonic_ns()
+     * @return Claimed buttons to press
+     */
+    virtual uint8_t respond(bool th, bool edge, uint64_t now) = 0;
+
+    /**
+     * The output for the current TH level may have changed; called
+     * from other threads.
+     */
+    void changed() {
+      m_changed.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Have respond() called at that time (monotonic_ns()) even if TH
+     * does not change, for timeouts; 0 cancels. Only from respond().
+     */
+    void set_deadline(uint64_t when) {
+      m_deadline = when;
+    }
+
+  private:
+    MasterSystem& m_ms;
+    uint8_t m_buttons;
+    std::string m_name;
+    std::unique_ptr<Realtime> m_realtime;
+    std::atomic<bool> m_changed;
+    std::atomic<bool> m_stopping;
+    uint64_t m_deadline;
+    mutable std::mutex m_response_lock;
+    LatencyHistogram m_response;
+    std::thread m_thread;
+
+    void run();
+  };
+}
+
+#endif /* _MSCTRL_PORTRESPONDER_H */
@@ -0,0 +1,106 @@
+
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "Realtime.h"
+
+using namespace std;
+
+namespace
+{
+  const size_t StackPrefault = 256 * 1024;
+  const size_t HeapPrefault = 4 * 1024 * 1024;
+
+  void __attribute__((noinline)) prefault_stack()
+  {
+    char stack[StackPrefault];
+    memset(stack, 0, sizeof(stack));
+    asm volatile("" : : "r"(stack) : "memory");
+  }
+}
+
+namespace MSCtrl
+{
+  Realtime::Realtime()
+    : m_priority(50),
+      m_cpu(-1)
+  {
+  }
+
+  void Realtime::set_priority(int priority)
+  {
+    if ((priority < 1) || (priority > 99))
+      throw runtime_error(fmt::format("Real-time priority {} is not between 1 and 99", priority));
+
+    m_priority = priority;
+  }
+
+  void Realtime::set_cpu(int cpu)
+  {
+    if ((cpu < 0) || (cpu >= sysconf(_SC_NPROCESSORS_CONF)))
+      throw runtime_error(fmt::format("No CPU #{}", cpu));
+
+    m_cpu = cpu;
+  }
+
+  void Realtime::apply()
+  {
+    // Keep freed memory in the heap instead of giving it back to the
+    // system, so that pre-faulted pages stay mapped.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+      spdlog::info("Real-time: memory locked");
+
+      prefault_stack();
+
+      if (char* heap = static_cast<char*>(malloc(HeapPrefault))) {
+        for (size_t offset = 0; offset < HeapPrefault; offset += 4096)
+          heap[offset] = 0;
+        free(heap);
+        spdlog::info("Real-time: pre-faulted {} KiB of stack and {} KiB of heap", StackPrefault / 1024, HeapPrefault / 1024);
+      }
+    } else {
+      spdlog::warn("Real-time: cannot lock memory ({}); page faults may cause stalls", strerror(errno));
+    }
+
+    apply_thread();
+  }
+
+  void Realtime::apply_thread()
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = m_priority;
+
+    int status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (status == 0)
+      spdlog::info("Real-time: SCHED_FIFO priority {}", m_priority);
+    else
+      spdlog::warn("Real-time: cannot use SCHED_FIFO ({}); running with the default scheduler", strerror(status));
+
+    if (m_cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(m_cpu, &cpus);
+
+      status = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+      if (status == 0)
+        spdlog::info("Real-time: pinned to CPU #{}", m_cpu);
+      else
+        spdlog::warn("Real-time: cannot pin to CPU #{} ({})", m_cpu, strerror(status));
+    }
+  }
+}
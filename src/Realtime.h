@@ -0,0 +1,46 @@
+
+#ifndef _MSCTRL_REALTIME_H
+#define _MSCTRL_REALTIME_H
+
+namespace MSCtrl
+{
+  /**
+   * Real-time execution settings for the calling (event to GPIO) thread
+   */
+  class Realtime
+  {
+  public:
+    Realtime();
+
+    /**
+     * @param priority SCHED_FIFO priority (1 to 99, default 50)
+     */
+    void set_priority(int priority);
+
+    /**
+     * @param cpu CPU to pin the thread to; by default it is left alone
+     */
+    void set_cpu(int cpu);
+
+    /**
+     * Lock and pre-fault memory, switch the calling thread to
+     * SCHED_FIFO and pin it. Threads created afterwards inherit the
+     * scheduling policy, so call this once everything else has been
+     * started. Failures are not fatal; everything that was and was not
+     * obtained is logged.
+     */
+    void apply();
+
+    /**
+     * Only switch the calling thread to SCHED_FIFO and pin it; for
+     * helper threads started after apply().
+     */
+    void apply_thread();
+
+  private:
+    int m_priority;
+    int m_cpu;
+  };
+}
+
+#endif /* _MSCTRL_REALTIME_H */
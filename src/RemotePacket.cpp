@@ -0,0 +1,66 @@
+
+#include <cstring>
+
+#include "RemotePacket.h"
+
+namespace
+{
+  // Host byte order, little endian on all supported targets (as in EventLog)
+  template <typename T> void put(uint8_t*& dst, T value)
+  {
+    memcpy(dst, &value, sizeof(T));
+    dst += sizeof(T);
+  }
+
+  template <typename T> T get(const uint8_t*& src)
+  {
+    T value;
+    memcpy(&value, src, sizeof(T));
+    src += sizeof(T);
+    return value;
+  }
+}
+
+namespace MSCtrl
+{
+  void RemotePacket::encode(uint8_t* dst) const
+  {
+    put<uint32_t>(dst, Magic);
+    put<uint8_t>(dst, Version);
+    put<uint8_t>(dst, pad);
+    put<uint8_t>(dst, flags);
+    put<uint8_t>(dst, 0);
+    put<uint32_t>(dst, session);
+    put<uint32_t>(dst, sequence);
+    put<uint64_t>(dst, time);
+    put<uint32_t>(dst, buttons);
+    for (unsigned axis = 0; axis < AxisCount; ++axis)
+      put<int16_t>(dst, axes[axis]);
+    for (unsigned axis = 0; axis < 3; ++axis)
+      put<float>(dst, gyro[axis]);
+    put<uint64_t>(dst, gyro_time);
+  }
+
+  bool RemotePacket::decode(const uint8_t* src, size_t size)
+  {
+    if (size != Size)
+      return false;
+    if ((get<uint32_t>(src) != Magic) || (get<uint8_t>(src) != Version))
+      return false;
+
+    pad = get<uint8_t>(src);
+    flags = get<uint8_t>(src);
+    get<uint8_t>(src);
+    session = get<uint32_t>(src);
+    sequence = get<uint32_t>(src);
+    time = get<uint64_t>(src);
+    buttons = get<uint32_t>(src);
+    for (unsigned axis = 0; axis < AxisCount; ++axis)
+      axes[axis] = get<int16_t>(src);
+    for (unsigned axis = 0; axis < 3; ++axis)
+      gyro[axis] = get<float>(src);
+    gyro_time = get<uint64_t>(src);
+
+    return true;
+  }
+}
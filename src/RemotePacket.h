@@ -0,0 +1,56 @@
+
+#ifndef _MSCTRL_REMOTEPACKET_H
+#define _MSCTRL_REMOTEPACKET_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace MSCtrl
+{
+  /**
+   * Full controller state sent over UDP by msctrl-send. Fixed size,
+   * little endian:
+   *   u32 magic ("MSUP"), u8 version, u8 pad index, u8 flags, u8 0
+   *   u32 session (random, per sender run), u32 sequence
+   *   u64 sender CLOCK_MONOTONIC time in ns
+   *   u32 buttons (bit n is SDL_CONTROLLER_BUTTON n)
+   *   6 x i16 axes (SDL_CONTROLLER_AXIS order and ranges)
+   *   3 x f32 gyro rates in rad/s
+   *   u64 sender time of the gyro sample in us
+   * Since each packet carries the whole state, a lost one is corrected
+   * by the next; older ones are dropped by sequence number. Gyro
+   * samples are sent one per packet, so that the receiver integrates
+   * them over their own intervals.
+   */
+  struct RemotePacket
+  {
+    enum Flags : uint8_t {
+      Gyro = 0x01,  // Gyro rates are valid
+      Bye = 0x02    // The controller is gone
+    };
+
+    static constexpr uint32_t Magic = 0x5055534d;
+    static constexpr uint8_t Version = 2;
+    static constexpr size_t Size = 60;
+    static constexpr unsigned AxisCount = 6;
+
+    uint8_t pad;
+    uint8_t flags;
+    uint32_t session;
+    uint32_t sequence;
+    uint64_t time;
+    uint32_t buttons;
+    int16_t axes[AxisCount];
+    float gyro[3];
+    uint64_t gyro_time;
+
+    void encode(uint8_t* dst) const;
+
+    /**
+     * @return false if the data is not a valid packet
+     */
+    bool decode(const uint8_t* src, size_t size);
+  };
+}
+
+#endif /* _MSCTRL_REMOTEPACKET_H */
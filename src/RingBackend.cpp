@@ -0,0 +1,46 @@
+
+#include <stdexcept>
+#include <thread>
+
+#include <fmt/core.h>
+
+#include "RingBackend.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // The daemon drains the ring in microseconds; if it stays full this
+  // long, it is gone
+  const uint64_t FullTimeout = 100000000;
+}
+
+namespace MSCtrl
+{
+  RingBackend::RingBackend(const string& name)
+    : m_ring(OutputRing::attach(name))
+  {
+  }
+
+  void RingBackend::open(uint32_t pins)
+  {
+    push(OutputRing::Kind::Open, pins, 0);
+  }
+
+  void RingBackend::write(uint32_t set, uint32_t clear)
+  {
+    push(OutputRing::Kind::Write, set, clear);
+  }
+
+  void RingBackend::push(OutputRing::Kind kind, uint32_t set, uint32_t clear)
+  {
+    OutputRing::Entry entry = { monotonic_ns(), kind, set, clear };
+
+    while (!m_ring->push(entry)) {
+      if (monotonic_ns() - entry.time > FullTimeout)
+        throw runtime_error(fmt::format("msctrl-outputd does not empty {}", m_ring->name()));
+      this_thread::yield();
+    }
+  }
+}
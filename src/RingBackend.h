@@ -0,0 +1,36 @@
+
+#ifndef _MSCTRL_RINGBACKEND_H
+#define _MSCTRL_RINGBACKEND_H
+
+#include <memory>
+
+#include <src/OutputBackend.h>
+#include <src/OutputRing.h>
+
+namespace MSCtrl
+{
+  /**
+   * Hands output changes over to msctrl-outputd through a shared
+   * memory ring, so that only that small process needs the privileges
+   * to drive the GPIOs.
+   */
+  class RingBackend : public OutputBackend
+  {
+  public:
+    RingBackend(const std::string& name = OutputRing::DefaultName);
+
+    std::string name() const override {
+      return "ring";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+
+  private:
+    std::unique_ptr<OutputRing> m_ring;
+
+    void push(OutputRing::Kind, uint32_t, uint32_t);
+  };
+}
+
+#endif /* _MSCTRL_RINGBACKEND_H */
@@ -0,0 +1,115 @@
+
+#include <spdlog/spdlog.h>
+
+#include "RingServer.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // Longest sleep between checks for stop()
+  const uint64_t SleepTimeout = 100000000;
+}
+
+namespace MSCtrl
+{
+  RingServer::RingServer(OutputRing* ring, OutputBackend* backend, uint32_t allowed)
+    : m_ring(ring),
+      m_backend(backend),
+      m_allowed(allowed),
+      m_pins(allowed),
+      m_spin(0),
+      m_stopping(false),
+      m_delivered(0),
+      m_stats_lock(),
+      m_latency(),
+      m_wakeups(0)
+  {
+    // Up front, so that a GPIO that cannot be used is reported at
+    // startup rather than when a client connects
+    m_backend->open(m_pins);
+  }
+
+  void RingServer::set_spin(uint64_t ns)
+  {
+    m_spin = ns;
+  }
+
+  void RingServer::stop()
+  {
+    m_stopping.store(true, memory_order_relaxed);
+  }
+
+  void RingServer::run()
+  {
+    uint64_t last = monotonic_ns();
+
+    while (!m_stopping.load(memory_order_relaxed)) {
+      OutputRing::Entry entry;
+
+      if (m_ring->pop(entry)) {
+        apply(entry);
+        last = monotonic_ns();
+        continue;
+      }
+
+      if ((m_spin != 0) && (monotonic_ns() - last < m_spin))
+        continue;
+
+      m_ring->wait(SleepTimeout);
+      last = monotonic_ns();
+
+      lock_guard<mutex> lock(m_stats_lock);
+      ++m_wakeups;
+    }
+  }
+
+  void RingServer::apply(const OutputRing::Entry& entry)
+  {
+    switch (entry.kind) {
+      case OutputRing::Kind::Open:
+        if (entry.set & ~m_allowed)
+          spdlog::warn("Ignoring GPIO mask {:#010x}, not allowed", entry.set & ~m_allowed);
+
+        // A new client starts with all outputs low
+        m_backend->write(0, m_pins);
+        spdlog::info("Client opened GPIO mask {:#010x}", entry.set & m_allowed);
+        break;
+      case OutputRing::Kind::Write:
+      {
+        m_backend->write(entry.set & m_pins, entry.clear & m_pins);
+        uint64_t elapsed = monotonic_ns() - entry.time;
+
+        // Only contended while the statistics are being read
+        {
+          lock_guard<mutex> lock(m_stats_lock);
+          m_latency.record(elapsed);
+        }
+        m_delivered.fetch_add(1, memory_order_relaxed);
+        break;
+      }
+    }
+  }
+
+  LatencyHistogram RingServer::latency() const
+  {
+    lock_guard<mutex> lock(m_stats_lock);
+    return m_latency;
+  }
+
+  void RingServer::dump_stats() const
+  {
+    LatencyHistogram latency;
+    uint64_t wakeups;
+    {
+      lock_guard<mutex> lock(m_stats_lock);
+      latency = m_latency;
+      wakeups = m_wakeups;
+    }
+
+    spdlog::info("Ring to {} latency: n={}, p50={:.1f}us, p99={:.1f}us, max={:.1f}us, wakeups={}",
+                 m_backend->name(), latency.count(), latency.percentile(50) / 1000.0,
+                 latency.percentile(99) / 1000.0, latency.max() / 1000.0, wakeups);
+  }
+}
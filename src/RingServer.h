@@ -0,0 +1,81 @@
+
+#ifndef _MSCTRL_RINGSERVER_H
+#define _MSCTRL_RINGSERVER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <src/OutputBackend.h>
+#include <src/OutputRing.h>
+#include <src/LatencyHistogram.h>
+
+namespace MSCtrl
+{
+  /**
+   * Consumer side of the output ring, in msctrl-outputd: applies the
+   * changes to the real backend, restricted to the allowed GPIOs, and
+   * measures the time from the producer's write to the backend's.
+   */
+  class RingServer
+  {
+  public:
+    /**
+     * Takes ownership of the ring and the backend, and opens the
+     * allowed GPIOs as outputs
+     * @param allowed Mask of the GPIOs clients may drive
+     */
+    RingServer(OutputRing*, OutputBackend*, uint32_t allowed);
+
+    /**
+     * Keep polling the ring this long after the last change before
+     * going to sleep (default 0). Waking up from the futex costs tens
+     * of us; spinning trades a CPU for the low microseconds.
+     */
+    void set_spin(uint64_t ns);
+
+    /**
+     * Process changes until stop() is called
+     */
+    void run();
+
+    /**
+     * May be called from any thread
+     */
+    void stop();
+
+    /**
+     * Copy of the ring to backend latencies; may be called from any
+     * thread
+     */
+    LatencyHistogram latency() const;
+
+    /**
+     * Number of writes applied so far; may be called from any thread
+     */
+    uint64_t delivered() const {
+      return m_delivered.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * May be called from any thread
+     */
+    void dump_stats() const;
+
+  private:
+    std::unique_ptr<OutputRing> m_ring;
+    std::unique_ptr<OutputBackend> m_backend;
+    uint32_t m_allowed;
+    uint32_t m_pins;
+    uint64_t m_spin;
+    std::atomic<bool> m_stopping;
+    std::atomic<uint64_t> m_delivered;
+    mutable std::mutex m_stats_lock;
+    LatencyHistogram m_latency;
+    uint64_t m_wakeups;
+
+    void apply(const OutputRing::Entry&);
+  };
+}
+
+#endif /* _MSCTRL_RINGSERVER_H */
@@ -2,113 +2,553 @@
 #include <stdexcept>
 #include <algorithm>
 
+#include <cerrno>
+
+#include <cstring>
+#include <vector>
+
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
 #include <SDL2/SDL.h>
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
 
 #include "SDLMain.h"
+#include "utils.h"
 
 using namespace std;
 
+namespace
+{
+  // Maximum number of events drained from the SDL queue at once
+  const int BatchSize = 64;
+
+  /**
+   * Sensor timestamp in us: the sensor's own clock when SDL reports
+   * it, or the time the event was dequeued. SDL's millisecond
+   * timestamp is too coarse at 1 kHz.
+   */
+  uint64_t sensor_timestamp(const SDL_ControllerSensorEvent& evt, uint64_t now)
+  {
+#if SDL_VERSION_ATLEAST(2, 26, 0)
+    if (evt.timestamp_us != 0)
+      return evt.timestamp_us;
+#endif
+    return now / 1000;
+  }
+}
+
 namespace MSCtrl
 {
   SDLMain::SDLMain()
-    : m_controllers()
+    : m_controllers(),
+      m_latency(nullptr),
+      m_dump_event(0),
+      m_quit_requested(false),
+      m_dump_requested(false),
+      m_stopping(false),
+      m_wakeup_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      m_signal_thread(),
+      m_recorder(),
+      m_replay(),
+      m_replay_realtime(false),
+      m_sources(),
+      m_batches()
   {
+    if (m_wakeup_fd < 0)
+      throw runtime_error(fmt::format("Cannot create eventfd: {}", strerror(errno)));
+
+    // Block signals before SDL starts its own threads so that only the
+    // signal thread receives them; it then wakes up the main loop,
+    // whether it waits for SDL events or on file descriptors.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
     if (SDL_Init(SDL_INIT_GAMECONTROLLER|SDL_INIT_TIMER) < 0)
       throw runtime_error(fmt::format("Cannot initialize SDL: {}", SDL_GetError()));
 
     SDL_GameControllerEventState(SDL_ENABLE);
+
+    m_dump_event = SDL_RegisterEvents(1);
+    if (m_dump_event == static_cast<uint32_t>(-1)) {
+      // Otherwise SIGUSR1 would go unnoticed
+      SDL_Quit();
+      close(m_wakeup_fd);
+      throw runtime_error("Cannot register the statistics event: no SDL user event left");
+    }
+
+    m_signal_thread = thread([this, sigs]() {
+      int sig;
+      while ((sigwait(&sigs, &sig) == 0) && !m_stopping) {
+        SDL_Event evt = {};
+        if (sig == SIGUSR1) {
+          m_dump_requested = true;
+          evt.type = m_dump_event;
+        } else {
+          m_quit_requested = true;
+          evt.type = SDL_QUIT;
+        }
+        SDL_PushEvent(&evt);
+
+        uint64_t one = 1;
+        if (write(m_wakeup_fd, &one, sizeof(one)) < 0)
+          spdlog::warn("Cannot wake up main loop: {}", strerror(errno));
+      }
+    });
   }
 
   SDLMain::~SDLMain()
   {
+    m_stopping = true;
+    pthread_kill(m_signal_thread.native_handle(), SIGUSR1);
+    m_signal_thread.join();
+    close(m_wakeup_fd);
+
+    m_sources.clear();
     m_controllers.clear(); // Avoid double-free since SDL_Quit closes them
     SDL_Quit();
   }
 
+  void SDLMain::set_record_file(const string& filename)
+  {
+    m_recorder.reset(new EventLogWriter(filename));
+    spdlog::info("Recording events to {}", filename);
+  }
+
+  void SDLMain::set_replay_file(const string& filename, bool realtime)
+  {
+    m_replay.reset(new EventLogReader(filename));
+    m_replay_realtime = realtime;
+  }
+
+  void SDLMain::add_input_source(InputSource* source)
+  {
+    m_sources.emplace_back(source);
+  }
+
   void SDLMain::loop()
   {
-    SDL_Event evt;
-    bool stop = false;
-    while (!stop && SDL_WaitEvent(&evt)) {
-      switch (evt.type) {
-        case SDL_QUIT:
-          spdlog::info("Quitting");
-          stop = true;
+    if (m_replay) {
+      replay();
+    } else if (!m_sources.empty()) {
+      poll_sources();
+    } else {
+      SDL_Event batch[BatchSize];
+      while (SDL_WaitEvent(&batch[0])) {
+        int count = SDL_PeepEvents(&batch[1], BatchSize - 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+        if (!handle_batch(batch, 1 + max(count, 0)))
           break;
-        case SDL_CONTROLLERDEVICEADDED:
-        {
-          string name = SDL_GameControllerNameForIndex(evt.cdevice.which);
+        on_events_processed();
+      }
+    }
 
-          spdlog::info("Controller {} added", name);
+    on_dump_stats();
+  }
 
-          if (on_controller_added(name)) {
-            m_controllers.emplace_back(new Controller(evt.cdevice.which));
-            on_controller_open(*m_controllers.back());
+  bool SDLMain::handle_batch(const SDL_Event* events, int count)
+  {
+    uint64_t now = monotonic_ns();
 
-            spdlog::info("Controller {} opened", name);
-          }
-          break;
-        }
-        case SDL_CONTROLLERDEVICEREMOVED:
-          m_controllers.erase(
-            remove_if(m_controllers.begin(), m_controllers.end(), [&](const unique_ptr<Controller>& ctrl) {
-              if (ctrl->matches(evt.cdevice.which)) {
-                spdlog::info("Controller {} closed", ctrl->name());
-                return true;
-              }
-              return false;
-            }),
-            m_controllers.end()
-            );
-          break;
+    ++m_batches.batches;
+    m_batches.events += count;
+    m_batches.largest = max(m_batches.largest, static_cast<unsigned>(count));
+
+    // The batch is handled in arrival order, except that button
+    // transitions do not wait behind stick values: those are deferred
+    // until the next event of another kind, and only the latest value
+    // of each axis is kept. Triggers are buttons for the mappings, so
+    // they are never deferred nor dropped. Gyro samples are all needed
+    // for integration, so nothing is moved across them. The recording
+    // keeps the arrival order.
+    int deferred[BatchSize] = {};
+    int deferred_count = 0;
+    int recorded = 0;
+
+    for (int i = 0; i < count; ++i) {
+      switch (events[i].type) {
         case SDL_CONTROLLERBUTTONUP:
-          for (auto& ctrl : m_controllers) {
-            if (ctrl->matches(evt.cbutton.which)) {
-              ctrl->on_button_release(evt.cbutton.button);
-              break;
-            }
-          }
-          break;
         case SDL_CONTROLLERBUTTONDOWN:
-          for (auto& ctrl : m_controllers) {
-            if (ctrl->matches(evt.cbutton.which)) {
-              ctrl->on_button_press(evt.cbutton.button);
-              break;
-            }
-          }
+          for (; recorded <= i; ++recorded)
+            record_event(events[recorded], now);
+          handle_event(events[i], now);
           break;
         case SDL_CONTROLLERAXISMOTION:
-          for (auto& ctrl : m_controllers) {
-            if (ctrl->matches(evt.caxis.which)) {
-              ctrl->on_axis_motion(evt.caxis.axis, evt.caxis.value);
-              break;
-            }
+          if ((events[i].caxis.axis == SDL_CONTROLLER_AXIS_TRIGGERLEFT) || (events[i].caxis.axis == SDL_CONTROLLER_AXIS_TRIGGERRIGHT)) {
+            for (; recorded <= i; ++recorded)
+              record_event(events[recorded], now);
+            handle_event(events[i], now);
+          } else {
+            deferred[deferred_count++] = i;
           }
           break;
         case SDL_CONTROLLERSENSORUPDATE:
-          for (auto& ctrl : m_controllers) {
-            if (ctrl->matches(evt.csensor.which)) {
-              switch (evt.csensor.sensor) {
-                case SDL_SENSOR_GYRO:
-                  ctrl->on_gyro_update(evt.csensor.timestamp, evt.csensor.data[0], evt.csensor.data[1], evt.csensor.data[2]);
-                  break;
-                default:
-                  break;
-              }
-              break;
-            }
-          }
+          handle_axes(events, deferred, deferred_count, now);
+          deferred_count = 0;
+          for (; recorded <= i; ++recorded)
+            record_event(events[recorded], now);
+          handle_event(events[i], now);
           break;
-        case SDL_JOYDEVICEADDED:
-          if (!SDL_IsGameController(evt.jdevice.which)) {
-            spdlog::warn("Joystick {} added, but is not a game controller", SDL_JoystickNameForIndex(evt.jdevice.which));
+        default:
+          // Device changes record themselves
+          handle_axes(events, deferred, deferred_count, now);
+          deferred_count = 0;
+          for (; recorded < i; ++recorded)
+            record_event(events[recorded], now);
+          recorded = i + 1;
+          if (!handle_event(events[i], now))
+            return false;
+          break;
+      }
+    }
+
+    handle_axes(events, deferred, deferred_count, now);
+    for (; recorded < count; ++recorded)
+      record_event(events[recorded], now);
+
+    return true;
+  }
+
+  void SDLMain::handle_axes(const SDL_Event* events, const int* indices, int count, uint64_t now)
+  {
+    // Walk backwards to find superseded values
+    pair<SDL_JoystickID, uint8_t> seen[BatchSize];
+    bool superseded[BatchSize];
+    int seen_count = 0;
+
+    for (int i = count - 1; i >= 0; --i) {
+      auto key = make_pair(events[indices[i]].caxis.which, events[indices[i]].caxis.axis);
+      superseded[i] = (find(seen, seen + seen_count, key) != seen + seen_count);
+      if (!superseded[i])
+        seen[seen_count++] = key;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      if (superseded[i])
+        ++m_batches.coalesced;
+      else
+        handle_event(events[indices[i]], now);
+    }
+  }
+
+  bool SDLMain::handle_event(const SDL_Event& evt, uint64_t now)
+  {
+    EventLog::Record record;
+
+    if (evt.type == m_dump_event) {
+      on_dump_stats();
+      return true;
+    }
+
+    switch (evt.type) {
+      case SDL_QUIT:
+        spdlog::info("Quitting");
+        return false;
+      case SDL_CONTROLLERDEVICEADDED:
+      {
+        string name = SDL_GameControllerNameForIndex(evt.cdevice.which);
+
+        spdlog::info("Controller {} added", name);
+
+        if (on_controller_added(name)) {
+          add_controller(new Controller(evt.cdevice.which));
+
+          if (m_recorder) {
+            record.which = m_controllers.back()->id();
+            record.type = EventLog::RecordType::DeviceAdded;
+            record.code = 0;
+            record.name = name;
+            m_recorder->write(record, now);
           }
+        }
+        break;
+      }
+      case SDL_CONTROLLERDEVICEREMOVED:
+        remove_controller(evt.cdevice.which);
+
+        if (m_recorder) {
+          record.which = evt.cdevice.which;
+          record.type = EventLog::RecordType::DeviceRemoved;
+          record.code = 0;
+          m_recorder->write(record, now);
+        }
+        break;
+      case SDL_CONTROLLERBUTTONUP:
+      case SDL_CONTROLLERBUTTONDOWN:
+        if (m_latency)
+          m_latency->begin(LatencyStats::EventType::Button, now);
+
+        if (Controller* ctrl = find_controller(evt.cbutton.which)) {
+          if (evt.type == SDL_CONTROLLERBUTTONDOWN)
+            ctrl->on_button_press(evt.cbutton.button);
+          else
+            ctrl->on_button_release(evt.cbutton.button);
+        }
+        break;
+      case SDL_CONTROLLERAXISMOTION:
+        if (m_latency)
+          m_latency->begin(LatencyStats::EventType::Axis, now);
+
+        if (Controller* ctrl = find_controller(evt.caxis.which))
+          ctrl->on_axis_motion(evt.caxis.axis, evt.caxis.value);
+        break;
+      case SDL_CONTROLLERSENSORUPDATE:
+        if (m_latency)
+          m_latency->begin(LatencyStats::EventType::Gyro, now);
+
+        dispatch_sensor(evt.csensor.which, evt.csensor.sensor, sensor_timestamp(evt.csensor, now), evt.csensor.data);
+        break;
+      case SDL_JOYDEVICEADDED:
+        if (!SDL_IsGameController(evt.jdevice.which)) {
+          spdlog::warn("Joystick {} added, but is not a game controller", SDL_JoystickNameForIndex(evt.jdevice.which));
+        }
+        break;
+      default:
+        break;
+    }
+
+    return true;
+  }
+
+  void SDLMain::record_event(const SDL_Event& evt, uint64_t now)
+  {
+    if (!m_recorder)
+      return;
+
+    EventLog::Record record;
+
+    switch (evt.type) {
+      case SDL_CONTROLLERBUTTONUP:
+      case SDL_CONTROLLERBUTTONDOWN:
+        record.which = evt.cbutton.which;
+        record.type = (evt.type == SDL_CONTROLLERBUTTONDOWN) ? EventLog::RecordType::ButtonDown : EventLog::RecordType::ButtonUp;
+        record.code = evt.cbutton.button;
+        break;
+      case SDL_CONTROLLERAXISMOTION:
+        record.which = evt.caxis.which;
+        record.type = EventLog::RecordType::AxisMotion;
+        record.code = evt.caxis.axis;
+        record.value = evt.caxis.value;
+        break;
+      case SDL_CONTROLLERSENSORUPDATE:
+        record.which = evt.csensor.which;
+        record.type = EventLog::RecordType::SensorUpdate;
+        record.code = evt.csensor.sensor;
+        record.sensor_timestamp = sensor_timestamp(evt.csensor, now);
+        for (unsigned i = 0; i < 3; ++i)
+          record.data[i] = evt.csensor.data[i];
+        break;
+      default:
+        return;
+    }
+
+    m_recorder->write(record, now);
+  }
+
+  void SDLMain::dispatch_sensor(SDL_JoystickID which, int sensor, uint64_t timestamp, const float* data)
+  {
+    Controller* ctrl = find_controller(which);
+    if (!ctrl)
+      return;
+
+    switch (sensor) {
+      case SDL_SENSOR_GYRO:
+        ctrl->on_gyro_update(timestamp, data[0], data[1], data[2]);
+        break;
+      case SDL_SENSOR_ACCEL:
+        ctrl->on_accel_update(timestamp, data[0], data[1], data[2]);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void SDLMain::replay()
+  {
+    EventLog::Record record;
+    uint64_t start = monotonic_ns();
+    unsigned count = 0;
+
+    spdlog::info("Replaying events {}", m_replay_realtime ? "in real time" : "as fast as possible");
+
+    while (m_replay->read(record)) {
+      if (m_replay_realtime) {
+        uint64_t deadline = start + record.time;
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000ULL;
+        ts.tv_nsec = deadline % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+          ;
+      }
+
+      // Still honor Ctrl-C and SIGUSR1, without pumping SDL for every record
+      if (m_replay_realtime || ((++count % 1024) == 0)) {
+        SDL_Event evt;
+        SDL_PumpEvents();
+        while (SDL_PeepEvents(&evt, 1, SDL_GETEVENT, SDL_QUIT, SDL_QUIT) > 0) {
+          if (!handle_event(evt, monotonic_ns()))
+            return;
+        }
+        while (SDL_PeepEvents(&evt, 1, SDL_GETEVENT, m_dump_event, m_dump_event) > 0)
+          handle_event(evt, monotonic_ns());
+      }
+
+      SDL_Event evt = {};
+      switch (record.type) {
+        case EventLog::RecordType::DeviceAdded:
+          open_controller(record.which, record.name);
+          continue;
+        case EventLog::RecordType::DeviceRemoved:
+          remove_controller(record.which);
+          continue;
+        case EventLog::RecordType::ButtonDown:
+        case EventLog::RecordType::ButtonUp:
+          evt.type = (record.type == EventLog::RecordType::ButtonDown) ? SDL_CONTROLLERBUTTONDOWN : SDL_CONTROLLERBUTTONUP;
+          evt.cbutton.which = record.which;
+          evt.cbutton.button = record.code;
           break;
-        default:
+        case EventLog::RecordType::AxisMotion:
+          evt.type = SDL_CONTROLLERAXISMOTION;
+          evt.caxis.which = record.which;
+          evt.caxis.axis = record.code;
+          evt.caxis.value = record.value;
           break;
+        case EventLog::RecordType::SensorUpdate:
+          // Not through an SDL event, which may not have room for the us timestamp
+          if (m_latency)
+            m_latency->begin(LatencyStats::EventType::Gyro, monotonic_ns());
+          dispatch_sensor(record.which, record.code, record.sensor_timestamp, record.data);
+          on_events_processed();
+          continue;
+        default:
+          continue;
+      }
+
+      uint64_t now = monotonic_ns();
+      record_event(evt, now);
+      handle_event(evt, now);
+      on_events_processed();
+    }
+
+    spdlog::info("End of replay");
+  }
+
+  void SDLMain::poll_sources()
+  {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+      throw runtime_error(fmt::format("Cannot create epoll instance: {}", strerror(errno)));
+
+    // Sources are indexed in the event data along with the descriptor
+    vector<InputSource*> sources;
+    struct epoll_event epevt = {};
+
+    epevt.events = EPOLLIN;
+    epevt.data.u64 = 0;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, m_wakeup_fd, &epevt);
+
+    for (auto& source : m_sources) {
+      source->start(*this);
+      sources.push_back(source.get());
+
+      for (int fd : source->fds()) {
+        epevt.events = EPOLLIN;
+        epevt.data.u64 = (static_cast<uint64_t>(sources.size()) << 32) | static_cast<uint32_t>(fd);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &epevt) < 0)
+          throw runtime_error(fmt::format("Cannot watch {} descriptor: {}", source->name(), strerror(errno)));
+      }
+
+      spdlog::info("Reading input from {}", source->name());
+    }
+
+    struct epoll_event events[16];
+    while (!m_quit_requested) {
+      int count = epoll_wait(epfd, events, 16, -1);
+      if (count < 0) {
+        if (errno == EINTR)
+          continue;
+        close(epfd);
+        throw runtime_error(fmt::format("epoll_wait failed: {}", strerror(errno)));
+      }
+
+      for (int i = 0; i < count; ++i) {
+        unsigned index = events[i].data.u64 >> 32;
+        int fd = static_cast<int>(events[i].data.u64 & 0xFFFFFFFFU);
+
+        if (index == 0) {
+          uint64_t value;
+          if (read(m_wakeup_fd, &value, sizeof(value)) < 0)
+            spdlog::warn("Cannot read wakeup counter: {}", strerror(errno));
+          if (m_dump_requested.exchange(false))
+            on_dump_stats();
+        } else {
+          sources[index - 1]->on_readable(*this, fd);
+        }
       }
+
+      on_events_processed();
     }
+
+    spdlog::info("Quitting");
+    close(epfd);
+  }
+
+  Controller* SDLMain::open_controller(SDL_JoystickID id, const string& name, const string& guid)
+  {
+    spdlog::info("Controller {} added", name);
+
+    if (!on_controller_added(name))
+      return nullptr;
+
+    Controller* ctrl = new Controller(id, name, guid);
+    add_controller(ctrl);
+
+    return ctrl;
+  }
+
+  void SDLMain::close_controller(SDL_JoystickID id)
+  {
+    remove_controller(id);
+  }
+
+  void SDLMain::add_controller(Controller* ctrl)
+  {
+    m_controllers.emplace_back(ctrl);
+    on_controller_open(*ctrl);
+
+    spdlog::info("Controller {} opened", ctrl->name());
+  }
+
+  void SDLMain::remove_controller(SDL_JoystickID id)
+  {
+    m_controllers.erase(
+      remove_if(m_controllers.begin(), m_controllers.end(), [&](const unique_ptr<Controller>& ctrl) {
+        if (ctrl->matches(id)) {
+          on_controller_close(*ctrl);
+          spdlog::info("Controller {} closed", ctrl->name());
+          return true;
+        }
+        return false;
+      }),
+      m_controllers.end()
+      );
+  }
+
+  Controller* SDLMain::find_controller(SDL_JoystickID id)
+  {
+    for (auto& ctrl : m_controllers) {
+      if (ctrl->matches(id))
+        return ctrl.get();
+    }
+
+    return nullptr;
   }
 }
@@ -2,16 +2,31 @@
 #ifndef _MSCTRL_SDLMAIN_H
 #define _MSCTRL_SDLMAIN_H
 
+#include <atomic>
 #include <list>
 #include <memory>
+#include <thread>
 
 #include <src/Controller.h>
+#include <src/LatencyHistogram.h>
+#include <src/EventLog.h>
+#include <src/InputSource.h>
 
 namespace MSCtrl
 {
   class SDLMain
   {
   public:
+    /**
+     * Counters for the events drained from the SDL queue at once
+     */
+    struct BatchCounters {
+      uint64_t batches;
+      uint64_t events;
+      uint64_t coalesced; // Axis values superseded within their batch
+      unsigned largest;
+    };
+
     SDLMain();
     virtual ~SDLMain();
 
@@ -20,8 +35,101 @@ namespace MSCtrl
     virtual bool on_controller_added(const std::string& name) = 0;
     virtual void on_controller_open(Controller&) = 0;
 
+    /**
+     * Called before a controller is deleted
+     */
+    virtual void on_controller_close(Controller&) {}
+
+    /**
+     * Called once all events of a batch have been handled; this is
+     * where buffered output should be committed.
+     */
+    virtual void on_events_processed() = 0;
+
+    /**
+     * Called on SIGUSR1 and when the loop exits
+     */
+    virtual void on_dump_stats() = 0;
+
+    /**
+     * Stamp each input event when it is dequeued (not owned)
+     */
+    void set_latency_stats(LatencyStats* stats) {
+      m_latency = stats;
+    }
+
+    /**
+     * Record all handled controller events to a file
+     */
+    void set_record_file(const std::string&);
+
+    /**
+     * Feed events from a recording instead of SDL
+     * @param realtime Replay with the recorded timing instead of as fast as possible
+     */
+    void set_replay_file(const std::string&, bool realtime);
+
+    /**
+     * Read controllers from an input frontend instead of SDL (takes ownership)
+     */
+    void add_input_source(InputSource*);
+
+    /**
+     * Create a controller without SDL device, for input frontends.
+     * Returns nullptr if on_controller_added() rejects it.
+     */
+    Controller* open_controller(SDL_JoystickID, const std::string& name, const std::string& guid = std::string());
+    void close_controller(SDL_JoystickID);
+
+    /**
+     * For input frontends that receive whole controller snapshots:
+     * commits what one of them changed (see on_events_processed()), so
+     * that a press and release in consecutive snapshots both reach
+     * the outputs
+     */
+    void commit_snapshot() {
+      on_events_processed();
+    }
+
+    /**
+     * Stamp an input event for latency statistics
+     * @param timestamp CLOCK_MONOTONIC time of the event in ns
+     */
+    void stamp_event(LatencyStats::EventType type, uint64_t timestamp) {
+      if (m_latency)
+        m_latency->begin(type, timestamp);
+    }
+
+    const BatchCounters& batch_counters() const {
+      return m_batches;
+    }
+
   private:
     std::list<std::unique_ptr<Controller>> m_controllers;
+    LatencyStats* m_latency;
+    std::atomic<uint32_t> m_dump_event;
+    std::atomic<bool> m_quit_requested;
+    std::atomic<bool> m_dump_requested;
+    std::atomic<bool> m_stopping;
+    int m_wakeup_fd;
+    std::thread m_signal_thread;
+    std::unique_ptr<EventLogWriter> m_recorder;
+    std::unique_ptr<EventLogReader> m_replay;
+    bool m_replay_realtime;
+    std::list<std::unique_ptr<InputSource>> m_sources;
+    BatchCounters m_batches;
+
+    bool handle_batch(const SDL_Event*, int count);
+    void handle_axes(const SDL_Event*, const int* indices, int count, uint64_t now);
+    bool handle_event(const SDL_Event&, uint64_t now);
+    void record_event(const SDL_Event&, uint64_t now);
+    void dispatch_sensor(SDL_JoystickID, int sensor, uint64_t timestamp, const float*);
+    void replay();
+    void poll_sources();
+
+    void add_controller(Controller*);
+    void remove_controller(SDL_JoystickID);
+    Controller* find_controller(SDL_JoystickID);
   };
 }
 
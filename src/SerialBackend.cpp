@@ -0,0 +1,259 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "SerialBackend.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // Writes queued while the link is this far behind are merged into
+  // the last one
+  const size_t MaxPending = 1024;
+
+  const uint64_t MaxDelay = 0xFFFF;
+
+  speed_t baudrate_constant(unsigned baudrate)
+  {
+    switch (baudrate) {
+      case 9600:
+        return B9600;
+      case 19200:
+        return B19200;
+      case 38400:
+        return B38400;
+      case 57600:
+        return B57600;
+      case 115200:
+        return B115200;
+      case 230400:
+        return B230400;
+      case 460800:
+        return B460800;
+      case 921600:
+        return B921600;
+      case 1000000:
+        return B1000000;
+      case 2000000:
+        return B2000000;
+    }
+
+    throw runtime_error(fmt::format("Unsupported baud rate {}", baudrate));
+  }
+
+  void put_u16(uint8_t* dst, uint16_t value)
+  {
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+  }
+
+  void put_u32(uint8_t* dst, uint32_t value)
+  {
+    for (unsigned index = 0; index < 4; ++index)
+      dst[index] = (value >> (index * 8)) & 0xFF;
+  }
+}
+
+namespace MSCtrl
+{
+  SerialBackend::SerialBackend(const string& device, unsigned baudrate)
+    : m_device(device),
+      m_fd(-1),
+      m_levels(0),
+      m_lock(),
+      m_wakeup(),
+      m_pending(),
+      m_overflow(false),
+      m_stopping(false),
+      m_sending(),
+      m_sequence(0),
+      m_last_step(0),
+      m_writer()
+  {
+    speed_t speed = baudrate_constant(baudrate);
+
+    m_fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (m_fd < 0)
+      throw runtime_error(fmt::format("Cannot open {}: {}", device, strerror(errno)));
+
+    struct termios tio;
+    if (tcgetattr(m_fd, &tio) < 0) {
+      int error = errno;
+      close(m_fd);
+      throw runtime_error(fmt::format("{} is not a serial device: {}", device, strerror(error)));
+    }
+
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, speed);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (tcsetattr(m_fd, TCSANOW, &tio) < 0) {
+      int error = errno;
+      close(m_fd);
+      throw runtime_error(fmt::format("Cannot configure {}: {}", device, strerror(error)));
+    }
+
+    m_pending.reserve(MaxPending);
+    m_sending.reserve(MaxPending);
+
+    spdlog::info("Serial device {} opened at {} bauds", device, baudrate);
+  }
+
+  SerialBackend::~SerialBackend()
+  {
+    if (m_writer.joinable()) {
+      {
+        lock_guard<mutex> lock(m_lock);
+        m_stopping = true;
+      }
+      m_wakeup.notify_one();
+      m_writer.join();
+    }
+
+    tcdrain(m_fd);
+    close(m_fd);
+  }
+
+  SerialBackend* SerialBackend::create(const string& spec)
+  {
+    if (spec.empty())
+      throw runtime_error("The serial backend needs a device, as in serial:/dev/ttyACM0");
+
+    auto sep = spec.find('@');
+    if (sep == string::npos)
+      return new SerialBackend(spec);
+
+    string baudrate = spec.substr(sep + 1);
+    if (baudrate.empty() || (baudrate.find_first_not_of("0123456789") != string::npos))
+      throw runtime_error(fmt::format("Invalid baud rate \"{}\"", baudrate));
+
+    return new SerialBackend(spec.substr(0, sep), stoul(baudrate));
+  }
+
+  void SerialBackend::open(uint32_t pins)
+  {
+    if (m_writer.joinable())
+      throw runtime_error("Serial device already opened");
+
+    uint8_t payload[4];
+    put_u32(payload, pins);
+    send(FrameType::Open, payload, sizeof(payload));
+
+    m_writer = thread(&SerialBackend::run, this);
+  }
+
+  void SerialBackend::write(uint32_t set, uint32_t clear)
+  {
+    uint64_t now = monotonic_ns();
+
+    {
+      lock_guard<mutex> lock(m_lock);
+
+      // The writer thread gave up
+      if (m_stopping)
+        return;
+
+      m_levels = (m_levels | set) & ~clear;
+
+      if (m_pending.size() < MaxPending) {
+        m_pending.push_back({ now, m_levels });
+      } else {
+        m_pending.back().levels = m_levels;
+        if (!m_overflow)
+          spdlog::warn("Serial link to {} too slow, merging output changes", m_device);
+        m_overflow = true;
+      }
+    }
+
+    m_wakeup.notify_one();
+  }
+
+  uint8_t SerialBackend::crc8(const uint8_t* data, size_t length)
+  {
+    uint8_t crc = 0;
+
+    while (length--) {
+      crc ^= *data++;
+      for (unsigned bit = 0; bit < 8; ++bit)
+        crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+    }
+
+    return crc;
+  }
+
+  void SerialBackend::run()
+  {
+    unique_lock<mutex> lock(m_lock);
+
+    while (true) {
+      m_wakeup.wait(lock, [this]() { return m_stopping || !m_pending.empty(); });
+      if (m_pending.empty())
+        break;
+
+      // Everything queued so far goes out in as few frames as possible
+      m_sending.swap(m_pending);
+      lock.unlock();
+
+      try {
+        for (size_t first = 0; first < m_sending.size(); first += MaxSteps) {
+          uint8_t payload[MaxSteps * StepSize];
+          unsigned count = min<size_t>(MaxSteps, m_sending.size() - first);
+
+          for (unsigned index = 0; index < count; ++index) {
+            const Step& step = m_sending[first + index];
+
+            // Quantize the times rather than the intervals, so that
+            // rounding does not accumulate
+            uint64_t time = step.time / 1000;
+            put_u16(payload + index * StepSize, min(time - m_last_step, MaxDelay));
+            put_u32(payload + index * StepSize + 2, step.levels);
+            m_last_step = time;
+          }
+
+          send(FrameType::Steps, payload, count * StepSize);
+        }
+      } catch (const exception& exc) {
+        spdlog::error("Serial backend stopped: {}", exc.what());
+        lock.lock();
+        m_stopping = true;
+        break;
+      }
+
+      m_sending.clear();
+      lock.lock();
+    }
+  }
+
+  void SerialBackend::send(FrameType type, const uint8_t* payload, unsigned length)
+  {
+    uint8_t frame[MaxFrameSize];
+
+    frame[0] = Sync;
+    frame[1] = type;
+    frame[2] = m_sequence++;
+    frame[3] = length;
+    memcpy(frame + HeaderSize, payload, length);
+    frame[HeaderSize + length] = crc8(frame + 1, HeaderSize - 1 + length);
+
+    size_t size = HeaderSize + length + 1, offset = 0;
+    while (offset < size) {
+      ssize_t count = ::write(m_fd, frame + offset, size - offset);
+      if (count < 0) {
+        if (errno == EINTR)
+          continue;
+        throw runtime_error(fmt::format("Cannot write to {}: {}", m_device, strerror(errno)));
+      }
+      offset += count;
+    }
+  }
+}
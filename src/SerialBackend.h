@@ -0,0 +1,96 @@
+
+#ifndef _MSCTRL_SERIALBACKEND_H
+#define _MSCTRL_SERIALBACKEND_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  /**
+   * Sends output levels over a serial or USB-CDC link to a
+   * microcontroller that drives the DE-9 pins. Each frame is
+   *   0xA5, type, sequence, payload length, payload, CRC-8
+   * with the CRC (polynomial 0x07) computed from the type to the end
+   * of the payload, and little endian integers in the payload:
+   *   Open (1): uint32 mask of the output GPIOs
+   *   Steps (2): up to 42 (uint16 delay in us, uint32 levels); the
+   *     device applies each levels word that long after the previous
+   *     one, or right away if that time has already passed.
+   * A writer thread batches the writes made while the link is busy
+   * into a single Steps frame with their original spacing, so the
+   * device reproduces the timing even though msctrl does not meet
+   * microsecond deadlines. The sequence number increments with each
+   * frame so that the device can detect lost ones; levels are
+   * absolute, so the next frame corrects them.
+   */
+  class SerialBackend : public OutputBackend
+  {
+  public:
+    enum FrameType : uint8_t {
+      Open = 1,
+      Steps = 2
+    };
+
+    static constexpr uint8_t Sync = 0xA5;
+    static constexpr unsigned HeaderSize = 4;
+    static constexpr unsigned StepSize = 6;
+    static constexpr unsigned MaxSteps = 42;
+    static constexpr unsigned MaxFrameSize = HeaderSize + MaxSteps * StepSize + 1;
+
+    /**
+     * @param device Serial device path (/dev/ttyACM0)
+     * @param baudrate Ignored by USB-CDC devices
+     */
+    SerialBackend(const std::string& device, unsigned baudrate = 115200);
+    ~SerialBackend();
+
+    SerialBackend(const SerialBackend&) = delete;
+    SerialBackend& operator=(const SerialBackend&) = delete;
+
+    std::string name() const override {
+      return "serial";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+
+    /**
+     * Parse "path[@baudrate]"
+     */
+    static SerialBackend* create(const std::string&);
+
+    static uint8_t crc8(const uint8_t*, size_t);
+
+  private:
+    struct Step {
+      uint64_t time;
+      uint32_t levels;
+    };
+
+    std::string m_device;
+    int m_fd;
+    uint32_t m_levels;
+
+    std::mutex m_lock;
+    std::condition_variable m_wakeup;
+    std::vector<Step> m_pending;
+    bool m_overflow;
+    bool m_stopping;
+
+    // Writer thread state
+    std::vector<Step> m_sending;
+    uint8_t m_sequence;
+    uint64_t m_last_step;
+    std::thread m_writer;
+
+    void run();
+    void send(FrameType, const uint8_t*, unsigned);
+  };
+}
+
+#endif /* _MSCTRL_SERIALBACKEND_H */
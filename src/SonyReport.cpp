@@ -0,0 +1,235 @@
+
+#include <array>
+#include <cmath>
+#include <cstdlib>
+
+#include <SDL2/SDL.h>
+
+#include "SonyReport.h"
+
+using namespace std;
+
+namespace
+{
+  const uint8_t USBReport = 0x01;
+  const size_t USBReportSize = 64;
+  const uint8_t DS4BluetoothReport = 0x11;
+  const uint8_t DualSenseBluetoothReport = 0x31;
+  const size_t BluetoothReportSize = 78;
+  const size_t CalibrationSize = 35;
+
+  const float StandardGravity = 9.80665f;
+
+  // Typical resolutions of both pads: 16 units per deg/s, 8192 per g
+  const float GyroResolution = 16.0f;
+  const float AccelResolution = 8192.0f;
+
+  // CRC-32 (reflected 0x04C11DB7), a byte at a time
+  constexpr array<uint32_t, 256> crc32_table()
+  {
+    array<uint32_t, 256> table = {};
+
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      uint32_t crc = byte;
+      for (unsigned bit = 0; bit < 8; ++bit)
+        crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+      table[byte] = crc;
+    }
+
+    return table;
+  }
+
+  constexpr array<uint32_t, 256> CRC32Table = crc32_table();
+
+  int16_t get_s16(const uint8_t* src)
+  {
+    return static_cast<int16_t>(src[0] | (src[1] << 8));
+  }
+
+  uint32_t get_u32(const uint8_t* src)
+  {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+  }
+
+  int16_t stick(uint8_t value)
+  {
+    return static_cast<int16_t>(65535L * value / 255 - 32768);
+  }
+
+  int16_t trigger(uint8_t value)
+  {
+    return static_cast<int16_t>(32767L * value / 255);
+  }
+
+  uint32_t bit(SDL_GameControllerButton btn)
+  {
+    return 1U << btn;
+  }
+
+  // D-pad positions, clockwise from up
+  const uint32_t Hat[8] = {
+    bit(SDL_CONTROLLER_BUTTON_DPAD_UP),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_UP) | bit(SDL_CONTROLLER_BUTTON_DPAD_RIGHT),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_RIGHT),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_DOWN) | bit(SDL_CONTROLLER_BUTTON_DPAD_RIGHT),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_DOWN),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_DOWN) | bit(SDL_CONTROLLER_BUTTON_DPAD_LEFT),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_LEFT),
+    bit(SDL_CONTROLLER_BUTTON_DPAD_UP) | bit(SDL_CONTROLLER_BUTTON_DPAD_LEFT)
+  };
+
+  // Both pads use the same three bytes, in a different place; the rest
+  // of the third one is a report counter on the DualShock 4
+  uint32_t buttons(const uint8_t* src, bool mute)
+  {
+    uint32_t result = ((src[0] & 0x0F) < 8) ? Hat[src[0] & 0x0F] : 0;
+
+    const struct {
+      unsigned byte;
+      uint8_t mask;
+      SDL_GameControllerButton btn;
+    } Buttons[] = {
+      { 0, 0x10, SDL_CONTROLLER_BUTTON_X },
+      { 0, 0x20, SDL_CONTROLLER_BUTTON_A },
+      { 0, 0x40, SDL_CONTROLLER_BUTTON_B },
+      { 0, 0x80, SDL_CONTROLLER_BUTTON_Y },
+      { 1, 0x01, SDL_CONTROLLER_BUTTON_LEFTSHOULDER },
+      { 1, 0x02, SDL_CONTROLLER_BUTTON_RIGHTSHOULDER },
+      { 1, 0x10, SDL_CONTROLLER_BUTTON_BACK },
+      { 1, 0x20, SDL_CONTROLLER_BUTTON_START },
+      { 1, 0x40, SDL_CONTROLLER_BUTTON_LEFTSTICK },
+      { 1, 0x80, SDL_CONTROLLER_BUTTON_RIGHTSTICK },
+      { 2, 0x01, SDL_CONTROLLER_BUTTON_GUIDE },
+      { 2, 0x02, SDL_CONTROLLER_BUTTON_TOUCHPAD }
+    };
+
+    for (const auto& entry : Buttons) {
+      if (src[entry.byte] & entry.mask)
+        result |= bit(entry.btn);
+    }
+
+    if (mute && (src[2] & 0x04))
+      result |= bit(SDL_CONTROLLER_BUTTON_MISC1);
+
+    return result;
+  }
+}
+
+namespace MSCtrl
+{
+  bool SonyReport::decode(Model model, const Calibration& calibration, const uint8_t* data, size_t size)
+  {
+    size_t offset;
+
+    if ((data[0] == USBReport) && (size >= USBReportSize)) {
+      offset = 1;
+    } else if ((size >= BluetoothReportSize) &&
+               (((model == Model::DualShock4) && (data[0] == DS4BluetoothReport)) ||
+                ((model == Model::DualSense) && (data[0] == DualSenseBluetoothReport)))) {
+      if (crc32(0xA1, data, BluetoothReportSize - 4) != get_u32(data + BluetoothReportSize - 4))
+        return false;
+      offset = (model == Model::DualShock4) ? 3 : 2;
+    } else {
+      return false;
+    }
+
+    const uint8_t* src = data + offset;
+    const uint8_t *triggers, *sensors;
+
+    if (model == Model::DualShock4) {
+      buttons = ::buttons(src + 4, false);
+      triggers = src + 7;
+      timestamp = src[9] | (src[10] << 8);
+      sensors = src + 12;
+    } else {
+      buttons = ::buttons(src + 7, true);
+      triggers = src + 4;
+      timestamp = get_u32(src + 27);
+      sensors = src + 15;
+    }
+
+    for (unsigned axis = 0; axis < 4; ++axis)
+      axes[axis] = stick(src[axis]);
+    axes[SDL_CONTROLLER_AXIS_TRIGGERLEFT] = trigger(triggers[0]);
+    axes[SDL_CONTROLLER_AXIS_TRIGGERRIGHT] = trigger(triggers[1]);
+
+    for (unsigned axis = 0; axis < 3; ++axis) {
+      gyro[axis] = (get_s16(sensors + 2 * axis) - calibration.gyro_bias[axis]) * calibration.gyro_scale[axis];
+      accel[axis] = (get_s16(sensors + 6 + 2 * axis) - calibration.accel_bias[axis]) * calibration.accel_scale[axis];
+    }
+
+    return true;
+  }
+
+  uint64_t SonyReport::elapsed_ticks(Model model, uint32_t from, uint32_t to)
+  {
+    return (model == Model::DualShock4) ? static_cast<uint16_t>(to - from) : static_cast<uint32_t>(to - from);
+  }
+
+  uint64_t SonyReport::ticks_to_us(Model model, uint64_t ticks)
+  {
+    return (model == Model::DualShock4) ? (ticks * 16 / 3) : (ticks / 3);
+  }
+
+  SonyReport::Calibration SonyReport::default_calibration()
+  {
+    Calibration result;
+
+    for (unsigned axis = 0; axis < 3; ++axis) {
+      result.gyro_bias[axis] = 0.0f;
+      result.gyro_scale[axis] = M_PI / 180 / GyroResolution;
+      result.accel_bias[axis] = 0.0f;
+      result.accel_scale[axis] = StandardGravity / AccelResolution;
+    }
+
+    return result;
+  }
+
+  bool SonyReport::parse_calibration(bool interleaved, const uint8_t* data, size_t size, Calibration& result)
+  {
+    if (size < CalibrationSize)
+      return false;
+
+    // Same computation as the kernel's hid-playstation
+    float speed_2x = get_s16(data + 19) + get_s16(data + 21);
+    Calibration calibration;
+
+    for (unsigned axis = 0; axis < 3; ++axis) {
+      int bias = get_s16(data + 1 + 2 * axis);
+      int plus = get_s16(data + (interleaved ? 7 + 2 * axis : 7 + 4 * axis));
+      int minus = get_s16(data + (interleaved ? 13 + 2 * axis : 9 + 4 * axis));
+      int range = abs(plus - bias) + abs(minus - bias);
+
+      // Clones often return garbage: only accept something close to
+      // the nominal resolution
+      float resolution = range / speed_2x;
+      if ((range == 0) || (speed_2x <= 0.0f) || (resolution < GyroResolution / 2) || (resolution > GyroResolution * 2))
+        return false;
+
+      calibration.gyro_bias[axis] = bias;
+      calibration.gyro_scale[axis] = M_PI / 180 / resolution;
+
+      int accel_plus = get_s16(data + 23 + 4 * axis);
+      int accel_minus = get_s16(data + 25 + 4 * axis);
+      int range_2g = accel_plus - accel_minus;
+      if ((range_2g < AccelResolution) || (range_2g > AccelResolution * 4))
+        return false;
+
+      calibration.accel_bias[axis] = accel_plus - range_2g / 2.0f;
+      calibration.accel_scale[axis] = 2 * StandardGravity / range_2g;
+    }
+
+    result = calibration;
+    return true;
+  }
+
+  uint32_t SonyReport::crc32(uint8_t seed, const uint8_t* data, size_t size)
+  {
+    uint32_t crc = (0xFFFFFFFF >> 8) ^ CRC32Table[(0xFFFFFFFF ^ seed) & 0xFF];
+
+    while (size--)
+      crc = (crc >> 8) ^ CRC32Table[(crc ^ *data++) & 0xFF];
+
+    return ~crc;
+  }
+}
@@ -0,0 +1,76 @@
+
+#ifndef _MSCTRL_SONYREPORT_H
+#define _MSCTRL_SONYREPORT_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace MSCtrl
+{
+  /**
+   * Decoded input report of a DualShock 4 or DualSense, as read from
+   * hidraw (USB report 0x01, Bluetooth reports 0x11 and 0x31). Every
+   * report carries the whole controller state; buttons and axes use
+   * the SDL codes and ranges, sensors are in rad/s and m/s^2 after
+   * the factory calibration. Decoding does not allocate.
+   */
+  struct SonyReport
+  {
+    enum class Model {
+      DualShock4,
+      DualSense
+    };
+
+    struct Calibration {
+      float gyro_bias[3];
+      float gyro_scale[3];
+      float accel_bias[3];
+      float accel_scale[3];
+    };
+
+    static constexpr unsigned AxisCount = 6;
+
+    uint32_t buttons; // Bit n is SDL_CONTROLLER_BUTTON n
+    int16_t axes[AxisCount];
+    float gyro[3];
+    float accel[3];
+    uint32_t timestamp; // Sensor clock ticks, see elapsed_ticks()
+
+    /**
+     * @return false if this is not a full input report (or its
+     * checksum is wrong)
+     */
+    bool decode(Model, const Calibration&, const uint8_t* data, size_t size);
+
+    /**
+     * Time between two sensor timestamps, accounting for the wrap
+     * around (16 bits of 16/3 us for the DualShock 4, 32 bits of
+     * 1/3 us for the DualSense)
+     */
+    static uint64_t elapsed_ticks(Model, uint32_t from, uint32_t to);
+    static uint64_t ticks_to_us(Model, uint64_t ticks);
+
+    /**
+     * Nominal sensor resolutions, when the pad does not provide its
+     * calibration
+     */
+    static Calibration default_calibration();
+
+    /**
+     * Parse the calibration feature report (0x02 for a DualShock 4 on
+     * USB, 0x05 otherwise)
+     * @param interleaved DualShock 4 on Bluetooth or through its USB
+     * dongle, which orders the gyro ranges differently
+     * @return false if the report is invalid
+     */
+    static bool parse_calibration(bool interleaved, const uint8_t* data, size_t size, Calibration&);
+
+    /**
+     * Bluetooth input reports end with the CRC-32 of 0xA1 followed by
+     * the report
+     */
+    static uint32_t crc32(uint8_t seed, const uint8_t* data, size_t size);
+  };
+}
+
+#endif /* _MSCTRL_SONYREPORT_H */
@@ -0,0 +1,191 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "SportsPad.h"
+
+using namespace std;
+
+namespace
+{
+  // A read is four edges a few us apart; anything slower is a new one
+  const uint64_t EdgeTimeout = 1000000;
+
+  // Longest interval the stick speed is integrated over
+  const uint64_t MaxLatchInterval = 100000000;
+
+  const float StickDeadzone = 0.1f;
+
+  float stick_speed(float value)
+  {
+    if (fabsf(value) < StickDeadzone)
+      return 0.0f;
+    return copysignf((fabsf(value) - StickDeadzone) / (1.0f - StickDeadzone), value);
+  }
+
+  int8_t take_counts(float& residual)
+  {
+    float counts = min(max(truncf(residual), -128.0f), 127.0f);
+    residual = min(max(residual - counts, -127.0f), 127.0f);
+    return static_cast<int8_t>(counts);
+  }
+}
+
+namespace MSCtrl
+{
+  SportsPad::SportsPad(MasterSystem& ms, Source source)
+    : PortResponder(ms, MasterSystem::DataButtons, "Sports Pad"),
+      m_source(source),
+      m_speed((source == Source::Gyro) ? 400.0f : 1200.0f),
+      m_velocity_x(0.0f),
+      m_velocity_y(0.0f),
+      m_motion_x(0),
+      m_motion_y(0),
+      m_gyro_ctrl(nullptr),
+      m_last_yaw(0.0f),
+      m_last_pitch(0.0f),
+      m_index(0),
+      m_last_edge(0),
+      m_last_latch(0),
+      m_residual_x(0.0f),
+      m_residual_y(0.0f),
+      m_dx(0),
+      m_dy(0),
+      m_output(MasterSystem::nibble_buttons(0))
+  {
+  }
+
+  SportsPad::~SportsPad()
+  {
+    stop();
+  }
+
+  void SportsPad::set_speed(float speed)
+  {
+    if (speed <= 0.0f)
+      throw runtime_error(fmt::format("Sports Pad speed {} is not positive", speed));
+
+    m_speed = speed;
+  }
+
+  void SportsPad::add_to(Controller& ctrl)
+  {
+    spdlog::info("Add Sports Pad mapping of {} to {}; speed={:.0f}", source_name(m_source), ctrl.name(), m_speed);
+
+    Controller::Listener::add_to(ctrl);
+
+    if (m_source == Source::Gyro)
+      ctrl.request_gyro();
+  }
+
+  void SportsPad::on_axis_motion(Controller& ctrl, Controller::Axis axis, float value)
+  {
+    bool left = (m_source == Source::Left);
+
+    if (axis == (left ? Controller::Axis::LeftX : Controller::Axis::RightX))
+      m_velocity_x.store(stick_speed(value) * m_speed, memory_order_relaxed);
+    else if (axis == (left ? Controller::Axis::LeftY : Controller::Axis::RightY))
+      m_velocity_y.store(stick_speed(value) * m_speed, memory_order_relaxed);
+  }
+
+  void SportsPad::on_gyro_update(Controller& ctrl, uint64_t, float, float, float)
+  {
+    // Use the integrated (bias-corrected) angles; turning left and
+    // tilting up are positive.
+    float yaw = ctrl.imu().angle(IMUIntegrator::Z);
+    float pitch = ctrl.imu().angle(IMUIntegrator::X);
+
+    if (&ctrl == m_gyro_ctrl)
+      add_motion((m_last_yaw - yaw) * m_speed, (m_last_pitch - pitch) * m_speed);
+
+    m_gyro_ctrl = &ctrl;
+    m_last_yaw = yaw;
+    m_last_pitch = pitch;
+  }
+
+  void SportsPad::add_motion(float dx, float dy)
+  {
+    m_motion_x.fetch_add(lroundf(dx * SubCounts), memory_order_relaxed);
+    m_motion_y.fetch_add(lroundf(dy * SubCounts), memory_order_relaxed);
+  }
+
+  void SportsPad::latch(uint64_t now)
+  {
+    float dt = min(now - m_last_latch, MaxLatchInterval) / 1e9f;
+    m_last_latch = now;
+
+    m_residual_x += m_motion_x.exchange(0, memory_order_relaxed) / SubCounts + m_velocity_x.load(memory_order_relaxed) * dt;
+    m_residual_y += m_motion_y.exchange(0, memory_order_relaxed) / SubCounts + m_velocity_y.load(memory_order_relaxed) * dt;
+
+    m_dx = take_counts(m_residual_x);
+    m_dy = take_counts(m_residual_y);
+  }
+
+  uint8_t SportsPad::respond(bool th, bool edge, uint64_t now)
+  {
+    if (!edge)
+      return m_output;
+
+    bool idle = (now - m_last_edge > EdgeTimeout);
+    m_last_edge = now;
+
+    if (idle) {
+      // Reads start with TH going low
+      m_index = 0;
+      if (th)
+        return m_output;
+    }
+
+    uint8_t nibble = 0;
+    switch (m_index) {
+      case 0:
+        latch(now);
+        nibble = static_cast<uint8_t>(m_dx) >> 4;
+        break;
+      case 1:
+        nibble = static_cast<uint8_t>(m_dx) & 0x0F;
+        break;
+      case 2:
+        nibble = static_cast<uint8_t>(m_dy) >> 4;
+        break;
+      case 3:
+        nibble = static_cast<uint8_t>(m_dy) & 0x0F;
+        break;
+    }
+
+    m_index = (m_index + 1) % 4;
+    m_output = MasterSystem::nibble_buttons(nibble);
+
+    return m_output;
+  }
+
+  SportsPad::Source SportsPad::source_from_name(const string& name)
+  {
+    if (name == "L")
+      return Source::Left;
+    if (name == "R")
+      return Source::Right;
+    if (name == "gyro")
+      return Source::Gyro;
+
+    throw runtime_error(fmt::format("Invalid Sports Pad source \"{}\"", name));
+  }
+
+  string SportsPad::source_name(Source source)
+  {
+    switch (source) {
+      case Source::Left:
+        return "L";
+      case Source::Right:
+        return "R";
+      case Source::Gyro:
+        return "gyro";
+    }
+
+    return "Unknown";
+  }
+}
@@ -0,0 +1,88 @@
+
+#ifndef _MSCTRL_SPORTSPAD_H
+#define _MSCTRL_SPORTSPAD_H
+
+#include <atomic>
+#include <string>
+
+#include <src/PortResponder.h>
+
+namespace MSCtrl
+{
+  /**
+   * Sports Pad (trackball) emulation. Each read by the console is four
+   * TH edges, starting with TH going low: high then low nibble of the
+   * X motion since the previous read, then the same for Y, as signed
+   * bytes on D0 to D3. The motion comes from a stick (speed
+   * proportional to the deflection) or from the gyro (yaw and pitch).
+   * Both buttons stay regular button mappings.
+   */
+  class SportsPad : public PortResponder
+  {
+  public:
+    enum class Source {
+      Left,
+      Right,
+      Gyro
+    };
+
+    SportsPad(MasterSystem&, Source);
+    ~SportsPad();
+
+    /**
+     * @param speed Counts per second at full stick deflection (default
+     * 1200), or counts per radian for the gyro (default 400)
+     */
+    void set_speed(float speed);
+
+    unsigned subscriptions() const override {
+      return (m_source == Source::Gyro) ? GyroEvents : AxisEvents;
+    }
+
+    void add_to(Controller&) override;
+    void on_axis_motion(Controller&, Controller::Axis, float) override;
+    void on_gyro_update(Controller&, uint64_t, float, float, float) override;
+
+    /**
+     * Add relative motion, in counts; for the stick, this is on top of
+     * its speed
+     */
+    void add_motion(float dx, float dy);
+
+    static Source source_from_name(const std::string&);
+    static std::string source_name(Source);
+
+  protected:
+    uint8_t respond(bool, bool, uint64_t) override;
+
+  private:
+    // Fixed-point motion accumulator resolution
+    static constexpr float SubCounts = 256.0f;
+
+    Source m_source;
+    float m_speed;
+
+    // Written by the event loop
+    std::atomic<float> m_velocity_x;
+    std::atomic<float> m_velocity_y;
+    std::atomic<int32_t> m_motion_x;
+    std::atomic<int32_t> m_motion_y;
+    const Controller* m_gyro_ctrl;
+    float m_last_yaw;
+    float m_last_pitch;
+
+    // Responder thread state
+    unsigned m_index;
+    uint64_t m_last_edge;
+    uint64_t m_last_latch;
+    float m_residual_x;
+    float m_residual_y;
+    int8_t m_dx;
+    int8_t m_dy;
+    uint8_t m_output;
+
+    void latch(uint64_t);
+  };
+}
+
+#endif /* _MSCTRL_SPORTSPAD_H */
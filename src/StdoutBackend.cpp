@@ -0,0 +1,17 @@
+
+#include <spdlog/spdlog.h>
+
+#include "StdoutBackend.h"
+
+namespace MSCtrl
+{
+  void StdoutBackend::open(uint32_t pins)
+  {
+    spdlog::info("GPIO disabled; output mask {:#010x}", pins);
+  }
+
+  void StdoutBackend::write(uint32_t set, uint32_t clear)
+  {
+    spdlog::info("Set GPIO mask {:#010x}, clear GPIO mask {:#010x}", set, clear);
+  }
+}
@@ -0,0 +1,24 @@
+
+#ifndef _MSCTRL_STDOUTBACKEND_H
+#define _MSCTRL_STDOUTBACKEND_H
+
+#include <src/OutputBackend.h>
+
+namespace MSCtrl
+{
+  /**
+   * Stub backend that only logs output changes
+   */
+  class StdoutBackend : public OutputBackend
+  {
+  public:
+    std::string name() const override {
+      return "stdout";
+    }
+
+    void open(uint32_t) override;
+    void write(uint32_t, uint32_t) override;
+  };
+}
+
+#endif /* _MSCTRL_STDOUTBACKEND_H */
@@ -0,0 +1,150 @@
+
+#include <stdexcept>
+#include <cmath>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "TiltMap.h"
+
+using namespace std;
+
+namespace
+{
+  // Weight of the integrated gyro in the complementary filter, per
+  // accelerometer sample
+  const float GyroWeight = 0.98f;
+}
+
+namespace MSCtrl
+{
+  TiltMap::TiltMap(MasterSystem& ms, GyroMap::Axis axis, MasterSystem::Button btn, TiltMap::Mode mode)
+    : m_ms(ms),
+      m_axis(axis),
+      m_button(btn),
+      m_mode(mode),
+      m_button_state(false),
+      m_threshold(20.0f * M_PI / 180),
+      m_angle_delta(3.0f * M_PI / 180),
+      m_angle(0.0f),
+      m_has_angle(false),
+      m_last_gyro_angle(0.0f),
+      m_has_gyro_angle(false),
+      m_trigger_buttons(0),
+      m_pressed_buttons(0)
+  {
+    if ((axis == GyroMap::Axis::PosY) || (axis == GyroMap::Axis::NegY))
+      throw runtime_error("Tilt around the Y axis cannot be measured from the accelerometer");
+  }
+
+  void TiltMap::add_trigger_button(Controller::Button btn)
+  {
+    m_trigger_buttons |= Controller::button_bit(btn);
+  }
+
+  void TiltMap::set_angle_threshold(float threshold)
+  {
+    m_threshold = threshold * M_PI / 180;
+  }
+
+  void TiltMap::set_angle_delta(float delta)
+  {
+    if (delta < 0)
+      throw runtime_error(fmt::format("Angle delta {} is negative", delta));
+
+    m_angle_delta = delta * M_PI / 180;
+  }
+
+  void TiltMap::add_to(Controller& ctrl)
+  {
+    spdlog::info("Add tilt mapping to {}; axis={}, mode={}, threshold={:.2f}, hysteresis={:.2f}", ctrl.name(), GyroMap::axis_name(m_axis), mode_name(m_mode), m_threshold, m_angle_delta);
+
+    Controller::Listener::add_to(ctrl);
+
+    ctrl.request_accel();
+    if (m_mode == Mode::Fused)
+      ctrl.request_gyro();
+  }
+
+  void TiltMap::on_button_state(Controller& ctrl, Controller::Button btn, bool state)
+  {
+    uint16_t bit = Controller::button_bit(btn);
+    if ((m_trigger_buttons & bit) == 0)
+      return;
+
+    m_pressed_buttons = state ? (m_pressed_buttons | bit) : (m_pressed_buttons & ~bit);
+
+    // No reference to take, the angle is absolute
+    update_button(ctrl);
+  }
+
+  void TiltMap::on_gyro_update(Controller& ctrl, uint64_t, float, float, float)
+  {
+    // The controller's integrator already handles the sample timing,
+    // the bias and the periods when the gyro was off; only its change
+    // since the previous sample is used
+    bool x = (m_axis == GyroMap::Axis::PosX) || (m_axis == GyroMap::Axis::NegX);
+    float gyro_angle = ctrl.imu().angle(x ? IMUIntegrator::X : IMUIntegrator::Z);
+
+    if (m_has_angle && m_has_gyro_angle)
+      m_angle += gyro_angle - m_last_gyro_angle;
+
+    m_last_gyro_angle = gyro_angle;
+    m_has_gyro_angle = true;
+  }
+
+  void TiltMap::on_accel_update(Controller& ctrl, uint64_t, float ax, float ay, float az)
+  {
+    // Gravity reads as +Y when the controller lies flat; rotating it
+    // by a positive angle around X or Z moves it towards -Z or +X.
+    bool x = (m_axis == GyroMap::Axis::PosX) || (m_axis == GyroMap::Axis::NegX);
+    float angle = x ? atan2f(-az, ay) : atan2f(ax, ay);
+
+    if ((m_mode == Mode::Fused) && m_has_angle)
+      m_angle = GyroWeight * m_angle + (1.0f - GyroWeight) * angle;
+    else
+      m_angle = angle;
+    m_has_angle = true;
+
+    update_button(ctrl);
+  }
+
+  void TiltMap::update_button(Controller& ctrl)
+  {
+    bool enabled = m_has_angle && (m_pressed_buttons == m_trigger_buttons);
+    bool negative = (m_axis == GyroMap::Axis::NegX) || (m_axis == GyroMap::Axis::NegZ);
+    float angle = negative ? -m_angle : m_angle;
+
+    if (m_button_state && (!enabled || (angle <= m_threshold - m_angle_delta))) {
+      spdlog::debug("Tilt release of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), GyroMap::axis_name(m_axis), m_angle);
+      m_ms.set_button_state(m_button, false);
+      m_button_state = false;
+    } else if (!m_button_state && enabled && (angle >= m_threshold)) {
+      spdlog::debug("Tilt press of {} on {} ({}) at {:.2f}", MasterSystem::button_name(m_button), ctrl.name(), GyroMap::axis_name(m_axis), m_angle);
+      m_ms.set_button_state(m_button, true);
+      m_button_state = true;
+    }
+  }
+
+  string TiltMap::mode_name(TiltMap::Mode mode)
+  {
+    switch (mode) {
+      case Mode::Accel:
+        return "tilt";
+      case Mode::Fused:
+        return "fused";
+    }
+
+    return "UNK";
+  }
+
+  TiltMap::Mode TiltMap::mode_from_name(const string& name)
+  {
+    if (name == "tilt")
+      return Mode::Accel;
+    if (name == "fused")
+      return Mode::Fused;
+
+    throw runtime_error(fmt::format("Invalid gyro mode \"{}\"", name));
+  }
+}
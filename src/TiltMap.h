@@ -0,0 +1,78 @@
+
+#ifndef _MSCTRL_TILTMAP_H
+#define _MSCTRL_TILTMAP_H
+
+#include <src/MasterSystem.h>
+#include <src/Controller.h>
+#include <src/GyroMap.h>
+
+namespace MSCtrl
+{
+  /**
+   * Maps the absolute tilt of the controller, measured from gravity,
+   * to a dpad button. Unlike GyroMap there is no reference position
+   * and no drift; tilt around the vertical (Y) axis cannot be
+   * measured this way.
+   */
+  class TiltMap : public Controller::Listener
+  {
+  public:
+    enum class Mode {
+      Accel, // Accelerometer only
+      Fused  // Complementary filter of gyro and accelerometer, less noisy when moving
+    };
+
+    TiltMap(MasterSystem&, GyroMap::Axis, MasterSystem::Button, Mode);
+
+    /**
+     * Add a trigger button; the mapping is only enabled while all
+     * trigger buttons are held
+     */
+    void add_trigger_button(Controller::Button);
+
+    /**
+     * Set the angle threshold in degrees
+     */
+    void set_angle_threshold(float);
+
+    /**
+     * Set the angle hysteresis delta in degrees
+     */
+    void set_angle_delta(float);
+
+    unsigned subscriptions() const override {
+      return ButtonEvents | AccelEvents | ((m_mode == Mode::Fused) ? GyroEvents : 0);
+    }
+
+    void add_to(Controller&) override;
+    void on_button_state(Controller&, Controller::Button, bool) override;
+    void on_gyro_update(Controller&, uint64_t, float, float, float) override;
+    void on_accel_update(Controller&, uint64_t, float, float, float) override;
+
+    static std::string mode_name(Mode);
+    static Mode mode_from_name(const std::string&);
+
+  private:
+    MasterSystem& m_ms;
+    GyroMap::Axis m_axis;
+    MasterSystem::Button m_button;
+    Mode m_mode;
+    bool m_button_state;
+    float m_threshold;
+    float m_angle_delta;
+
+    // Filtered angle (rad), and integrated gyro angle at the last
+    // gyro sample
+    float m_angle;
+    bool m_has_angle;
+    float m_last_gyro_angle;
+    bool m_has_gyro_angle;
+
+    uint16_t m_trigger_buttons;
+    uint16_t m_pressed_buttons;
+
+    void update_button(Controller&);
+  };
+}
+
+#endif /* _MSCTRL_TILTMAP_H */
@@ -0,0 +1,247 @@
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/timerfd.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "UDPInput.h"
+#include "SDLMain.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // Keep clear of SDL joystick instance ids, and of evdev's
+  const SDL_JoystickID FirstId = 0x20000;
+
+  // msctrl-send repeats the state at least this often
+  const uint64_t CheckInterval = 100000000;
+  const uint64_t SilenceTimeout = 500000000;
+}
+
+namespace MSCtrl
+{
+  UDPInput::UDPInput(const string& spec)
+    : m_spec(spec),
+      m_fd(-1),
+      m_timer_fd(-1),
+      m_remotes(),
+      m_counters(),
+      m_buffers(),
+      m_iovecs(),
+      m_messages()
+  {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    auto sep = spec.rfind(':');
+    string port = (sep == string::npos) ? spec : spec.substr(sep + 1);
+    if ((sep != string::npos) && (inet_pton(AF_INET, spec.substr(0, sep).c_str(), &addr.sin_addr) != 1))
+      throw runtime_error(fmt::format("Invalid address \"{}\"", spec.substr(0, sep)));
+    if (port.empty() || (port.find_first_not_of("0123456789") != string::npos) || (stoi(port) > 65535))
+      throw runtime_error(fmt::format("Invalid port \"{}\"", port));
+    addr.sin_port = htons(stoi(port));
+
+    m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+      throw runtime_error(fmt::format("Cannot create UDP socket: {}", strerror(errno)));
+
+    if (bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+      int error = errno;
+      close(m_fd);
+      throw runtime_error(fmt::format("Cannot listen on UDP {}: {}", spec, strerror(error)));
+    }
+
+    for (unsigned index = 0; index < Batch; ++index) {
+      m_iovecs[index].iov_base = m_buffers[index].data();
+      m_iovecs[index].iov_len = m_buffers[index].size();
+      m_messages[index].msg_hdr.msg_iov = &m_iovecs[index];
+      m_messages[index].msg_hdr.msg_iovlen = 1;
+    }
+  }
+
+  UDPInput::~UDPInput()
+  {
+    if (m_counters.received != 0)
+      spdlog::info("UDP input: {} packets, {} invalid, {} out of order, {} lost, {} timeouts",
+                   m_counters.received, m_counters.invalid, m_counters.dropped, m_counters.lost, m_counters.timeouts);
+
+    if (m_timer_fd >= 0)
+      close(m_timer_fd);
+    close(m_fd);
+  }
+
+  string UDPInput::name() const
+  {
+    return fmt::format("UDP ({})", m_spec);
+  }
+
+  uint16_t UDPInput::port() const
+  {
+    struct sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+    if (getsockname(m_fd, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0)
+      return 0;
+    return ntohs(addr.sin_port);
+  }
+
+  void UDPInput::start(SDLMain&)
+  {
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timer_fd < 0)
+      throw runtime_error(fmt::format("Cannot create timer: {}", strerror(errno)));
+
+    struct itimerspec spec = {};
+    spec.it_interval.tv_nsec = CheckInterval;
+    spec.it_value.tv_nsec = CheckInterval;
+    timerfd_settime(m_timer_fd, 0, &spec, nullptr);
+  }
+
+  vector<int> UDPInput::fds() const
+  {
+    return { m_fd, m_timer_fd };
+  }
+
+  void UDPInput::on_readable(SDLMain& main, int fd)
+  {
+    if (fd == m_timer_fd) {
+      uint64_t expirations;
+      if (read(m_timer_fd, &expirations, sizeof(expirations)) > 0)
+        check_timeouts(main, monotonic_ns());
+      return;
+    }
+
+    while (true) {
+      int count = recvmmsg(m_fd, m_messages.data(), Batch, MSG_DONTWAIT, nullptr);
+      if (count < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN)
+          spdlog::warn("Cannot receive from UDP {}: {}", m_spec, strerror(errno));
+        return;
+      }
+
+      uint64_t now = monotonic_ns();
+      for (int index = 0; index < count; ++index) {
+        RemotePacket packet;
+        ++m_counters.received;
+        if (packet.decode(m_buffers[index].data(), m_messages[index].msg_len) && (packet.pad < MaxPads))
+          handle_packet(main, packet, now);
+        else
+          ++m_counters.invalid;
+      }
+
+      if (count < static_cast<int>(Batch))
+        return;
+    }
+  }
+
+  void UDPInput::handle_packet(SDLMain& main, const RemotePacket& packet, uint64_t now)
+  {
+    Remote& remote = m_remotes[packet.pad];
+
+    if (!remote.active && (packet.flags & RemotePacket::Bye))
+      return;
+
+    if (!remote.active) {
+      remote.ctrl = main.open_controller(FirstId + packet.pad, fmt::format("Remote pad {}", packet.pad));
+      if (!remote.ctrl)
+        return;
+      remote.active = true;
+      remote.gyro_clock = now / 1000;
+      remote.state = RemotePacket();
+    } else if (packet.session == remote.session) {
+      // Serial number arithmetic, so that the sequence may wrap
+      int32_t delta = static_cast<int32_t>(packet.sequence - remote.sequence);
+      if (delta <= 0) {
+        ++m_counters.dropped;
+        return;
+      }
+      m_counters.lost += delta - 1;
+    } else {
+      spdlog::info("Remote pad {} restarted", packet.pad);
+      remote.state.flags &= ~RemotePacket::Gyro;
+    }
+
+    remote.session = packet.session;
+    remote.sequence = packet.sequence;
+    remote.last_packet = now;
+    remote.silent = false;
+
+    if (packet.flags & RemotePacket::Bye) {
+      apply(main, remote, RemotePacket(), now);
+      main.close_controller(FirstId + packet.pad);
+      remote.active = false;
+      return;
+    }
+
+    apply(main, remote, packet, now);
+  }
+
+  void UDPInput::apply(SDLMain& main, Remote& remote, const RemotePacket& packet, uint64_t now)
+  {
+    uint32_t changed = remote.state.buttons ^ packet.buttons;
+    bool commit = (changed != 0);
+    for (unsigned btn = 0; changed && (btn < SDL_CONTROLLER_BUTTON_MAX); ++btn) {
+      if (changed & (1U << btn)) {
+        main.stamp_event(LatencyStats::EventType::Button, now);
+        if (packet.buttons & (1U << btn))
+          remote.ctrl->on_button_press(btn);
+        else
+          remote.ctrl->on_button_release(btn);
+      }
+    }
+
+    for (unsigned axis = 0; axis < RemotePacket::AxisCount; ++axis) {
+      if (packet.axes[axis] != remote.state.axes[axis]) {
+        main.stamp_event(LatencyStats::EventType::Axis, now);
+        remote.ctrl->on_axis_motion(axis, packet.axes[axis]);
+        // Triggers are buttons for the mappings
+        commit = commit || (axis == SDL_CONTROLLER_AXIS_TRIGGERLEFT) || (axis == SDL_CONTROLLER_AXIS_TRIGGERRIGHT);
+      }
+    }
+
+    // Sample times are in the sender's time base, only their intervals
+    // are used. A repeated sample is not applied again, and the first
+    // one (or one going back in time) only restarts integration.
+    bool had_gyro = remote.state.flags & RemotePacket::Gyro;
+    if ((packet.flags & RemotePacket::Gyro) && (!had_gyro || (packet.gyro_time != remote.state.gyro_time))) {
+      if (had_gyro && (packet.gyro_time > remote.state.gyro_time))
+        remote.gyro_clock += packet.gyro_time - remote.state.gyro_time;
+
+      main.stamp_event(LatencyStats::EventType::Gyro, now);
+      remote.ctrl->on_gyro_update(remote.gyro_clock, packet.gyro[0], packet.gyro[1], packet.gyro[2]);
+    }
+
+    remote.state = packet;
+
+    // Packets are received several at once; each one that changes a
+    // button is written on its own so that taps are not lost
+    if (commit)
+      main.commit_snapshot();
+  }
+
+  void UDPInput::check_timeouts(SDLMain& main, uint64_t now)
+  {
+    for (unsigned pad = 0; pad < MaxPads; ++pad) {
+      Remote& remote = m_remotes[pad];
+      if (!remote.active || remote.silent || (now - remote.last_packet < SilenceTimeout))
+        continue;
+
+      // Do not leave buttons held when the network goes away
+      spdlog::warn("Remote pad {} went silent, releasing its buttons", pad);
+      ++m_counters.timeouts;
+      remote.silent = true;
+      apply(main, remote, RemotePacket(), now);
+    }
+  }
+}
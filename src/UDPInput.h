@@ -0,0 +1,91 @@
+
+#ifndef _MSCTRL_UDPINPUT_H
+#define _MSCTRL_UDPINPUT_H
+
+#include <array>
+
+#include <sys/socket.h>
+
+#include <src/InputSource.h>
+#include <src/Controller.h>
+#include <src/RemotePacket.h>
+
+namespace MSCtrl
+{
+  /**
+   * Receives controller state sent by msctrl-send over UDP. Each pad
+   * index becomes a controller, opened on its first packet; the
+   * differences with the previous state are fed to it like SDL events.
+   * Packets that are not newer than the last one applied for their pad
+   * are dropped. When a pad goes silent, its buttons are released and
+   * its axes centered. The receive path does not allocate.
+   */
+  class UDPInput : public InputSource
+  {
+  public:
+    static constexpr unsigned MaxPads = 4;
+
+    struct Counters {
+      uint64_t received;
+      uint64_t invalid;
+      uint64_t dropped;  // Out of order or duplicated
+      uint64_t lost;     // Sequence numbers never seen
+      uint64_t timeouts;
+    };
+
+    /**
+     * @param spec [address:]port to listen on
+     */
+    UDPInput(const std::string& spec);
+    ~UDPInput();
+
+    UDPInput(const UDPInput&) = delete;
+    UDPInput& operator=(const UDPInput&) = delete;
+
+    std::string name() const override;
+
+    void start(SDLMain&) override;
+    std::vector<int> fds() const override;
+    void on_readable(SDLMain&, int fd) override;
+
+    /**
+     * Bound port, when listening on port 0
+     */
+    uint16_t port() const;
+
+    const Counters& counters() const {
+      return m_counters;
+    }
+
+  private:
+    static constexpr unsigned Batch = 16;
+
+    struct Remote {
+      Controller* ctrl;
+      bool active;
+      bool silent;
+      uint32_t session;
+      uint32_t sequence;
+      uint64_t last_packet;
+      uint64_t gyro_clock; // us, advanced by the sender's sample intervals
+      RemotePacket state;
+    };
+
+    std::string m_spec;
+    int m_fd;
+    int m_timer_fd;
+    std::array<Remote, MaxPads> m_remotes;
+    Counters m_counters;
+
+    // recvmmsg buffers, one byte larger than a packet to catch longer ones
+    std::array<std::array<uint8_t, RemotePacket::Size + 1>, Batch> m_buffers;
+    std::array<struct iovec, Batch> m_iovecs;
+    std::array<struct mmsghdr, Batch> m_messages;
+
+    void handle_packet(SDLMain&, const RemotePacket&, uint64_t now);
+    void apply(SDLMain&, Remote&, const RemotePacket&, uint64_t now);
+    void check_timeouts(SDLMain&, uint64_t now);
+  };
+}
+
+#endif /* _MSCTRL_UDPINPUT_H */
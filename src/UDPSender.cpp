@@ -0,0 +1,235 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "UDPSender.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+  // Well under UDPInput's silence timeout, so that a lost packet or two
+  // do not release the buttons
+  const uint64_t KeepAliveInterval = 100000000;
+
+  bool sdl_button(MSCtrl::Controller::Button btn, uint8_t& dst)
+  {
+    using MSCtrl::Controller;
+
+    switch (btn) {
+      case Controller::Button::A:
+        dst = SDL_CONTROLLER_BUTTON_A;
+        break;
+      case Controller::Button::B:
+        dst = SDL_CONTROLLER_BUTTON_B;
+        break;
+      case Controller::Button::X:
+        dst = SDL_CONTROLLER_BUTTON_X;
+        break;
+      case Controller::Button::Y:
+        dst = SDL_CONTROLLER_BUTTON_Y;
+        break;
+      case Controller::Button::LeftShoulder:
+        dst = SDL_CONTROLLER_BUTTON_LEFTSHOULDER;
+        break;
+      case Controller::Button::RightShoulder:
+        dst = SDL_CONTROLLER_BUTTON_RIGHTSHOULDER;
+        break;
+      case Controller::Button::DPadLeft:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_LEFT;
+        break;
+      case Controller::Button::DPadRight:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_RIGHT;
+        break;
+      case Controller::Button::DPadUp:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_UP;
+        break;
+      case Controller::Button::DPadDown:
+        dst = SDL_CONTROLLER_BUTTON_DPAD_DOWN;
+        break;
+      case Controller::Button::Start:
+        dst = SDL_CONTROLLER_BUTTON_START;
+        break;
+      case Controller::Button::Back:
+        dst = SDL_CONTROLLER_BUTTON_BACK;
+        break;
+      default:
+        // Triggers travel as axes
+        return false;
+    }
+
+    return true;
+  }
+}
+
+namespace MSCtrl
+{
+  UDPSender::UDPSender(const string& destination, uint8_t pad, bool gyro)
+    : m_fd(-1),
+      m_gyro(gyro),
+      m_controller(nullptr),
+      m_lock(),
+      m_wakeup(),
+      m_state(),
+      m_dirty(true),
+      m_changed_buttons(0),
+      m_gyro_pending(false),
+      m_stopping(false),
+      m_last_send(0),
+      m_sent(0),
+      m_keepalive()
+  {
+    auto sep = destination.rfind(':');
+    if ((sep == string::npos) || (sep == 0))
+      throw runtime_error(fmt::format("Invalid destination \"{}\", expected host:port", destination));
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo* result;
+    int error = getaddrinfo(destination.substr(0, sep).c_str(), destination.substr(sep + 1).c_str(), &hints, &result);
+    if (error != 0)
+      throw runtime_error(fmt::format("Cannot resolve {}: {}", destination, gai_strerror(error)));
+
+    m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if ((m_fd < 0) || (connect(m_fd, result->ai_addr, result->ai_addrlen) < 0)) {
+      error = errno;
+      freeaddrinfo(result);
+      if (m_fd >= 0)
+        close(m_fd);
+      throw runtime_error(fmt::format("Cannot send to {}: {}", destination, strerror(error)));
+    }
+    freeaddrinfo(result);
+
+    // A restarted sender must not look like old packets
+    m_state.pad = pad;
+    m_state.session = random_device()();
+
+    m_keepalive = thread(&UDPSender::keepalive, this);
+  }
+
+  UDPSender::~UDPSender()
+  {
+    {
+      lock_guard<mutex> lock(m_lock);
+      m_stopping = true;
+      m_state.flags = RemotePacket::Bye;
+      send();
+    }
+    m_wakeup.notify_one();
+    m_keepalive.join();
+
+    if (m_controller && m_gyro)
+      m_controller->release_gyro();
+    close(m_fd);
+  }
+
+  void UDPSender::add_to(Controller& ctrl)
+  {
+    if (m_controller)
+      throw runtime_error("UDP sender already has a controller");
+
+    m_controller = &ctrl;
+    ctrl.add_listener(this);
+    if (m_gyro)
+      ctrl.request_gyro();
+  }
+
+  void UDPSender::on_button_state(Controller&, Controller::Button btn, bool state)
+  {
+    uint8_t bit;
+    if (!sdl_button(btn, bit))
+      return;
+
+    uint32_t mask = 1U << bit;
+
+    lock_guard<mutex> lock(m_lock);
+    if (((m_state.buttons & mask) != 0) == state)
+      return;
+
+    // A press and release within one batch must not cancel out
+    if (m_changed_buttons & mask)
+      send();
+
+    m_state.buttons ^= mask;
+    m_changed_buttons |= mask;
+    m_dirty = true;
+  }
+
+  void UDPSender::on_axis_motion(Controller&, Controller::Axis axis, float value)
+  {
+    long raw = lroundf(value * SDL_JOYSTICK_AXIS_MAX);
+
+    lock_guard<mutex> lock(m_lock);
+    m_state.axes[static_cast<unsigned>(axis)] = max<long>(SDL_JOYSTICK_AXIS_MIN, min<long>(SDL_JOYSTICK_AXIS_MAX, raw));
+    m_dirty = true;
+  }
+
+  void UDPSender::on_gyro_update(Controller&, uint64_t timestamp, float dx, float dy, float dz)
+  {
+    lock_guard<mutex> lock(m_lock);
+    // Several samples may come in one batch; each is needed, with its
+    // own time, for the receiver to integrate the same angle
+    if (m_gyro_pending)
+      send();
+
+    m_state.gyro[0] = dx;
+    m_state.gyro[1] = dy;
+    m_state.gyro[2] = dz;
+    m_state.gyro_time = timestamp;
+    m_state.flags |= RemotePacket::Gyro;
+    m_gyro_pending = true;
+    m_dirty = true;
+  }
+
+  void UDPSender::flush()
+  {
+    lock_guard<mutex> lock(m_lock);
+    if (m_dirty)
+      send();
+  }
+
+  void UDPSender::send()
+  {
+    uint8_t data[RemotePacket::Size];
+
+    ++m_state.sequence;
+    m_state.time = monotonic_ns();
+    m_state.encode(data);
+
+    // Nobody listening yet shows up as ECONNREFUSED; the state is sent
+    // again anyway
+    if ((::send(m_fd, data, sizeof(data), 0) < 0) && (errno != ECONNREFUSED))
+      spdlog::warn("Cannot send controller state: {}", strerror(errno));
+
+    m_dirty = false;
+    m_changed_buttons = 0;
+    m_gyro_pending = false;
+    m_last_send = m_state.time;
+    ++m_sent;
+  }
+
+  void UDPSender::keepalive()
+  {
+    unique_lock<mutex> lock(m_lock);
+
+    while (!m_wakeup.wait_for(lock, chrono::nanoseconds(KeepAliveInterval), [this]() { return m_stopping; })) {
+      if (monotonic_ns() - m_last_send >= KeepAliveInterval)
+        send();
+    }
+  }
+}
@@ -0,0 +1,75 @@
+
+#ifndef _MSCTRL_UDPSENDER_H
+#define _MSCTRL_UDPSENDER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <src/Controller.h>
+#include <src/RemotePacket.h>
+
+namespace MSCtrl
+{
+  /**
+   * Sending side of UDPInput: tracks the state of a controller and
+   * sends it whole, once per event batch when it changed (flush()),
+   * before each button change or gyro sample that would overwrite an
+   * unsent one, and
+   * from a keep-alive thread often enough that the receiver does
+   * not consider the pad silent. A Bye packet is sent on destruction.
+   */
+  class UDPSender : public Controller::Listener
+  {
+  public:
+    /**
+     * @param destination host:port of the msctrl instance
+     * @param pad Pad index on the receiving side
+     * @param gyro Also send gyro rates
+     */
+    UDPSender(const std::string& destination, uint8_t pad, bool gyro = false);
+    ~UDPSender();
+
+    UDPSender(const UDPSender&) = delete;
+    UDPSender& operator=(const UDPSender&) = delete;
+
+    unsigned subscriptions() const override {
+      return ButtonEvents | AxisEvents | (m_gyro ? GyroEvents : 0);
+    }
+
+    void add_to(Controller&) override;
+
+    void on_button_state(Controller&, Controller::Button, bool) override;
+    void on_axis_motion(Controller&, Controller::Axis, float) override;
+    void on_gyro_update(Controller&, uint64_t, float, float, float) override;
+
+    /**
+     * Send the state if it changed since the last packet
+     */
+    void flush();
+
+    uint64_t sent() const {
+      return m_sent;
+    }
+
+  private:
+    int m_fd;
+    bool m_gyro;
+    Controller* m_controller;
+    std::mutex m_lock;
+    std::condition_variable m_wakeup;
+    RemotePacket m_state;
+    bool m_dirty;
+    uint32_t m_changed_buttons;
+    bool m_gyro_pending;
+    bool m_stopping;
+    uint64_t m_last_send;
+    uint64_t m_sent;
+    std::thread m_keepalive;
+
+    void send();
+    void keepalive();
+  };
+}
+
+#endif /* _MSCTRL_UDPSENDER_H */
@@ -0,0 +1,180 @@
+
+#include <iostream>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+
+#include <pwd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "MasterSystem.h"
+#include "OutputRing.h"
+#include "RingServer.h"
+#include "Realtime.h"
+#include "utils.h"
+
+using namespace std;
+using namespace MSCtrl;
+
+/*
+ * The only part of msctrl that needs the privileges to drive the
+ * GPIOs: it owns the output backend and applies the changes that an
+ * unprivileged msctrl -B ring sends through shared memory.
+ */
+
+namespace
+{
+  void usage()
+  {
+    auto backends = OutputBackend::names();
+    backends.remove("ring");
+
+    cerr << "Usage: msctrl-outputd [options]" << endl;
+    cerr << "  -B, --backend <name>   Select how GPIOs are driven: " << join_strings(", ", backends.begin(), backends.end()) << endl;
+    cerr << "                         (default " << OutputBackend::default_name() << ")" << endl;
+    cerr << "  -n, --name <name>      Shared memory name (default " << OutputRing::DefaultName << ")" << endl;
+    cerr << "  -u, --user <user>      Owner of the shared memory, that is, the user running msctrl" << endl;
+    cerr << "                         (default: the one who ran sudo)" << endl;
+    cerr << "  -g, --gpios <n,...>    GPIOs clients may drive (default: msctrl's wiring)" << endl;
+    cerr << "  -s, --spin <us>        Keep polling that long after each change before sleeping (default 0)" << endl;
+    cerr << "  --rt-priority <n>      Run with SCHED_FIFO priority n (1-99, default 50)" << endl;
+    cerr << "  --rt-cpu <n>           Pin to the specified CPU" << endl;
+    cerr << "  -h, --help             Display this help" << endl;
+  }
+
+  int parse_user(const string& user)
+  {
+    if (!user.empty() && (user.find_first_not_of("0123456789") == string::npos))
+      return stoi(user);
+
+    struct passwd* pw = getpwnam(user.c_str());
+    if (!pw)
+      throw runtime_error(fmt::format("Unknown user \"{}\"", user));
+    return pw->pw_uid;
+  }
+
+  uint32_t parse_gpios(const string& spec)
+  {
+    uint32_t pins = 0;
+
+    split_string(spec, ',', [&pins](const string& part) {
+      if (part.empty() || (part.find_first_not_of("0123456789") != string::npos) || (stoi(part) > 31))
+        throw runtime_error(fmt::format("Invalid GPIO \"{}\"", part));
+      pins |= 1U << stoi(part);
+    });
+
+    return pins;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  spdlog::set_level(spdlog::level::info);
+
+  try {
+    string backend = OutputBackend::default_name();
+    string name = OutputRing::DefaultName;
+    int uid = getenv("SUDO_UID") ? atoi(getenv("SUDO_UID")) : -1;
+    uint32_t allowed = MasterSystem().output_pins();
+    uint64_t spin = 0;
+    unique_ptr<Realtime> realtime(nullptr);
+
+    for (int i = 1; i < argc; ++i) {
+      string option = argv[i];
+
+      if ((option == "-h") || (option == "--help")) {
+        usage();
+        return 0;
+      }
+
+      static const list<string> options = {
+        "-B", "--backend", "-n", "--name", "-u", "--user", "-g", "--gpios", "-s", "--spin", "--rt-priority", "--rt-cpu"
+      };
+      if (find(options.begin(), options.end(), option) == options.end()) {
+        usage();
+        throw runtime_error(fmt::format("Unknown option \"{}\"", option));
+      }
+      if (i + 1 == argc) {
+        usage();
+        throw runtime_error(fmt::format("{} without value", option));
+      }
+      string value = argv[++i];
+
+      if ((option == "-B") || (option == "--backend")) {
+        backend = value;
+      } else if ((option == "-n") || (option == "--name")) {
+        name = (value[0] == '/') ? value : "/" + value;
+      } else if ((option == "-u") || (option == "--user")) {
+        uid = parse_user(value);
+      } else if ((option == "-g") || (option == "--gpios")) {
+        allowed = parse_gpios(value);
+      } else if ((option == "-s") || (option == "--spin")) {
+        if (value.find_first_not_of("0123456789") != string::npos)
+          throw runtime_error(fmt::format("Invalid spin time \"{}\"", value));
+        spin = stoul(value) * 1000;
+      } else if ((option == "--rt-priority") || (option == "--rt-cpu")) {
+        if (value.empty() || (value.size() > 9) || (value.find_first_not_of("0123456789") != string::npos))
+          throw runtime_error(fmt::format("Invalid value \"{}\" for {}", value, option));
+        if (!realtime)
+          realtime.reset(new Realtime());
+        if (option == "--rt-priority")
+          realtime->set_priority(stoi(value));
+        else
+          realtime->set_cpu(stoi(value));
+      }
+    }
+
+    if (backend.substr(0, backend.find(':')) == "ring")
+      throw runtime_error("msctrl-outputd cannot use the ring backend");
+
+    // Only the signal thread gets them
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    unique_ptr<OutputBackend> output(OutputBackend::create(backend));
+    RingServer server(OutputRing::create(name, uid), output.release(), allowed);
+    server.set_spin(spin);
+
+    thread signals([&server, sigs]() {
+      int sig;
+      while (sigwait(&sigs, &sig) == 0) {
+        if (sig != SIGUSR1)
+          break;
+        server.dump_stats();
+      }
+      server.stop();
+    });
+
+    spdlog::info("Serving GPIO mask {:#010x} through {}", allowed, name);
+
+    try {
+      if (realtime)
+        realtime->apply();
+      server.run();
+    } catch (...) {
+      // The signal thread must be joined before the error is reported
+      pthread_kill(signals.native_handle(), SIGTERM);
+      signals.join();
+      throw;
+    }
+
+    signals.join();
+    server.dump_stats();
+  } catch (const exception& exc) {
+    cerr << "Error: " << exc.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+
+#include <iostream>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "SDLMain.h"
+#include "EvdevInput.h"
+#include "UDPInput.h"
+#include "UDPSender.h"
+
+using namespace std;
+using namespace MSCtrl;
+
+/*
+ * Sends the controllers of this machine to an msctrl instance started
+ * with -U, so that a gamepad in another room can drive the console.
+ */
+
+namespace
+{
+  void usage()
+  {
+    cerr << "Usage: msctrl-send [options] <host>:<port>" << endl;
+    cerr << "  -E, --evdev <node>     Read a gamepad from its /dev/input/event* node instead of SDL (\"auto\" for all)." << endl;
+    cerr << "                         This option can be repeated." << endl;
+    cerr << "  -g, --gyro             Also send gyro rates" << endl;
+    cerr << "  --gyro-rate <hz>       Average gyro samples down to this rate (default: the sensor's rate)" << endl;
+    cerr << "  -h, --help             Display this help" << endl;
+  }
+}
+
+class Sender : public SDLMain
+{
+public:
+  Sender(const string& destination, bool gyro, float gyro_rate)
+    : m_destination(destination),
+      m_gyro(gyro),
+      m_gyro_rate(gyro_rate),
+      m_senders() {
+  }
+
+  bool on_controller_added(const string& name) override {
+    if (m_senders.size() < UDPInput::MaxPads)
+      return true;
+
+    spdlog::warn("Ignoring {}, {} controllers are already sent", name, UDPInput::MaxPads);
+    return false;
+  }
+
+  void on_controller_open(Controller& ctrl) override {
+    // First pad index not in use
+    uint8_t pad = 0;
+    while (any_of(m_senders.begin(), m_senders.end(), [pad](const auto& entry) { return entry.second.first == pad; }))
+      ++pad;
+
+    unique_ptr<UDPSender> sender(new UDPSender(m_destination, pad, m_gyro));
+    ctrl.set_gyro_rate(m_gyro_rate);
+    sender->add_to(ctrl);
+
+    spdlog::info("Sending {} to {} as pad {}", ctrl.name(), m_destination, pad);
+    m_senders[ctrl.id()] = make_pair(pad, move(sender));
+  }
+
+  void on_controller_close(Controller& ctrl) override {
+    auto it = m_senders.find(ctrl.id());
+    if (it == m_senders.end())
+      return;
+
+    ctrl.remove_listener(it->second.second.get());
+    spdlog::info("{} packets sent for pad {}", it->second.second->sent(), it->second.first);
+    m_senders.erase(it);
+  }
+
+  void on_events_processed() override {
+    for (auto& entry : m_senders)
+      entry.second.second->flush();
+  }
+
+  void on_dump_stats() override {
+    for (auto& entry : m_senders)
+      spdlog::info("Pad {}: {} packets sent", entry.second.first, entry.second.second->sent());
+  }
+
+private:
+  string m_destination;
+  bool m_gyro;
+  float m_gyro_rate;
+  map<SDL_JoystickID, pair<uint8_t, unique_ptr<UDPSender>>> m_senders;
+};
+
+int main(int argc, char* argv[])
+{
+  spdlog::set_level(spdlog::level::info);
+
+  try {
+    string destination;
+    list<string> evdev;
+    bool gyro = false;
+    float gyro_rate = 0.0f;
+
+    for (int i = 1; i < argc; ++i) {
+      string option = argv[i];
+
+      if ((option == "-h") || (option == "--help")) {
+        usage();
+        return 0;
+      } else if ((option == "-g") || (option == "--gyro")) {
+        gyro = true;
+      } else if ((option == "-E") || (option == "--evdev") || (option == "--gyro-rate")) {
+        if (i + 1 == argc) {
+          usage();
+          throw runtime_error(fmt::format("{} without value", option));
+        }
+        if (option == "--gyro-rate")
+          gyro_rate = stof(argv[++i]);
+        else
+          evdev.push_back(argv[++i]);
+      } else if ((option[0] != '-') && destination.empty()) {
+        destination = option;
+      } else {
+        usage();
+        throw runtime_error(fmt::format("Unexpected argument \"{}\"", option));
+      }
+    }
+
+    if (destination.empty()) {
+      usage();
+      throw runtime_error("No destination");
+    }
+
+    Sender sender(destination, gyro, gyro_rate);
+    for (const auto& path : evdev)
+      sender.add_input_source(new EvdevInput(path));
+
+    sender.loop();
+  } catch (const exception& exc) {
+    cerr << "Error: " << exc.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -6,8 +6,12 @@
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
 
+#include <src/Configure.h>
+
 #include "SDLMain.h"
 #include "CLParser.h"
+#include "Realtime.h"
+#include "CalibrationCache.h"
 
 using namespace std;
 using namespace MSCtrl;
@@ -18,13 +22,21 @@ public:
   Dispatcher(int argc, char* argv[])
     : m_ms(),
       m_trigger_threshold(0.5f),
-      m_remappings() {
+      m_gyro_rate(0.0f),
+      m_remappings(),
+      m_latency(),
+      m_realtime(nullptr),
+      m_calibration(nullptr),
+      m_peripheral(nullptr) {
     try {
       parse(m_ms, *this, argc, argv);
     } catch (const exception&) {
       usage();
       throw;
     }
+
+    set_latency_stats(&m_latency);
+    m_ms.set_latency_stats(&m_latency);
   }
 
   bool on_controller_added(const string& name) override {
@@ -32,9 +44,31 @@ public:
   }
 
   void on_controller_open(Controller& ctrl) override {
+    ctrl.set_trigger_threshold(m_trigger_threshold);
+    ctrl.set_gyro_rate(m_gyro_rate);
+    if (m_calibration)
+      m_calibration->add_to(ctrl);
+    if (m_peripheral)
+      m_peripheral->add_to(ctrl);
     for (auto& ptr : m_remappings)
       ptr->add_to(ctrl);
-    ctrl.set_trigger_threshold(m_trigger_threshold);
+  }
+
+  void on_events_processed() override {
+    m_ms.commit();
+  }
+
+  void on_dump_stats() override {
+    m_latency.dump();
+
+    const auto& batches = batch_counters();
+    if (batches.batches != 0)
+      spdlog::info("Event batches: n={}, mean={:.2f}, max={}, coalesced axis events={}",
+                   batches.batches, static_cast<double>(batches.events) / batches.batches,
+                   batches.largest, batches.coalesced);
+
+    if (m_peripheral)
+      m_peripheral->dump_stats();
   }
 
   void add_map(Controller::Listener* map) override {
@@ -46,10 +80,61 @@ public:
     m_trigger_threshold = value;
   }
 
+  void set_gyro_rate(float rate) override {
+    spdlog::debug("Gyro rate: {}", rate);
+    m_gyro_rate = rate;
+  }
+
+  void set_record_file(const string& filename) override {
+    SDLMain::set_record_file(filename);
+  }
+
+  void set_replay_file(const string& filename, bool realtime) override {
+    SDLMain::set_replay_file(filename, realtime);
+  }
+
+  void add_input_source(InputSource* source) override {
+    SDLMain::add_input_source(source);
+  }
+
+  void set_calibration_cache(const string& filename) override {
+#ifdef ENABLE_GYRO_CALIBRATION
+    m_calibration.reset(new CalibrationCache(filename));
+#else
+    spdlog::warn("Gyro calibration is disabled, ignoring calibration cache {}", filename);
+#endif
+  }
+
+  void set_realtime(Realtime* realtime) override {
+    m_realtime.reset(realtime);
+  }
+
+  void set_peripheral(Peripheral* peripheral) override {
+    m_peripheral.reset(peripheral);
+  }
+
+  void run() {
+    // Last, so that SDL's and the signal threads keep the default policy
+    if (m_realtime)
+      m_realtime->apply();
+
+    // Started after, to inherit the memory locking and by default the
+    // scheduling policy
+    if (m_peripheral)
+      m_peripheral->start();
+
+    loop();
+  }
+
 private:
   MasterSystem m_ms;
   float m_trigger_threshold;
+  float m_gyro_rate;
   list<unique_ptr<Controller::Listener>> m_remappings;
+  LatencyStats m_latency;
+  unique_ptr<Realtime> m_realtime;
+  unique_ptr<CalibrationCache> m_calibration;
+  unique_ptr<Peripheral> m_peripheral;
 };
 
 int main(int argc, char* argv[]) {
@@ -58,7 +143,7 @@ int main(int argc, char* argv[]) {
   try {
     Dispatcher sdl(argc, argv);
 
-    sdl.loop();
+    sdl.run();
   } catch (const CLParser::usage_exception&) {
     // Nothing
   } catch (const exception& exc) {
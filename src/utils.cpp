@@ -1,4 +1,6 @@
 
+#include <time.h>
+
 #include "utils.h"
 
 using namespace std;
@@ -57,4 +59,11 @@ namespace MSCtrl
     unsigned int index = 0;
     split_string(s, sep, [&](const string& part) { cb(index++, part); });
   }
+
+  uint64_t monotonic_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+  }
 }
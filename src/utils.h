@@ -2,6 +2,7 @@
 #ifndef _MSCTRL_UTILS_H
 #define _MSCTRL_UTILS_H
 
+#include <cstdint>
 #include <string>
 #include <functional>
 #include <sstream>
@@ -11,6 +12,11 @@ namespace MSCtrl
   void split_string(const std::string& s, char sep, const std::function<void (const std::string&)>& cb);
   void split_string(const std::string& s, char sep, const std::function<void (unsigned, const std::string&)>& cb);
 
+  /**
+   * CLOCK_MONOTONIC time in nanoseconds
+   */
+  uint64_t monotonic_ns();
+
   template <typename InputIterator> std::string join_strings(const std::string& sep, InputIterator begin, InputIterator end) {
     bool first = true;
     std::ostringstream oss;